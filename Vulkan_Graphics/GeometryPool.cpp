@@ -0,0 +1,242 @@
+#include "GeometryPool.h"
+
+#include <cmath>
+
+#include <glm/gtc/packing.hpp>
+
+// 5 bits red, 6 green, 5 blue
+static uint16_t packRgb565(const glm::vec3& color)
+{
+	glm::vec3 c = glm::clamp(color, 0.0f, 1.0f);
+	return static_cast<uint16_t>((static_cast<uint32_t>(std::round(c.r * 31.0f)) << 11)
+		| (static_cast<uint32_t>(std::round(c.g * 63.0f)) << 5)
+		| static_cast<uint32_t>(std::round(c.b * 31.0f)));
+}
+
+// Quantizes to the mesh bounds, the range gets what the vertex shader needs to undo it
+static void packVertices(const std::vector<Vertex>& vertices, std::vector<PackedVertex>* packedVertices, GeometryRange* range)
+{
+	glm::vec3 minPos = vertices[0].pos;
+	glm::vec3 maxPos = vertices[0].pos;
+	bool constantColor = true;
+	for (const Vertex& vertex : vertices)
+	{
+		minPos = glm::min(minPos, vertex.pos);
+		maxPos = glm::max(maxPos, vertex.pos);
+		constantColor = constantColor && vertex.col == vertices[0].col;
+	}
+
+	// Flat axes keep a scale of 1 so nothing divides by 0
+	glm::vec3 extent = maxPos - minPos;
+	for (int i = 0; i < 3; i++)
+	{
+		if (extent[i] <= 0.0f) extent[i] = 1.0f;
+	}
+	range->positionOffset = minPos;
+	range->positionScale = extent;
+	// A constant color goes to the draw at full precision and the vertices multiply it by white
+	// Otherwise the draw is white and each vertex keeps its own color as RGB565
+	range->color = glm::packUnorm4x8(glm::vec4(constantColor ? vertices[0].col : glm::vec3(1.0f), 1.0f));
+
+	packedVertices->resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const Vertex& vertex = vertices[i];
+		PackedVertex& packed = (*packedVertices)[i];
+
+		glm::vec3 position = glm::clamp((vertex.pos - minPos) / extent, 0.0f, 1.0f);
+		for (int j = 0; j < 3; j++)
+		{
+			packed.pos[j] = static_cast<uint16_t>(std::round(position[j] * 65535.0f));
+		}
+		packed.pos[3] = constantColor ? 0xFFFF : packRgb565(vertex.col);
+
+		// Octahedral: project on the octahedron, fold the lower half over the upper one
+		glm::vec3 normal = vertex.normal / std::max(std::abs(vertex.normal.x) + std::abs(vertex.normal.y) + std::abs(vertex.normal.z), 1e-20f);
+		glm::vec2 octahedral(normal.x, normal.y);
+		if (normal.z < 0.0f)
+		{
+			octahedral.x = (1.0f - std::abs(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+			octahedral.y = (1.0f - std::abs(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		packed.normal = glm::packSnorm2x16(octahedral);
+		packed.tex = glm::packHalf2x16(vertex.tex);
+	}
+}
+
+GeometryPool::GeometryPool()
+{
+}
+
+void GeometryPool::create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VertexFormat newVertexFormat,
+	uint32_t newVertexCapacity, uint32_t newIndexCapacity, uint32_t newShortIndexCapacity)
+{
+	physicalDevice = newPhysicalDevice;
+	device = newDevice;
+	vertexFormat = newVertexFormat;
+	vertexAllocator.create(newVertexCapacity);
+	indexAllocator.create(newIndexCapacity);
+	shortIndexAllocator.create(newShortIndexCapacity);
+
+	// Memory is on the GPU and only accessible by it, filled through transfers
+	createBuffer(physicalDevice, device, static_cast<VkDeviceSize>(getVertexStride(vertexFormat)) * newVertexCapacity,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
+
+	createBuffer(physicalDevice, device, sizeof(uint32_t) * newIndexCapacity,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
+
+	createBuffer(physicalDevice, device, sizeof(uint16_t) * newShortIndexCapacity,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &shortIndexBuffer, &shortIndexBufferMemory);
+}
+
+void GeometryPool::destroy()
+{
+	vkDestroyBuffer(device, vertexBuffer, nullptr);
+	vkFreeMemory(device, vertexBufferMemory, nullptr);
+	vkDestroyBuffer(device, indexBuffer, nullptr);
+	vkFreeMemory(device, indexBufferMemory, nullptr);
+	vkDestroyBuffer(device, shortIndexBuffer, nullptr);
+	vkFreeMemory(device, shortIndexBufferMemory, nullptr);
+}
+
+GeometryRange GeometryPool::upload(VkQueue transferQueue, VkCommandPool transferCommandPool,
+	std::vector<Vertex>* vertices, std::vector<uint32_t>* indices, bool allowShortIndices)
+{
+	// Indices are relative to vertexOffset, under 65536 vertices they fit in 16 bits
+	bool shortIndices = allowShortIndices && vertices->size() < 65536;
+	RangeAllocator& typeIndexAllocator = shortIndices ? shortIndexAllocator : indexAllocator;
+
+	GeometryRange range = {};
+	range.indexType = shortIndices ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	range.positionOffset = glm::vec3(0.0f);
+	range.positionScale = glm::vec3(1.0f);
+	range.color = glm::packUnorm4x8(glm::vec4(1.0f));
+
+	// Nothing to draw, nothing to copy
+	if (vertices->empty() || indices->empty())
+	{
+		return range;
+	}
+
+	uint32_t vertexOffset;
+	if (!vertexAllocator.allocate(static_cast<uint32_t>(vertices->size()), &vertexOffset))
+	{
+		throw std::runtime_error("Geometry pool is full");
+	}
+	if (!typeIndexAllocator.allocate(static_cast<uint32_t>(indices->size()), &range.firstIndex))
+	{
+		vertexAllocator.free(vertexOffset, static_cast<uint32_t>(vertices->size()));
+		throw std::runtime_error("Geometry pool is full");
+	}
+	range.vertexOffset = static_cast<int32_t>(vertexOffset);
+	range.vertexCount = static_cast<uint32_t>(vertices->size());
+	range.indexCount = static_cast<uint32_t>(indices->size());
+
+	std::vector<PackedVertex> packedVertices;
+	const void* vertexData = vertices->data();
+	if (vertexFormat == VERTEX_FORMAT_PACKED)
+	{
+		packVertices(*vertices, &packedVertices, &range);
+		vertexData = packedVertices.data();
+	}
+
+	std::vector<uint16_t> shortIndexData;
+	const void* indexData = indices->data();
+	if (shortIndices)
+	{
+		shortIndexData.assign(indices->begin(), indices->end());
+		indexData = shortIndexData.data();
+	}
+
+	// One staging buffer for both, vertices first then indices
+	VkDeviceSize vertexStride = getVertexStride(vertexFormat);
+	VkDeviceSize vertexSize = vertexStride * vertices->size();
+	VkDeviceSize indexStride = shortIndices ? sizeof(uint16_t) : sizeof(uint32_t);
+	VkDeviceSize indexSize = indexStride * indices->size();
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	createBuffer(physicalDevice, device, vertexSize + indexSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		&stagingBuffer, &stagingBufferMemory);
+
+	void* data;
+	vkMapMemory(device, stagingBufferMemory, 0, vertexSize + indexSize, 0, &data);
+	memcpy(data, vertexData, (size_t)vertexSize);
+	memcpy(static_cast<char*>(data) + vertexSize, indexData, (size_t)indexSize);
+	vkUnmapMemory(device, stagingBufferMemory);
+
+	// Copy both to their ranges in the pool buffers
+	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, vertexSize,
+		0, vertexStride * static_cast<VkDeviceSize>(range.vertexOffset));
+	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, shortIndices ? shortIndexBuffer : indexBuffer, indexSize,
+		vertexSize, indexStride * static_cast<VkDeviceSize>(range.firstIndex));
+
+	vkDestroyBuffer(device, stagingBuffer, nullptr);
+	vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+	return range;
+}
+
+void GeometryPool::free(const GeometryRange& range)
+{
+	vertexAllocator.free(static_cast<uint32_t>(range.vertexOffset), range.vertexCount);
+	RangeAllocator& typeIndexAllocator = range.indexType == VK_INDEX_TYPE_UINT16 ? shortIndexAllocator : indexAllocator;
+	typeIndexAllocator.free(range.firstIndex, range.indexCount);
+}
+
+VkBuffer GeometryPool::getVertexBuffer()
+{
+	return vertexBuffer;
+}
+
+VkBuffer GeometryPool::getIndexBuffer(VkIndexType indexType)
+{
+	return indexType == VK_INDEX_TYPE_UINT16 ? shortIndexBuffer : indexBuffer;
+}
+
+VertexFormat GeometryPool::getVertexFormat()
+{
+	return vertexFormat;
+}
+
+uint32_t GeometryPool::getVertexStride(VertexFormat format)
+{
+	return format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex) : sizeof(Vertex);
+}
+
+void GeometryPool::getVertexInputDescription(VertexFormat format, VkVertexInputBindingDescription* bindingDescription,
+	std::vector<VkVertexInputAttributeDescription>* attributeDescriptions)
+{
+	// Description for single Vertex as whole
+	bindingDescription->binding = 0;
+	bindingDescription->stride = getVertexStride(format);
+	bindingDescription->inputRate = VK_VERTEX_INPUT_RATE_VERTEX;		// How to move between data after each vertex
+
+	// Location, format and offset of each attribute, locations match shader.vert
+	if (format == VERTEX_FORMAT_PACKED)
+	{
+		// Color is in pos.w, times the color of the draw
+		*attributeDescriptions = {
+			{ 0, 0, VK_FORMAT_R16G16B16A16_UNORM, static_cast<uint32_t>(offsetof(PackedVertex, pos)) },
+			{ 2, 0, VK_FORMAT_R16G16_SFLOAT, static_cast<uint32_t>(offsetof(PackedVertex, tex)) },
+			{ 3, 0, VK_FORMAT_R16G16_SNORM, static_cast<uint32_t>(offsetof(PackedVertex, normal)) }
+		};
+	}
+	else
+	{
+		*attributeDescriptions = {
+			{ 0, 0, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, pos)) },
+			{ 1, 0, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, col)) },
+			{ 2, 0, VK_FORMAT_R32G32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, tex)) },
+			{ 3, 0, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, normal)) }
+		};
+	}
+}
+
+GeometryPool::~GeometryPool()
+{
+}
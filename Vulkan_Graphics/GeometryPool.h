@@ -0,0 +1,71 @@
+#pragma once
+
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+
+#include <vector>
+
+#include "utils.h"
+#include "RangeAllocator.h"
+
+// Location of one mesh inside the shared vertex and index buffers
+// Packed positions are stored / scale - offset, float ones have offset 0 and scale 1
+struct GeometryRange {
+	int32_t vertexOffset;
+	uint32_t vertexCount;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	VkIndexType indexType;		// Picks the index buffer firstIndex is in
+	glm::vec3 positionOffset;
+	glm::vec3 positionScale;
+	uint32_t color;				// RGBA8 of the whole mesh when packed, white when the vertex colors vary
+};
+
+// One device local vertex buffer and two index buffers (32 and 16 bit) shared by every mesh of the scene
+// All draws bind them once per index type, so indirect commands built on the GPU can reference any mesh
+// Ranges are sub-allocated first fit, freed ranges are reused by later uploads
+class GeometryPool
+{
+public:
+	GeometryPool();
+
+	void create(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VertexFormat newVertexFormat,
+		uint32_t newVertexCapacity, uint32_t newIndexCapacity, uint32_t newShortIndexCapacity);
+	void destroy();
+
+	// Copies the mesh data through a staging buffer, waits for the copy, vertices are converted to the pool format
+	// Without allowShortIndices the indices stay 32 bit whatever the vertex count
+	GeometryRange upload(VkQueue transferQueue, VkCommandPool transferCommandPool,
+		std::vector<Vertex>* vertices, std::vector<uint32_t>* indices, bool allowShortIndices);
+	// Range goes back to the pool, no draw still in flight may read it
+	void free(const GeometryRange& range);
+
+	VkBuffer getVertexBuffer();
+	VkBuffer getIndexBuffer(VkIndexType indexType);
+	VertexFormat getVertexFormat();
+
+	// Vertex input state for pipelines drawing from a pool of this format, binding 0
+	static uint32_t getVertexStride(VertexFormat format);
+	static void getVertexInputDescription(VertexFormat format, VkVertexInputBindingDescription* bindingDescription,
+		std::vector<VkVertexInputAttributeDescription>* attributeDescriptions);
+
+	~GeometryPool();
+
+private:
+	VkPhysicalDevice physicalDevice;
+	VkDevice device;
+	VertexFormat vertexFormat = VERTEX_FORMAT_FLOAT;
+
+	VkBuffer vertexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory vertexBufferMemory = VK_NULL_HANDLE;
+	RangeAllocator vertexAllocator;
+
+	VkBuffer indexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory indexBufferMemory = VK_NULL_HANDLE;
+	RangeAllocator indexAllocator;
+
+	// Meshes under 65536 vertices
+	VkBuffer shortIndexBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory shortIndexBufferMemory = VK_NULL_HANDLE;
+	RangeAllocator shortIndexAllocator;
+};
@@ -1,2 +1,22 @@
 #include "Light.h"
 
+#include <cmath>
+
+LightParams createLightParams(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane,
+	VkExtent2D extent, uint32_t lightCount)
+{
+	LightParams params = {};
+	params.view = view;
+	params.projection = glm::vec4(projection[0][0], projection[1][1], nearPlane, farPlane);
+	params.screenSize = glm::vec2(static_cast<float>(extent.width), static_cast<float>(extent.height));
+
+	// Slice z covers near * (far / near)^(z / LIGHT_GRID_Z) to the next one, froxels stay about as deep as wide
+	float logRatio = std::log(farPlane / nearPlane);
+	params.sliceScale = static_cast<float>(LIGHT_GRID_Z) / logRatio;
+	params.sliceBias = -static_cast<float>(LIGHT_GRID_Z) * std::log(nearPlane) / logRatio;
+	params.lightCount = lightCount;
+	params.projectionP22 = projection[2][2];
+	params.projectionP32 = projection[3][2];
+
+	return params;
+}
@@ -3,49 +3,30 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
-#include <vector>
+#include <glm/glm.hpp>
 
 #include "utils.h"
 
-struct LightBufferObject {
-	glm::mat3 position;
-	glm::vec3 color;
+// Point light as stored in the light storage buffer, same layout as PointLight in the shaders (std430)
+struct PointLight {
+	glm::vec4 positionRadius;	// World position, w range at which the light has faded to 0
+	glm::vec4 color;			// Color times intensity, w unused
 };
 
-
-class Light
-{
-public:
-
-	Light();
-
-	Light(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
-		VkQueue transferQueue, VkCommandPool transferCommandPool, 
-		const glm::vec3 &position, const glm::vec3 &color, const glm::vec3 &intensity);
-
-	void setLBO(LightBufferObject newLight);
-	LightBufferObject getLBO();
-
-	void destroyLBO();
-
-	~Light();
-private:
-	 LightBufferObject lightBufferObject;
-
-	int texId;
-
-	int vertexCount;
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
-
-	int indexCount;
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
-
-
-	VkPhysicalDevice physicalDevice;
-	VkDevice device;
-	
-	void createLightBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<LightBufferObject>* Lights);
+// Per frame uniform shared by the light assignment compute and the fragment shader
+// Froxel slice of a view depth d: floor(log(d) * sliceScale + sliceBias), exponential between the near and far planes
+struct LightParams {
+	glm::mat4 view;
+	glm::vec4 projection;		// P00, P11, near, far
+	glm::vec2 screenSize;
+	float sliceScale;
+	float sliceBias;
+	uint32_t lightCount;
+	float projectionP22;		// With P32, turns a depth buffer value back into view depth for deferred lighting
+	float projectionP32;
+	uint32_t padding;
 };
 
+// Light parameters of a frame, near and far are the planes of the perspective projection
+LightParams createLightParams(const glm::mat4& view, const glm::mat4& projection, float nearPlane, float farPlane,
+	VkExtent2D extent, uint32_t lightCount);
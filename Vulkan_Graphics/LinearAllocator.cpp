@@ -0,0 +1,163 @@
+#include "LinearAllocator.h"
+
+#include <stdexcept>
+#include <utility>
+
+LinearAllocator::LinearAllocator()
+{
+}
+
+LinearAllocator::LinearAllocator(LinearAllocator&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+LinearAllocator& LinearAllocator::operator=(LinearAllocator&& other) noexcept
+{
+	if (this != &other)
+	{
+		destroy();
+
+		memory = other.memory;
+		capacity = other.capacity;
+		offset = other.offset;
+		ownsMemory = other.ownsMemory;
+		overflowBlocks = std::move(other.overflowBlocks);
+		overflowBytes = other.overflowBytes;
+		overflowCount = other.overflowCount;
+
+		other.memory = nullptr;
+		other.capacity = 0;
+		other.offset = 0;
+		other.ownsMemory = false;
+		other.overflowBytes = 0;
+	}
+	return *this;
+}
+
+void LinearAllocator::create(size_t newCapacity)
+{
+	destroy();
+
+	memory = new uint8_t[newCapacity];
+	capacity = newCapacity;
+	offset = 0;
+	ownsMemory = true;
+}
+
+void LinearAllocator::createExternal(void* newMemory, size_t newCapacity)
+{
+	destroy();
+
+	memory = static_cast<uint8_t*>(newMemory);
+	capacity = newCapacity;
+	offset = 0;
+	ownsMemory = false;
+}
+
+void LinearAllocator::destroy()
+{
+	for (uint8_t* block : overflowBlocks)
+	{
+		delete[] block;
+	}
+	overflowBlocks.clear();
+	overflowBytes = 0;
+
+	if (ownsMemory)
+	{
+		delete[] memory;
+	}
+	memory = nullptr;
+	capacity = 0;
+	offset = 0;
+	ownsMemory = false;
+}
+
+void* LinearAllocator::allocate(size_t size, size_t alignment)
+{
+	// Round offset up to alignment (power of 2)
+	size_t alignedOffset = (offset + alignment - 1) & ~(alignment - 1);
+
+	if (alignedOffset + size <= capacity)
+	{
+		offset = alignedOffset + size;
+		return memory + alignedOffset;
+	}
+
+	// GPU buffers are sized up front, running out is a bug
+	if (!ownsMemory)
+	{
+		throw std::runtime_error("Linear allocator out of memory");
+	}
+
+	// Keep the frame going from the heap, block grows on next reset so the following frames fit
+	overflowCount++;
+	overflowBytes += size + alignment;
+	uint8_t* block = new uint8_t[size + alignment];
+	overflowBlocks.push_back(block);
+
+	uintptr_t address = reinterpret_cast<uintptr_t>(block);
+	return reinterpret_cast<void*>((address + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1));
+}
+
+void* LinearAllocator::getMemory()
+{
+	return memory;
+}
+
+size_t LinearAllocator::getOffset(const void* allocation)
+{
+	return static_cast<size_t>(static_cast<const uint8_t*>(allocation) - memory);
+}
+
+size_t LinearAllocator::getMarker()
+{
+	return offset;
+}
+
+void LinearAllocator::reset(size_t marker)
+{
+	if (!overflowBlocks.empty())
+	{
+		size_t requiredCapacity = offset + overflowBytes;
+
+		for (uint8_t* block : overflowBlocks)
+		{
+			delete[] block;
+		}
+		overflowBlocks.clear();
+		overflowBytes = 0;
+
+		// Grow once so the steady state stays inside the block, only possible when nothing is kept
+		if (marker == 0)
+		{
+			size_t newCapacity = capacity * 2 > requiredCapacity ? capacity * 2 : requiredCapacity;
+			delete[] memory;
+			memory = new uint8_t[newCapacity];
+			capacity = newCapacity;
+		}
+	}
+
+	offset = marker;
+}
+
+size_t LinearAllocator::getUsed()
+{
+	return offset;
+}
+
+size_t LinearAllocator::getCapacity()
+{
+	return capacity;
+}
+
+uint32_t LinearAllocator::getOverflowCount()
+{
+	return overflowCount;
+}
+
+LinearAllocator::~LinearAllocator()
+{
+	destroy();
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bump allocator for per frame transient data, everything is released at once with reset()
+// Either owns a heap block (CPU frame arenas) or wraps external memory (persistently mapped GPU buffers)
+// Alignment is relative to the start of the block, which is what GPU buffer offsets need
+class LinearAllocator
+{
+public:
+	LinearAllocator();
+
+	LinearAllocator(const LinearAllocator&) = delete;
+	LinearAllocator& operator=(const LinearAllocator&) = delete;
+	LinearAllocator(LinearAllocator&& other) noexcept;
+	LinearAllocator& operator=(LinearAllocator&& other) noexcept;
+
+	// Owned block, when a frame overflows it the block grows on the next reset()
+	void create(size_t newCapacity);
+	// External block, never grows, overflow throws
+	void createExternal(void* newMemory, size_t newCapacity);
+	void destroy();
+
+	void* allocate(size_t size, size_t alignment);
+
+	template<typename T>
+	T* allocateArray(size_t count)
+	{
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	// Start of the block and offset of an allocation from it
+	void* getMemory();
+	size_t getOffset(const void* allocation);
+
+	// Allocations made before a marker survive reset(marker), used for persistent regions of GPU buffers
+	size_t getMarker();
+	void reset(size_t marker = 0);
+
+	size_t getUsed();
+	size_t getCapacity();
+	uint32_t getOverflowCount();
+
+	~LinearAllocator();
+
+private:
+	uint8_t* memory = nullptr;
+	size_t capacity = 0;
+	size_t offset = 0;
+	bool ownsMemory = false;
+
+	// Owned blocks only: allocations that did not fit, freed on reset
+	std::vector<uint8_t*> overflowBlocks;
+	size_t overflowBytes = 0;
+	uint32_t overflowCount = 0;
+};
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+
+// Number of global operator new calls since startup
+// Sampled around a frame to check the render path does not touch the heap in steady state
+uint64_t getHeapAllocationCount();
@@ -1,32 +1,59 @@
 #include "Mesh.h"
 
+#include <algorithm>
+
 Mesh::Mesh()
 {
 }
 
-Mesh::Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
-	VkQueue transferQueue, VkCommandPool transferCommandPool,
-	std::vector<Vertex>* vertices, std::vector<uint32_t> * indices, int newTexId)
+Mesh::Mesh(GeometryPool* geometryPool, VkQueue transferQueue, VkCommandPool transferCommandPool,
+	std::vector<Vertex>* vertices, std::vector<std::vector<uint32_t>>* lodIndices, std::vector<float>* lodErrors,
+	std::vector<MeshCluster>* newClusters, int newTexId, float newOpacity)
 {
-	vertexCount = vertices->size();
-	indexCount = indices->size();
-	physicalDevice = newPhysicalDevice;
-	device = newDevice;
-	createVertexBuffer(transferQueue, transferCommandPool, vertices);
-	createIndexBuffer(transferQueue, transferCommandPool, indices);
+	// LODs back to back in one upload, ranges are relative to the start of the mesh
+	std::vector<uint32_t> indices;
+	lodCount = static_cast<uint32_t>(std::min(lodIndices->size(), static_cast<size_t>(MAX_MESH_LODS)));
+	for (uint32_t i = 0; i < lodCount; i++)
+	{
+		lods[i].firstIndex = static_cast<uint32_t>(indices.size());
+		lods[i].indexCount = static_cast<uint32_t>((*lodIndices)[i].size());
+		lods[i].error = (*lodErrors)[i];
+		indices.insert(indices.end(), (*lodIndices)[i].begin(), (*lodIndices)[i].end());
+	}
+
+	// Transparent meshes go to the single sorted list of the transparent pass, which draws from the 32 bit buffer
+	geometry = geometryPool->upload(transferQueue, transferCommandPool, vertices, &indices, newOpacity >= 1.0f);
+	if (geometry.indexCount == 0)
+	{
+		lodCount = 0;
+	}
+	for (uint32_t i = 0; i < lodCount; i++)
+	{
+		lods[i].firstIndex += geometry.firstIndex;
+	}
+
+	// LOD 0 is first in the upload, clusters move with it
+	if (lodCount > 0)
+	{
+		clusters = *newClusters;
+		for (MeshCluster& cluster : clusters)
+		{
+			cluster.firstIndex += lods[0].firstIndex;
+		}
+	}
 
-	model.model = glm::mat4(1.0f);
 	texId = newTexId;
+	opacity = newOpacity;
 }
 
-void Mesh::setModel(glm::mat4 newModel)
+void Mesh::setTransformNode(uint32_t newTransformNode)
 {
-	model.model = newModel;
+	transformNode = newTransformNode;
 }
 
-Model Mesh::getModel()
+uint32_t Mesh::getTransformNode()
 {
-	return model;
+	return transformNode;
 }
 
 int Mesh::getTexId()
@@ -34,105 +61,57 @@ int Mesh::getTexId()
 	return texId;
 }
 
-
-VkBuffer Mesh::getVertexBuffer()
+float Mesh::getOpacity()
 {
-	return vertexBuffer;
+	return opacity;
 }
 
-int Mesh::getVertexCount()
+void Mesh::setBounds(const MeshBounds& newBounds)
 {
-	return vertexCount;
+	bounds = newBounds;
 }
 
-int Mesh::getIndexCount()
+MeshBounds Mesh::getBounds()
 {
-	return indexCount;
+	return bounds;
 }
 
-VkBuffer Mesh::getIndexBuffer()
+
+GeometryRange Mesh::getGeometry()
 {
-	return indexBuffer;
+	return geometry;
 }
 
-
-void Mesh::destroyBuffers()
+int Mesh::getVertexCount()
 {
-	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
-	vkDestroyBuffer(device, indexBuffer, nullptr);
-	vkFreeMemory(device, indexBufferMemory, nullptr);
+	return static_cast<int>(geometry.vertexCount);
 }
 
-Mesh::~Mesh()
+int Mesh::getIndexCount()
 {
+	return lodCount > 0 ? static_cast<int>(lods[0].indexCount) : 0;
 }
 
-void Mesh::createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool,
-std::vector<Vertex>* vertices)
+VkIndexType Mesh::getIndexType()
 {
-	// Get size of buffer needed for vertices
-	VkDeviceSize bufferSize = sizeof(Vertex) * vertices->size();
-
-	// Create temporary staging buffers before transfer to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	
-
-	// Create Staging Buffer and allocate memory to it
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-		&stagingBuffer, &stagingBufferMemory);
-
-	// MAP MEMORY TO VERTEX BUFFER
-	void* data;					
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertices->data(), (size_t)bufferSize);
-	vkUnmapMemory(device, stagingBufferMemory);
-
-	// Create buffer with TRANSFER_DST_BIT as receipient of transfer data
-	// Memory is on the GPU and only accessible by it
-	createBuffer(physicalDevice, device, bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &vertexBuffer, &vertexBufferMemory);
-
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, vertexBuffer, bufferSize);
-
-	// Clean staging buffer parts
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
-
+	return geometry.indexType;
 }
 
-void Mesh::createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices)
+uint32_t Mesh::getLodCount()
 {
-	// Get size of buffer
-	VkDeviceSize bufferSize = sizeof(uint32_t) * indices->size();
-
-	// Create temporary staging buffer before transfer to GPU
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(physicalDevice, device, bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&stagingBuffer, &stagingBufferMemory);
-
-	// MAP MEMORY TO INDEX BUFFER
-	void* data;					
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices->data(), (size_t)bufferSize);
-	vkUnmapMemory(device, stagingBufferMemory);
-
-	// Create buffer for index data on GPU access only area
-	createBuffer(physicalDevice, device, bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &indexBuffer, &indexBufferMemory);
-
-	// Copy from staging buffer to GPU access buffer
-	copyBuffer(device, transferQueue, transferCommandPool, stagingBuffer, indexBuffer, bufferSize);
+	return lodCount;
+}
 
-	// Destroy and release staging buffer resources
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+MeshLod Mesh::getLod(uint32_t lod)
+{
+	return lods[lod];
+}
 
+const std::vector<MeshCluster>& Mesh::getClusters()
+{
+	return clusters;
 }
 
+Mesh::~Mesh()
+{
+}
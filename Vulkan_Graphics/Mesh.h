@@ -6,54 +6,106 @@
 #include <vector>
 
 #include "utils.h"
+#include "GeometryPool.h"
 
+// Per object data read by the vertex shader from the object storage buffer
+// normal holds the inverse transpose of the model 3x3 (computed on the CPU once per frame)
+// and the camera world position in its last column, so the shader needs no inverse()
+// previousModel is the model of the frame before, for the motion vectors of temporal anti-aliasing
 struct Model {
 	glm::mat4 model;
+	glm::mat4 normal;
+	glm::mat4 previousModel;
 };
 
 
+// Local space bounds of a mesh, computed at import
+struct MeshBounds {
+	glm::vec3 aabbMin;
+	glm::vec3 aabbMax;
+	glm::vec4 sphere;		// xyz centre, w radius
+};
+
+// One level of detail of a mesh: index range in the geometry pool and its simplification error (model units)
+// Every LOD of a mesh uses the same vertices
+struct MeshLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+	uint32_t padding;
+};
+
+// Cluster of the full detail mesh, index range in the geometry pool
+// cone is the normal cone: xyz axis, w sine of the angle left for the view direction, 1 when it can not be backfacing
+// Same layout as DrawCluster in cull.comp (std430), the draw of a cluster comes from the per frame cluster draw list
+struct MeshCluster {
+	glm::vec4 boundingSphere;	// Local space
+	glm::vec4 cone;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	uint32_t padding[2];
+};
+
+// Flattened draw data, one per mesh in the scene, built when a model is added
+// Same layout as DrawData in the shaders (std430), the list is copied as is to the draw data storage buffer
+// Indirect commands use the draw index as firstInstance, shaders find transform and texture from it
+struct DrawItem {
+	glm::vec4 boundingSphere;	// Local space, for culling
+	glm::vec4 positionOffset;	// Local position = offset + stored position * scale (xyz)
+	glm::vec4 positionScale;
+	uint32_t transformId;		// Index in the object storage buffer
+	uint32_t texId;				// Index in the texture array
+	int32_t vertexOffset;		// In the geometry pool
+	uint32_t lodCount;
+	uint32_t firstCluster;		// In the scene cluster list, used instead of LOD 0 when clusterCount > 0
+	uint32_t clusterCount;
+	uint32_t color;				// RGBA8, rgb multiplies the RGB565 vertex color of packed vertices, a is the material opacity
+	uint32_t shortIndices;		// 1 when the indices are in the 16 bit buffer, also the command list the draw goes to
+	MeshLod lods[MAX_MESH_LODS];
+};
+
 class Mesh
 {
 public:
 
 	Mesh();
 
-	Mesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, 
-		VkQueue transferQueue, VkCommandPool transferCommandPool,
-		std::vector<Vertex> *vertices, std::vector<uint32_t>* indices, int newTexId);
+	// lodIndices[0] is the full mesh, lodErrors holds one error per LOD, clusters index into lodIndices[0]
+	Mesh(GeometryPool* geometryPool, VkQueue transferQueue, VkCommandPool transferCommandPool,
+		std::vector<Vertex> *vertices, std::vector<std::vector<uint32_t>>* lodIndices, std::vector<float>* lodErrors,
+		std::vector<MeshCluster>* newClusters, int newTexId, float newOpacity);
 
-	void setModel(glm::mat4 newModel);
-	Model getModel();
+	// Node of the transform hierarchy the mesh is placed by
+	void setTransformNode(uint32_t newTransformNode);
+	uint32_t getTransformNode();
 
 	int getTexId();
+	// Material opacity, under 1 the mesh is drawn in the transparent pass
+	float getOpacity();
 
-	int getVertexCount();
-	VkBuffer getVertexBuffer();
+	void setBounds(const MeshBounds& newBounds);
+	MeshBounds getBounds();
 
+	GeometryRange getGeometry();
+	int getVertexCount();
 	int getIndexCount();
-	VkBuffer getIndexBuffer();
+	VkIndexType getIndexType();
 
-	void destroyBuffers();
+	uint32_t getLodCount();
+	MeshLod getLod(uint32_t lod);
+	const std::vector<MeshCluster>& getClusters();
 
 	~Mesh();
 private:
-	Model model;
-
 	int texId;
-
-	int vertexCount;
-	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
-
-	int indexCount;
-	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
-
-
-	VkPhysicalDevice physicalDevice;
-	VkDevice device;
-	
-	void createVertexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<Vertex>* vertices);
-	void createIndexBuffer(VkQueue transferQueue, VkCommandPool transferCommandPool, std::vector<uint32_t>* indices);
+	float opacity = 1.0f;
+	MeshBounds bounds = {};
+
+	// Vertices and indices of every LOD live in the shared geometry pool
+	GeometryRange geometry = {};
+	uint32_t lodCount = 0;
+	MeshLod lods[MAX_MESH_LODS] = {};
+	std::vector<MeshCluster> clusters;
+	uint32_t transformNode = 0;
 };
 
@@ -0,0 +1,168 @@
+#include "MeshClusterizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+static void computeClusterBounds(const std::vector<Vertex>& vertices, const uint32_t* indices, uint32_t indexCount, MeshCluster* cluster)
+{
+	// Sphere around the box centre, same as the mesh bounds
+	glm::vec3 minPos = vertices[indices[0]].pos;
+	glm::vec3 maxPos = minPos;
+	for (uint32_t i = 1; i < indexCount; i++)
+	{
+		minPos = glm::min(minPos, vertices[indices[i]].pos);
+		maxPos = glm::max(maxPos, vertices[indices[i]].pos);
+	}
+
+	glm::vec3 center = (minPos + maxPos) * 0.5f;
+	float radiusSquared = 0.0f;
+	for (uint32_t i = 0; i < indexCount; i++)
+	{
+		glm::vec3 offset = vertices[indices[i]].pos - center;
+		radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+	}
+	cluster->boundingSphere = glm::vec4(center, std::sqrt(radiusSquared));
+
+	// Face normals from the winding, counter clockwise is the front face like the graphics pipeline
+	std::vector<glm::vec3> normals;
+	normals.reserve(indexCount / 3);
+	glm::vec3 axis(0.0f);
+	for (uint32_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		glm::vec3 a = vertices[indices[i]].pos;
+		glm::vec3 normal = glm::cross(vertices[indices[i + 1]].pos - a, vertices[indices[i + 2]].pos - a);
+		float length = std::sqrt(glm::dot(normal, normal));
+		if (length == 0.0f) continue;
+
+		normals.push_back(normal / length);
+		axis += normals.back();
+	}
+
+	// Cutoff 1 never culls: no usable normals or normals spread over more than a half sphere
+	cluster->cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	float axisLength = std::sqrt(glm::dot(axis, axis));
+	if (axisLength == 0.0f) return;
+	axis /= axisLength;
+
+	float minDot = 1.0f;
+	for (const glm::vec3& normal : normals)
+	{
+		minDot = std::min(minDot, glm::dot(axis, normal));
+	}
+	if (minDot <= 0.0f) return;
+
+	// Every triangle faces away once the view direction is within 90 degrees minus the cone angle of the axis
+	cluster->cone = glm::vec4(axis, std::sqrt(1.0f - minDot * minDot));
+}
+
+std::vector<MeshCluster> buildMeshClusters(const std::vector<Vertex>& vertices, std::vector<uint32_t>* indices)
+{
+	std::vector<MeshCluster> clusters;
+	uint32_t triangleCount = static_cast<uint32_t>(indices->size() / 3);
+	if (triangleCount <= MAX_CLUSTER_TRIANGLES)
+	{
+		return clusters;
+	}
+
+	// Triangles around each vertex, packed: vertexTriangles[triangleOffsets[v] .. triangleOffsets[v + 1]]
+	std::vector<uint32_t> triangleOffsets(vertices.size() + 1, 0);
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		triangleOffsets[(*indices)[i] + 1]++;
+	}
+	for (size_t v = 0; v < vertices.size(); v++)
+	{
+		triangleOffsets[v + 1] += triangleOffsets[v];
+	}
+
+	std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+	std::vector<uint32_t> fillOffsets(triangleOffsets.begin(), triangleOffsets.end() - 1);
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		vertexTriangles[fillOffsets[(*indices)[i]]++] = i / 3;
+	}
+
+	std::vector<uint8_t> used(triangleCount, 0);
+	std::vector<uint32_t> vertexCluster(vertices.size(), UINT32_MAX);		// Cluster the vertex was last added to
+	std::vector<uint32_t> clusterVertices;
+	clusterVertices.reserve(MAX_CLUSTER_VERTICES);
+
+	std::vector<uint32_t> ordered;
+	ordered.reserve(triangleCount * 3);
+
+	uint32_t nextSeed = 0;
+	while (true)
+	{
+		while (nextSeed < triangleCount && used[nextSeed]) nextSeed++;
+		if (nextSeed == triangleCount) break;
+
+		uint32_t clusterId = static_cast<uint32_t>(clusters.size());
+		MeshCluster cluster = {};
+		cluster.firstIndex = static_cast<uint32_t>(ordered.size());
+		clusterVertices.clear();
+
+		uint32_t triangle = nextSeed;
+		uint32_t clusterTriangles = 0;
+		while (true)
+		{
+			used[triangle] = 1;
+			for (uint32_t k = 0; k < 3; k++)
+			{
+				uint32_t vertex = (*indices)[triangle * 3 + k];
+				if (vertexCluster[vertex] != clusterId)
+				{
+					vertexCluster[vertex] = clusterId;
+					clusterVertices.push_back(vertex);
+				}
+				ordered.push_back(vertex);
+			}
+
+			if (++clusterTriangles == MAX_CLUSTER_TRIANGLES) break;
+
+			// Next triangle touching the cluster that adds the fewest vertices
+			uint32_t best = UINT32_MAX;
+			uint32_t bestNewVertices = 4;
+			for (size_t i = 0; i < clusterVertices.size() && bestNewVertices > 0; i++)
+			{
+				uint32_t vertex = clusterVertices[i];
+				for (uint32_t j = triangleOffsets[vertex]; j < triangleOffsets[vertex + 1]; j++)
+				{
+					uint32_t candidate = vertexTriangles[j];
+					if (used[candidate]) continue;
+
+					uint32_t newVertices = 0;
+					for (uint32_t k = 0; k < 3; k++)
+					{
+						newVertices += vertexCluster[(*indices)[candidate * 3 + k]] != clusterId ? 1 : 0;
+					}
+
+					if (newVertices < bestNewVertices && clusterVertices.size() + newVertices <= MAX_CLUSTER_VERTICES)
+					{
+						best = candidate;
+						bestNewVertices = newVertices;
+						if (newVertices == 0) break;
+					}
+				}
+			}
+
+			// Nothing connected left: keep filling from the original order while the cluster is less than half full
+			if (best == UINT32_MAX)
+			{
+				if (clusterTriangles * 2 >= MAX_CLUSTER_TRIANGLES || clusterVertices.size() + 3 > MAX_CLUSTER_VERTICES) break;
+
+				while (nextSeed < triangleCount && used[nextSeed]) nextSeed++;
+				if (nextSeed == triangleCount) break;
+				best = nextSeed;
+			}
+
+			triangle = best;
+		}
+
+		cluster.indexCount = static_cast<uint32_t>(ordered.size()) - cluster.firstIndex;
+		computeClusterBounds(vertices, ordered.data() + cluster.firstIndex, cluster.indexCount, &cluster);
+		clusters.push_back(cluster);
+	}
+
+	indices->swap(ordered);
+	return clusters;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+
+#include "Mesh.h"
+
+// Splits a triangle list into clusters of at most MAX_CLUSTER_VERTICES vertices and MAX_CLUSTER_TRIANGLES triangles
+// Clusters grow through shared vertices so they stay compact, each gets a bounding sphere and a normal cone
+// The indices are reordered so every cluster is one contiguous range, firstIndex is relative to the start of the list
+// Meshes that fit in a single cluster return no clusters and are culled as a whole
+std::vector<MeshCluster> buildMeshClusters(const std::vector<Vertex>& vertices, std::vector<uint32_t>* indices);
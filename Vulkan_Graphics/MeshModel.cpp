@@ -1,13 +1,21 @@
 #include "MeshModel.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "MeshClusterizer.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+
 MeshModel::MeshModel()
 {
 }
 
-MeshModel::MeshModel(std::vector<Mesh> newMeshList)
+MeshModel::MeshModel(std::vector<Mesh> newMeshList, uint32_t newRootNode)
 {
     meshList = newMeshList;
-    model = glm::mat4(1.0f);
+    rootNode = newRootNode;
 }
 
 size_t MeshModel::getMeshCount()
@@ -24,22 +32,15 @@ Mesh* MeshModel::getMesh(size_t index)
     return &meshList[index];
 }
 
-glm::mat4 MeshModel::getModel()
+uint32_t MeshModel::getRootNode()
 {
-    return model;
-}
-
-void MeshModel::setModel(glm::mat4 newModel)
-{
-    model = newModel;
+    return rootNode;
 }
 
 void MeshModel::destroyMeshModel()
 {
-    for (auto& mesh : meshList)
-    {
-        mesh.destroyBuffers();
-    }
+    // Geometry belongs to the renderer geometry pool
+    meshList.clear();
 }
 
 std::vector<std::string> MeshModel::loadMaterials(const aiScene* scene)
@@ -72,30 +73,58 @@ std::vector<std::string> MeshModel::loadMaterials(const aiScene* scene)
     return textureList;
 }
 
-std::vector<Mesh> MeshModel::loadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, 
-    aiNode* node, const aiScene* scene, std::vector<int> matToTex)
+void MeshModel::loadNode(GeometryPool* geometryPool, VkQueue transferQueue, VkCommandPool transferCommandPool, 
+    TransformHierarchy* transformHierarchy, int32_t parentNode, uint32_t* nextNode,
+    aiNode* node, const aiScene* scene, std::vector<int> matToTex, std::vector<Mesh>* meshList)
 {
-    std::vector<Mesh> meshList;
+    // Assimp matrices are row major, glm is column major
+    glm::mat4 localTransform;
+    for (int row = 0; row < 4; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            localTransform[col][row] = node->mTransformation[row][col];
+        }
+    }
+    uint32_t transformNode = (*nextNode)++;
+    transformHierarchy->setNode(transformNode, parentNode, localTransform);
     
     for (size_t i = 0; i < node->mNumMeshes; i++)
     {
-        meshList.push_back(loadMesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool,
+        meshList->push_back(loadMesh(geometryPool, transferQueue, transferCommandPool,
             scene->mMeshes[node->mMeshes[i]], scene, matToTex));
+        meshList->back().setTransformNode(transformNode);
     }
 
-    // Go through each node attached to this node and load it, then append to mesh list
+    // Go through each node attached to this node and load it, appending to mesh list
     for (size_t i = 0; i < node->mNumChildren; i++)
     {
-        std::vector<Mesh> newList = loadNode(newPhysicalDevice, newDevice, transferQueue, transferCommandPool,
-            node->mChildren[i], scene, matToTex);
-        meshList.insert(meshList.end(), newList.begin(), newList.end());
+        loadNode(geometryPool, transferQueue, transferCommandPool,
+            transformHierarchy, static_cast<int32_t>(transformNode), nextNode, node->mChildren[i], scene, matToTex, meshList);
+    }
+}
 
+uint32_t MeshModel::countNodes(aiNode* node)
+{
+    uint32_t count = 1;
+    for (size_t i = 0; i < node->mNumChildren; i++)
+    {
+        count += countNodes(node->mChildren[i]);
     }
+    return count;
+}
 
-    return meshList;
+size_t MeshModel::countMeshes(aiNode* node)
+{
+    size_t count = node->mNumMeshes;
+    for (size_t i = 0; i < node->mNumChildren; i++)
+    {
+        count += countMeshes(node->mChildren[i]);
+    }
+    return count;
 }
 
-Mesh MeshModel::loadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool, 
+Mesh MeshModel::loadMesh(GeometryPool* geometryPool, VkQueue transferQueue, VkCommandPool transferCommandPool, 
     aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex)
 {
     std::vector<Vertex> vertices;
@@ -138,14 +167,100 @@ Mesh MeshModel::loadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice,
         }
     }
 
+    float sourceAcmr = computeAcmr(indices, ACMR_CACHE_SIZE);
+
+    // Clusters reorder the full detail indices, before the LODs are built from them
+    // Then vertex cache order inside each cluster (or the whole mesh) and outside facing groups first
+    std::vector<MeshCluster> clusters = buildMeshClusters(vertices, &indices);
+    if (clusters.empty())
+    {
+        optimizeVertexCache(indices.data(), indices.size());
+    }
+    for (const MeshCluster& cluster : clusters)
+    {
+        optimizeVertexCache(indices.data() + cluster.firstIndex, cluster.indexCount);
+    }
+    optimizeOverdraw(vertices, &indices, &clusters);
+
+    // LODs, each simplified from the previous one to about half its triangles
+    // Errors add up so each one is relative to the full mesh
+    std::vector<std::vector<uint32_t>> lodIndices = { indices };
+    std::vector<float> lodErrors = { 0.0f };
+    while (lodIndices.size() < MAX_MESH_LODS)
+    {
+        const std::vector<uint32_t>& previous = lodIndices.back();
+        size_t targetIndexCount = (previous.size() / 6) * 3;
+        if (targetIndexCount < 3)
+        {
+            break;
+        }
+
+        float error = 0.0f;
+        std::vector<uint32_t> lod = simplifyMesh(vertices, previous, targetIndexCount, &error);
+
+        // Stop once the mesh does not simplify much further (locked borders and seams)
+        if (lod.empty() || lod.size() * 4 > previous.size() * 3)
+        {
+            break;
+        }
+
+        std::vector<MeshCluster> noClusters;
+        optimizeVertexCache(lod.data(), lod.size());
+        optimizeOverdraw(vertices, &lod, &noClusters);
+
+        lodErrors.push_back(lodErrors.back() + error);
+        lodIndices.push_back(std::move(lod));
+    }
+
+    // Vertices in the order the LODs first use them, unused ones dropped
+    size_t sourceVertexCount = vertices.size();
+    optimizeVertexFetch(&vertices, &lodIndices);
+
+    printf("Mesh %s: ACMR %.3f -> %.3f, %zu -> %zu vertices, %zu LODs, %zu clusters\n", mesh->mName.C_Str(),
+        sourceAcmr, computeAcmr(lodIndices[0], ACMR_CACHE_SIZE), sourceVertexCount, vertices.size(), lodIndices.size(), clusters.size());
+
+    // Dissolve of the material (d in .mtl files), 1 when the file has none
+    float opacity = 1.0f;
+    scene->mMaterials[mesh->mMaterialIndex]->Get(AI_MATKEY_OPACITY, opacity);
+
     // Create new Mesh with details and return it
-    Mesh newMesh = Mesh(newPhysicalDevice, newDevice, transferQueue, transferCommandPool,
-        &vertices, &indices, matToTex[mesh->mMaterialIndex]);
+    Mesh newMesh = Mesh(geometryPool, transferQueue, transferCommandPool,
+        &vertices, &lodIndices, &lodErrors, &clusters, matToTex[mesh->mMaterialIndex], opacity);
+    newMesh.setBounds(computeBounds(vertices));
 
     return newMesh;
 
 }
 
+MeshBounds MeshModel::computeBounds(const std::vector<Vertex>& vertices)
+{
+    MeshBounds bounds = {};
+    if (vertices.empty())
+    {
+        return bounds;
+    }
+
+    bounds.aabbMin = vertices[0].pos;
+    bounds.aabbMax = vertices[0].pos;
+    for (const Vertex& vertex : vertices)
+    {
+        bounds.aabbMin = glm::min(bounds.aabbMin, vertex.pos);
+        bounds.aabbMax = glm::max(bounds.aabbMax, vertex.pos);
+    }
+
+    // Sphere around the box centre, radius from the furthest vertex (tighter than the half diagonal)
+    glm::vec3 center = (bounds.aabbMin + bounds.aabbMax) * 0.5f;
+    float radiusSquared = 0.0f;
+    for (const Vertex& vertex : vertices)
+    {
+        glm::vec3 offset = vertex.pos - center;
+        radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+    }
+    bounds.sphere = glm::vec4(center, std::sqrt(radiusSquared));
+
+    return bounds;
+}
+
 MeshModel::~MeshModel()
 {
 }
@@ -7,32 +7,41 @@
 #include <assimp/scene.h>
 
 #include "Mesh.h"
+#include "TransformHierarchy.h"
 
 class MeshModel
 {
 	public:
 		MeshModel();
-		MeshModel(std::vector<Mesh> newMeshList);
+		MeshModel(std::vector<Mesh> newMeshList, uint32_t newRootNode);
 
 		size_t getMeshCount();
 		Mesh* getMesh(size_t index);
 
-		glm::mat4 getModel();
-		void setModel(glm::mat4 newModel);
+		// Transform node above every node of the model, its local transform is the model matrix
+		uint32_t getRootNode();
 		
 		void destroyMeshModel();
 
 		static std::vector<std::string> loadMaterials(const aiScene* scene);
-		static std::vector<Mesh> loadNode(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
-			aiNode* node, const aiScene* scene, std::vector<int> matToTex);
-		static Mesh loadMesh(VkPhysicalDevice newPhysicalDevice, VkDevice newDevice, VkQueue transferQueue, VkCommandPool transferCommandPool,
+		// Sets up transform node *nextNode under parentNode for node, then the following ones for its children
+		// Meshes are placed by their node, the nodes come from a block of countNodes() nodes
+		// Each mesh is appended to meshList once uploaded, so the ones done before a failure can be given back
+		static void loadNode(GeometryPool* geometryPool, VkQueue transferQueue, VkCommandPool transferCommandPool,
+			TransformHierarchy* transformHierarchy, int32_t parentNode, uint32_t* nextNode,
+			aiNode* node, const aiScene* scene, std::vector<int> matToTex, std::vector<Mesh>* meshList);
+		static uint32_t countNodes(aiNode* node);
+		// Meshes loadNode() appends for node, one per reference so instanced meshes count every time
+		static size_t countMeshes(aiNode* node);
+		static Mesh loadMesh(GeometryPool* geometryPool, VkQueue transferQueue, VkCommandPool transferCommandPool,
 			aiMesh* mesh, const aiScene* scene, std::vector<int> matToTex);
+		static MeshBounds computeBounds(const std::vector<Vertex>& vertices);
 
 
 		~MeshModel();
 
 	private:
 		std::vector<Mesh> meshList;
-		glm::mat4 model = glm::mat4(1.0f);
+		uint32_t rootNode = 0;
 };
 
@@ -0,0 +1,326 @@
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace
+{
+	// Forsyth's scoring, cache modelled as LRU of VERTEX_CACHE_SIZE entries
+	const uint32_t VERTEX_CACHE_SIZE = 32;
+	const float CACHE_DECAY_POWER = 1.5f;
+	const float LAST_TRIANGLE_SCORE = 0.75f;
+	const float VALENCE_BOOST_SCALE = 2.0f;
+	const float VALENCE_BOOST_POWER = 0.5f;
+
+	float vertexScore(int cachePosition, uint32_t remainingTriangles)
+	{
+		// No triangle left to draw, never picked again
+		if (remainingTriangles == 0) return -1.0f;
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			// Vertices of the last triangle get a fixed score so its neighbours do not win by default
+			if (cachePosition < 3)
+			{
+				score = LAST_TRIANGLE_SCORE;
+			}
+			else
+			{
+				float scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+				score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+			}
+		}
+
+		// Favour vertices with few triangles left, so they are finished and leave the cache
+		score += VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), -VALENCE_BOOST_POWER);
+		return score;
+	}
+
+	float rangeAcmr(const uint32_t* indices, size_t indexCount, uint32_t cacheSize)
+	{
+		return computeAcmr(std::vector<uint32_t>(indices, indices + indexCount), cacheSize);
+	}
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount)
+{
+	uint32_t triangleCount = static_cast<uint32_t>(indexCount / 3);
+	if (triangleCount < 2) return;
+
+	// Compact vertex ids for the range, it is often a cluster of a much larger mesh
+	std::vector<uint32_t> uniqueVertices(indices, indices + triangleCount * 3);
+	std::sort(uniqueVertices.begin(), uniqueVertices.end());
+	uniqueVertices.erase(std::unique(uniqueVertices.begin(), uniqueVertices.end()), uniqueVertices.end());
+	uint32_t vertexCount = static_cast<uint32_t>(uniqueVertices.size());
+
+	std::vector<uint32_t> localIndices(triangleCount * 3);
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		localIndices[i] = static_cast<uint32_t>(std::lower_bound(uniqueVertices.begin(), uniqueVertices.end(), indices[i]) - uniqueVertices.begin());
+	}
+
+	// Triangles around each vertex, packed: vertexTriangles[triangleOffsets[v] .. triangleOffsets[v] + remaining[v]]
+	// Drawn triangles are swapped out of the live part of the list
+	std::vector<uint32_t> triangleOffsets(vertexCount + 1, 0);
+	for (uint32_t index : localIndices)
+	{
+		triangleOffsets[index + 1]++;
+	}
+	std::partial_sum(triangleOffsets.begin(), triangleOffsets.end(), triangleOffsets.begin());
+
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	std::vector<uint32_t> vertexTriangles(triangleCount * 3);
+	for (uint32_t i = 0; i < triangleCount * 3; i++)
+	{
+		uint32_t vertex = localIndices[i];
+		vertexTriangles[triangleOffsets[vertex] + remaining[vertex]++] = i / 3;
+	}
+
+	std::vector<float> vertexScores(vertexCount);
+	for (uint32_t v = 0; v < vertexCount; v++)
+	{
+		vertexScores[v] = vertexScore(-1, remaining[v]);
+	}
+
+	std::vector<float> triangleScores(triangleCount);
+	for (uint32_t t = 0; t < triangleCount; t++)
+	{
+		triangleScores[t] = vertexScores[localIndices[t * 3]] + vertexScores[localIndices[t * 3 + 1]] + vertexScores[localIndices[t * 3 + 2]];
+	}
+
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<int> cachePosition(vertexCount, -1);
+	uint32_t cache[VERTEX_CACHE_SIZE + 3];
+	uint32_t cacheCount = 0;
+
+	std::vector<uint32_t> result;
+	result.reserve(triangleCount * 3);
+
+	uint32_t nextCandidate = 0;
+	uint32_t bestTriangle = UINT32_MAX;
+	for (uint32_t drawn = 0; drawn < triangleCount; drawn++)
+	{
+		// Nothing in the cache has triangles left, restart from the best of the next undrawn ones
+		if (bestTriangle == UINT32_MAX)
+		{
+			while (emitted[nextCandidate]) nextCandidate++;
+			bestTriangle = nextCandidate;
+		}
+
+		uint32_t triangle = bestTriangle;
+		emitted[triangle] = 1;
+
+		// Triangle vertices go to the front of the cache, the rest shift back
+		uint32_t newCache[VERTEX_CACHE_SIZE + 3];
+		uint32_t newCacheCount = 0;
+		for (uint32_t k = 0; k < 3; k++)
+		{
+			uint32_t vertex = localIndices[triangle * 3 + k];
+			result.push_back(uniqueVertices[vertex]);
+			newCache[newCacheCount++] = vertex;
+
+			// Remove the triangle from the vertex's live list
+			uint32_t* live = vertexTriangles.data() + triangleOffsets[vertex];
+			for (uint32_t j = 0; j < remaining[vertex]; j++)
+			{
+				if (live[j] == triangle)
+				{
+					std::swap(live[j], live[remaining[vertex] - 1]);
+					break;
+				}
+			}
+			remaining[vertex]--;
+		}
+		for (uint32_t i = 0; i < cacheCount; i++)
+		{
+			uint32_t vertex = cache[i];
+			if (vertex != newCache[0] && vertex != newCache[1] && vertex != newCache[2])
+			{
+				newCache[newCacheCount++] = vertex;
+			}
+		}
+
+		// Vertices pushed out lose their cache score
+		for (uint32_t i = VERTEX_CACHE_SIZE; i < newCacheCount; i++)
+		{
+			cachePosition[newCache[i]] = -1;
+		}
+		cacheCount = std::min(newCacheCount, VERTEX_CACHE_SIZE);
+		std::copy(newCache, newCache + cacheCount, cache);
+
+		// Only the scores of vertices in the cache change, and of their triangles
+		for (uint32_t i = 0; i < newCacheCount; i++)
+		{
+			uint32_t vertex = newCache[i];
+			if (i < cacheCount)
+			{
+				cachePosition[vertex] = static_cast<int>(i);
+			}
+
+			float score = vertexScore(cachePosition[vertex], remaining[vertex]);
+			float delta = score - vertexScores[vertex];
+			vertexScores[vertex] = score;
+
+			const uint32_t* live = vertexTriangles.data() + triangleOffsets[vertex];
+			for (uint32_t j = 0; j < remaining[vertex]; j++)
+			{
+				triangleScores[live[j]] += delta;
+			}
+		}
+
+		// Best next triangle among those touching the cache
+		bestTriangle = UINT32_MAX;
+		float bestScore = -1.0f;
+		for (uint32_t i = 0; i < cacheCount; i++)
+		{
+			uint32_t vertex = cache[i];
+			const uint32_t* live = vertexTriangles.data() + triangleOffsets[vertex];
+			for (uint32_t j = 0; j < remaining[vertex]; j++)
+			{
+				if (triangleScores[live[j]] > bestScore)
+				{
+					bestScore = triangleScores[live[j]];
+					bestTriangle = live[j];
+				}
+			}
+		}
+	}
+
+	// Greedy cluster growth is often as good already, keep whichever order the FIFO model prefers
+	if (rangeAcmr(result.data(), result.size(), ACMR_CACHE_SIZE) < rangeAcmr(indices, triangleCount * 3, ACMR_CACHE_SIZE))
+	{
+		std::copy(result.begin(), result.end(), indices);
+	}
+}
+
+void optimizeOverdraw(const std::vector<Vertex>& vertices, std::vector<uint32_t>* indices, std::vector<MeshCluster>* clusters)
+{
+	uint32_t triangleCount = static_cast<uint32_t>(indices->size() / 3);
+	if (triangleCount == 0) return;
+
+	// Groups as index ranges
+	std::vector<std::pair<uint32_t, uint32_t>> groups;
+	if (!clusters->empty())
+	{
+		for (const MeshCluster& cluster : *clusters)
+		{
+			groups.push_back({ cluster.firstIndex, cluster.indexCount });
+		}
+	}
+	else
+	{
+		for (uint32_t first = 0; first < triangleCount * 3; first += OVERDRAW_GROUP_TRIANGLES * 3)
+		{
+			groups.push_back({ first, std::min(OVERDRAW_GROUP_TRIANGLES * 3, triangleCount * 3 - first) });
+		}
+	}
+	if (groups.size() < 2) return;
+
+	// Area weighted centre of the whole mesh
+	glm::vec3 meshCenter(0.0f);
+	float meshArea = 0.0f;
+	std::vector<glm::vec3> groupCenters(groups.size(), glm::vec3(0.0f));
+	std::vector<glm::vec3> groupNormals(groups.size(), glm::vec3(0.0f));
+	std::vector<float> groupAreas(groups.size(), 0.0f);
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		for (uint32_t i = groups[g].first; i < groups[g].first + groups[g].second; i += 3)
+		{
+			glm::vec3 a = vertices[(*indices)[i]].pos;
+			glm::vec3 b = vertices[(*indices)[i + 1]].pos;
+			glm::vec3 c = vertices[(*indices)[i + 2]].pos;
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			float area = std::sqrt(glm::dot(normal, normal));
+
+			glm::vec3 center = (a + b + c) / 3.0f;
+			groupCenters[g] += center * area;
+			groupNormals[g] += normal;
+			groupAreas[g] += area;
+		}
+		meshCenter += groupCenters[g];
+		meshArea += groupAreas[g];
+	}
+	if (meshArea == 0.0f) return;
+	meshCenter /= meshArea;
+
+	// Groups whose faces point away from the centre are on the outside, they go first
+	std::vector<float> sortKeys(groups.size());
+	for (size_t g = 0; g < groups.size(); g++)
+	{
+		glm::vec3 center = groupAreas[g] > 0.0f ? groupCenters[g] / groupAreas[g] : meshCenter;
+		float normalLength = std::sqrt(glm::dot(groupNormals[g], groupNormals[g]));
+		glm::vec3 normal = normalLength > 0.0f ? groupNormals[g] / normalLength : glm::vec3(0.0f);
+		sortKeys[g] = glm::dot(center - meshCenter, normal);
+	}
+
+	std::vector<uint32_t> order(groups.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&sortKeys](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<uint32_t> result;
+	result.reserve(indices->size());
+	std::vector<MeshCluster> sortedClusters;
+	sortedClusters.reserve(clusters->size());
+	for (uint32_t g : order)
+	{
+		if (!clusters->empty())
+		{
+			sortedClusters.push_back((*clusters)[g]);
+			sortedClusters.back().firstIndex = static_cast<uint32_t>(result.size());
+		}
+		result.insert(result.end(), indices->begin() + groups[g].first, indices->begin() + groups[g].first + groups[g].second);
+	}
+
+	// Trailing indices that do not form a triangle are kept as they were
+	result.insert(result.end(), indices->begin() + triangleCount * 3, indices->end());
+	indices->swap(result);
+	if (!clusters->empty())
+	{
+		clusters->swap(sortedClusters);
+	}
+}
+
+void optimizeVertexFetch(std::vector<Vertex>* vertices, std::vector<std::vector<uint32_t>>* indexLists)
+{
+	std::vector<uint32_t> remap(vertices->size(), UINT32_MAX);
+	std::vector<Vertex> result;
+	result.reserve(vertices->size());
+
+	for (std::vector<uint32_t>& indices : *indexLists)
+	{
+		for (uint32_t& index : indices)
+		{
+			if (remap[index] == UINT32_MAX)
+			{
+				remap[index] = static_cast<uint32_t>(result.size());
+				result.push_back((*vertices)[index]);
+			}
+			index = remap[index];
+		}
+	}
+
+	vertices->swap(result);
+}
+
+float computeAcmr(const std::vector<uint32_t>& indices, uint32_t cacheSize)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) return 0.0f;
+
+	// FIFO ring, a hit does not move the entry
+	std::vector<uint32_t> cache(cacheSize, UINT32_MAX);
+	uint32_t cacheHead = 0;
+	size_t misses = 0;
+	for (size_t i = 0; i < triangleCount * 3; i++)
+	{
+		if (std::find(cache.begin(), cache.end(), indices[i]) != cache.end()) continue;
+
+		cache[cacheHead] = indices[i];
+		cacheHead = (cacheHead + 1) % cacheSize;
+		misses++;
+	}
+
+	return static_cast<float>(misses) / static_cast<float>(triangleCount);
+}
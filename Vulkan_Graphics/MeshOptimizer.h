@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+
+#include "Mesh.h"
+
+// Import time reordering of mesh data, none of it changes what is drawn
+
+// Reorders the triangles of a range for the post-transform vertex cache (Forsyth's linear speed algorithm)
+void optimizeVertexCache(uint32_t* indices, size_t indexCount);
+
+// Reorders groups of triangles so the ones facing out of the mesh come first and hide the rest
+// With clusters the groups are the clusters, moved whole and their firstIndex updated
+// Otherwise the list is cut in OVERDRAW_GROUP_TRIANGLES runs, run it after optimizeVertexCache so each run stays cache friendly
+void optimizeOverdraw(const std::vector<Vertex>& vertices, std::vector<uint32_t>* indices, std::vector<MeshCluster>* clusters);
+
+// Reorders vertices by first use in the index lists and drops unused ones, every list is remapped
+void optimizeVertexFetch(std::vector<Vertex>* vertices, std::vector<std::vector<uint32_t>>* indexLists);
+
+// Average cache miss ratio (transformed vertices per triangle) for a FIFO cache of cacheSize entries
+float computeAcmr(const std::vector<uint32_t>& indices, uint32_t cacheSize);
@@ -0,0 +1,277 @@
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+	// Sum of squared distances to a set of planes, symmetric 4x4 kept as its upper triangle
+	struct Quadric {
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	};
+
+	void addPlane(Quadric& q, double a, double b, double c, double d)
+	{
+		q.a2 += a * a; q.ab += a * b; q.ac += a * c; q.ad += a * d;
+		q.b2 += b * b; q.bc += b * c; q.bd += b * d;
+		q.c2 += c * c; q.cd += c * d;
+		q.d2 += d * d;
+	}
+
+	void addQuadric(Quadric& q, const Quadric& other)
+	{
+		q.a2 += other.a2; q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+		q.b2 += other.b2; q.bc += other.bc; q.bd += other.bd;
+		q.c2 += other.c2; q.cd += other.cd;
+		q.d2 += other.d2;
+	}
+
+	double evaluate(const Quadric& q, const glm::vec3& p)
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double result = q.a2 * x * x + 2 * q.ab * x * y + 2 * q.ac * x * z + 2 * q.ad * x
+			+ q.b2 * y * y + 2 * q.bc * y * z + 2 * q.bd * y
+			+ q.c2 * z * z + 2 * q.cd * z
+			+ q.d2;
+		return std::max(result, 0.0);
+	}
+
+	// Move every use of the "from" position onto the "to" position, toVertex is the vertex to use there
+	struct Collapse {
+		uint32_t from;
+		uint32_t to;
+		uint32_t toVertex;
+		double cost;
+	};
+
+	struct PositionHash {
+		size_t operator()(const glm::vec3& p) const
+		{
+			uint32_t bits[3];
+			memcpy(bits, &p, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+
+	uint64_t edgeKey(uint32_t a, uint32_t b)
+	{
+		return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a;
+	}
+}
+
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	size_t targetIndexCount, float* resultError)
+{
+	std::vector<uint32_t> result = indices;
+	*resultError = 0.0f;
+
+	if (result.size() <= targetIndexCount || vertices.empty())
+	{
+		return result;
+	}
+
+	// Topology works on positions, vertices split by attributes share one
+	std::unordered_map<glm::vec3, uint32_t, PositionHash> positionLookup;
+	std::vector<uint32_t> positionId(vertices.size(), UINT32_MAX);
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> positionVertex;		// A vertex at each position
+	std::vector<uint32_t> positionVertexCount;	// Referenced vertices at each position, more than one is a seam
+
+	for (uint32_t index : indices)
+	{
+		if (positionId[index] != UINT32_MAX) continue;
+
+		auto inserted = positionLookup.emplace(vertices[index].pos, static_cast<uint32_t>(positions.size()));
+		if (inserted.second)
+		{
+			positions.push_back(vertices[index].pos);
+			positionVertex.push_back(index);
+			positionVertexCount.push_back(0);
+		}
+		positionId[index] = inserted.first->second;
+		positionVertexCount[inserted.first->second]++;
+	}
+
+	size_t positionCount = positions.size();
+
+	// Seams, borders (edge with one triangle) and non manifold edges never move
+	std::vector<uint8_t> locked(positionCount, 0);
+	for (size_t i = 0; i < positionCount; i++)
+	{
+		locked[i] = positionVertexCount[i] > 1;
+	}
+
+	std::unordered_map<uint64_t, uint32_t> edgeTriangles;
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		for (size_t e = 0; e < 3; e++)
+		{
+			edgeTriangles[edgeKey(positionId[result[i + e]], positionId[result[i + (e + 1) % 3]])]++;
+		}
+	}
+	for (const auto& edge : edgeTriangles)
+	{
+		if (edge.second != 2)
+		{
+			locked[edge.first >> 32] = 1;
+			locked[edge.first & 0xffffffff] = 1;
+		}
+	}
+
+	// Planes of the original triangles around each position
+	std::vector<Quadric> quadrics(positionCount, Quadric{});
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		uint32_t p0 = positionId[result[i]], p1 = positionId[result[i + 1]], p2 = positionId[result[i + 2]];
+		glm::vec3 normal = glm::cross(positions[p1] - positions[p0], positions[p2] - positions[p0]);
+		float length = glm::length(normal);
+		if (length == 0.0f) continue;
+
+		normal /= length;
+		double d = -glm::dot(normal, positions[p0]);
+		addPlane(quadrics[p0], normal.x, normal.y, normal.z, d);
+		addPlane(quadrics[p1], normal.x, normal.y, normal.z, d);
+		addPlane(quadrics[p2], normal.x, normal.y, normal.z, d);
+	}
+
+	std::vector<uint32_t> triangleOffsets(positionCount + 1);
+	std::vector<uint32_t> adjacentTriangles;
+	std::vector<Collapse> bestCollapse(positionCount);
+	std::vector<Collapse> collapses;
+	std::vector<uint8_t> touched(positionCount);
+	std::vector<uint32_t> vertexRemap(vertices.size());
+	double maxCost = 0.0;
+
+	// Passes of independent collapses, cheapest first, until the target is reached or nothing can collapse
+	while (result.size() > targetIndexCount)
+	{
+		// Triangles around each position
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (uint32_t index : result)
+		{
+			triangleOffsets[positionId[index] + 1]++;
+		}
+		for (size_t i = 0; i < positionCount; i++)
+		{
+			triangleOffsets[i + 1] += triangleOffsets[i];
+		}
+		adjacentTriangles.resize(result.size());
+		std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			adjacentTriangles[fill[positionId[result[i]]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		// Cheapest collapse of every movable position along its edges
+		for (auto& collapse : bestCollapse)
+		{
+			collapse.cost = -1.0;
+		}
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			for (size_t e = 0; e < 3; e++)
+			{
+				uint32_t fromVertex = result[i + e];
+				uint32_t toVertex = result[i + (e + 1) % 3];
+				for (int direction = 0; direction < 2; direction++)
+				{
+					uint32_t from = positionId[fromVertex];
+					uint32_t to = positionId[toVertex];
+					if (!locked[from] && from != to)
+					{
+						double cost = evaluate(quadrics[from], positions[to]) + evaluate(quadrics[to], positions[to]);
+						if (bestCollapse[from].cost < 0.0 || cost < bestCollapse[from].cost)
+						{
+							bestCollapse[from] = { from, to, toVertex, cost };
+						}
+					}
+					std::swap(fromVertex, toVertex);
+				}
+			}
+		}
+
+		collapses.clear();
+		for (const auto& collapse : bestCollapse)
+		{
+			if (collapse.cost >= 0.0) collapses.push_back(collapse);
+		}
+		if (collapses.empty()) break;
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		// Apply in order, a position is involved in one collapse per pass so the flip test stays exact
+		size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+		size_t removedTriangles = 0;
+		std::fill(touched.begin(), touched.end(), 0);
+		for (size_t i = 0; i < vertexRemap.size(); i++)
+		{
+			vertexRemap[i] = static_cast<uint32_t>(i);
+		}
+
+		for (const Collapse& collapse : collapses)
+		{
+			if (removedTriangles >= trianglesToRemove) break;
+			if (touched[collapse.from] || touched[collapse.to]) continue;
+
+			// Reject collapses that flip a remaining triangle
+			bool flipped = false;
+			size_t collapsedTriangles = 0;
+			for (uint32_t t = triangleOffsets[collapse.from]; t < triangleOffsets[collapse.from + 1] && !flipped; t++)
+			{
+				const uint32_t* triangle = &result[adjacentTriangles[t] * 3];
+				uint32_t p[3] = { positionId[triangle[0]], positionId[triangle[1]], positionId[triangle[2]] };
+				if (p[0] == collapse.to || p[1] == collapse.to || p[2] == collapse.to)
+				{
+					collapsedTriangles++;
+					continue;
+				}
+
+				glm::vec3 before[3] = { positions[p[0]], positions[p[1]], positions[p[2]] };
+				glm::vec3 after[3] = { before[0], before[1], before[2] };
+				for (int k = 0; k < 3; k++)
+				{
+					if (p[k] == collapse.from) after[k] = positions[collapse.to];
+				}
+
+				glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				flipped = glm::dot(normalBefore, normalAfter) <= 0.0f;
+			}
+			if (flipped || collapsedTriangles == 0) continue;
+
+			vertexRemap[positionVertex[collapse.from]] = collapse.toVertex;
+			addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+			maxCost = std::max(maxCost, collapse.cost);
+			removedTriangles += collapsedTriangles;
+
+			for (uint32_t t = triangleOffsets[collapse.from]; t < triangleOffsets[collapse.from + 1]; t++)
+			{
+				const uint32_t* triangle = &result[adjacentTriangles[t] * 3];
+				touched[positionId[triangle[0]]] = 1;
+				touched[positionId[triangle[1]]] = 1;
+				touched[positionId[triangle[2]]] = 1;
+			}
+		}
+
+		if (removedTriangles == 0) break;
+
+		// Rewrite the list, dropping triangles that lost an edge
+		size_t writeIndex = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			uint32_t a = vertexRemap[result[i]], b = vertexRemap[result[i + 1]], c = vertexRemap[result[i + 2]];
+			uint32_t pa = positionId[a], pb = positionId[b], pc = positionId[c];
+			if (pa == pb || pb == pc || pa == pc) continue;
+
+			result[writeIndex++] = a;
+			result[writeIndex++] = b;
+			result[writeIndex++] = c;
+		}
+		result.resize(writeIndex);
+	}
+
+	*resultError = static_cast<float>(std::sqrt(maxCost));
+	return result;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <vector>
+
+#include "utils.h"
+
+// Quadric error edge collapse on an indexed triangle list, run at import to build LODs
+// Vertices are never moved or added: a vertex collapses onto a neighbour, so every LOD shares the vertex data
+// Vertices split by attributes (uv seams), mesh borders and non manifold edges are locked to keep the outline
+
+// Simplifies until the index count reaches targetIndexCount or no valid collapse is left
+// resultError receives the largest collapse error, roughly a distance in model units
+std::vector<uint32_t> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices,
+	size_t targetIndexCount, float* resultError);
@@ -0,0 +1,94 @@
+#include "RangeAllocator.h"
+
+#include <algorithm>
+
+RangeAllocator::RangeAllocator()
+{
+}
+
+void RangeAllocator::create(uint32_t newCapacity)
+{
+	capacity = newCapacity;
+	end = 0;
+	used = 0;
+	freeRanges.clear();
+}
+
+bool RangeAllocator::allocate(uint32_t count, uint32_t* offset)
+{
+	if (count == 0)
+	{
+		*offset = 0;
+		return true;
+	}
+
+	// Holes first, the lowest one that fits
+	for (size_t i = 0; i < freeRanges.size(); i++)
+	{
+		FreeRange& range = freeRanges[i];
+		if (range.count < count) continue;
+
+		*offset = range.offset;
+		range.offset += count;
+		range.count -= count;
+		if (range.count == 0)
+		{
+			freeRanges.erase(freeRanges.begin() + i);
+		}
+		used += count;
+		return true;
+	}
+
+	if (count > capacity - end)
+	{
+		return false;
+	}
+
+	*offset = end;
+	end += count;
+	used += count;
+	return true;
+}
+
+void RangeAllocator::free(uint32_t offset, uint32_t count)
+{
+	if (count == 0) return;
+	used -= count;
+
+	// Insert in offset order, then merge with the next and previous holes
+	auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(), offset,
+		[](const FreeRange& range, uint32_t value) { return range.offset < value; });
+	next = freeRanges.insert(next, { offset, count });
+
+	if (next + 1 != freeRanges.end() && next->offset + next->count == (next + 1)->offset)
+	{
+		next->count += (next + 1)->count;
+		freeRanges.erase(next + 1);
+	}
+	if (next != freeRanges.begin() && (next - 1)->offset + (next - 1)->count == next->offset)
+	{
+		(next - 1)->count += next->count;
+		next = freeRanges.erase(next) - 1;
+	}
+
+	// A hole touching the end is not a hole anymore
+	if (next->offset + next->count == end)
+	{
+		end = next->offset;
+		freeRanges.erase(next);
+	}
+}
+
+uint32_t RangeAllocator::getEnd()
+{
+	return end;
+}
+
+uint32_t RangeAllocator::getUsed()
+{
+	return used;
+}
+
+RangeAllocator::~RangeAllocator()
+{
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// First fit allocator of [offset, offset + count) ranges inside a fixed capacity, for sub-allocating shared buffers
+// Freed ranges merge with their free neighbours, the end of the used space moves back when the last range is freed
+class RangeAllocator
+{
+public:
+	RangeAllocator();
+
+	void create(uint32_t newCapacity);
+
+	// Returns false when no free range is large enough, count 0 always succeeds at offset 0
+	bool allocate(uint32_t count, uint32_t* offset);
+	void free(uint32_t offset, uint32_t count);
+
+	// Everything is in [0, end), passes over the whole buffer stop there
+	uint32_t getEnd();
+	uint32_t getUsed();
+
+	~RangeAllocator();
+
+private:
+	struct FreeRange {
+		uint32_t offset;
+		uint32_t count;
+	};
+
+	std::vector<FreeRange> freeRanges;		// Sorted by offset, all below end
+	uint32_t capacity = 0;
+	uint32_t end = 0;
+	uint32_t used = 0;
+};
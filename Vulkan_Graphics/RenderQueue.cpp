@@ -0,0 +1,118 @@
+#include "RenderQueue.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+// 8 passes of 8 bits, the histograms of every pass are counted in one read of the keys
+static const uint32_t RADIX_BITS = 8;
+static const uint32_t RADIX_SIZE = 1 << RADIX_BITS;
+static const uint32_t RADIX_PASSES = 64 / RADIX_BITS;
+
+RenderQueue::RenderQueue()
+{
+}
+
+void RenderQueue::begin(LinearAllocator* newArena, size_t newCapacity)
+{
+	arena = newArena;
+	capacity = newCapacity;
+	count = 0;
+	keys = arena->allocateArray<uint64_t>(capacity);
+	items = arena->allocateArray<uint32_t>(capacity);
+}
+
+void RenderQueue::push(uint64_t key, uint32_t item)
+{
+	if (count >= capacity)
+	{
+		throw std::runtime_error("Render queue is full");
+	}
+
+	keys[count] = key;
+	items[count] = item;
+	count++;
+}
+
+void RenderQueue::sort()
+{
+	if (count < 2) return;
+
+	uint32_t histograms[RADIX_PASSES][RADIX_SIZE] = {};
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t key = keys[i];
+		for (uint32_t pass = 0; pass < RADIX_PASSES; pass++)
+		{
+			histograms[pass][(key >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1)]++;
+		}
+	}
+
+	uint64_t* scratchKeys = arena->allocateArray<uint64_t>(count);
+	uint32_t* scratchItems = arena->allocateArray<uint32_t>(count);
+
+	for (uint32_t pass = 0; pass < RADIX_PASSES; pass++)
+	{
+		uint32_t* histogram = histograms[pass];
+		uint32_t shift = pass * RADIX_BITS;
+
+		// Every key has the same digit (unused pipeline or material bits), the pass would not move anything
+		if (histogram[(keys[0] >> shift) & (RADIX_SIZE - 1)] == count) continue;
+
+		// Counts to start offsets, the scatter keeps equal digits in order so earlier passes stay sorted
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < RADIX_SIZE; digit++)
+		{
+			uint32_t digitCount = histogram[digit];
+			histogram[digit] = offset;
+			offset += digitCount;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t slot = histogram[(keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+			scratchKeys[slot] = keys[i];
+			scratchItems[slot] = items[i];
+		}
+
+		std::swap(keys, scratchKeys);
+		std::swap(items, scratchItems);
+	}
+}
+
+size_t RenderQueue::size()
+{
+	return count;
+}
+
+const uint32_t* RenderQueue::getItems()
+{
+	return items;
+}
+
+// Bits of a positive float sort like its value, negative depths (behind the camera) all become 0
+static uint32_t quantizeDepth(float depth)
+{
+	uint32_t depthBits = 0;
+	if (depth > 0.0f)
+	{
+		memcpy(&depthBits, &depth, sizeof(depthBits));
+	}
+	return depthBits;
+}
+
+uint64_t RenderQueue::makeKey(uint32_t pipeline, uint32_t material, float depth)
+{
+	uint32_t depthBits = quantizeDepth(depth);
+	return (static_cast<uint64_t>(pipeline & 0xFF) << 56) | (static_cast<uint64_t>(material & 0xFFFFFF) << 32) | depthBits;
+}
+
+uint64_t RenderQueue::makeBackToFrontKey(uint32_t pipeline, float depth)
+{
+	uint32_t depthBits = ~quantizeDepth(depth);
+	return (static_cast<uint64_t>(pipeline & 0xFF) << 56) | depthBits;
+}
+
+RenderQueue::~RenderQueue()
+{
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "LinearAllocator.h"
+
+// Pipeline field of the sort keys, passes are drawn in this order
+enum RenderBucket : uint32_t {
+	RENDER_BUCKET_OPAQUE = 0,
+	RENDER_BUCKET_TRANSPARENT = 1
+};
+
+// Items to draw this frame ordered by 64 bit sort keys, from the most significant bit:
+// pipeline (8 bits), material (24 bits), quantized depth (32 bits)
+// Keys and items live in the frame arena, sorted with an LSD radix sort instead of comparisons
+class RenderQueue
+{
+public:
+	RenderQueue();
+
+	// Empty queue for at most capacity items, arrays from the arena until its next reset
+	void begin(LinearAllocator* newArena, size_t newCapacity);
+	void push(uint64_t key, uint32_t item);
+	void sort();
+
+	size_t size();
+	const uint32_t* getItems();		// In key order once sorted
+
+	// Smaller depth sorts first (front to back)
+	static uint64_t makeKey(uint32_t pipeline, uint32_t material, float depth);
+	// Larger depth sorts first (back to front) and no material field, blending needs the exact order
+	static uint64_t makeBackToFrontKey(uint32_t pipeline, float depth);
+
+	~RenderQueue();
+
+private:
+	LinearAllocator* arena = nullptr;
+	uint64_t* keys = nullptr;
+	uint32_t* items = nullptr;
+	size_t count = 0;
+	size_t capacity = 0;
+};
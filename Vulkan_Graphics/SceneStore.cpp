@@ -0,0 +1,220 @@
+#include "SceneStore.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// Fills row with the last element, same move as SceneHandleTable::remove
+template<typename T>
+static void removeRow(std::vector<T>& components, uint32_t row)
+{
+	if (row + 1 < components.size())
+	{
+		components[row] = std::move(components.back());
+	}
+	components.pop_back();
+}
+
+SceneHandleTable::SceneHandleTable()
+{
+}
+
+SceneHandle SceneHandleTable::add()
+{
+	uint32_t slot;
+	if (!freeSlots.empty())
+	{
+		slot = freeSlots.back();
+		freeSlots.pop_back();
+	}
+	else
+	{
+		slot = static_cast<uint32_t>(slotRows.size());
+		slotRows.push_back(0);
+		slotGenerations.push_back(1);
+	}
+
+	slotRows[slot] = static_cast<uint32_t>(rowSlots.size());
+	rowSlots.push_back(slot);
+
+	return { slot, slotGenerations[slot] };
+}
+
+uint32_t SceneHandleTable::remove(SceneHandle handle)
+{
+	if (!isValid(handle))
+	{
+		throw std::runtime_error("Attempted to remove an invalid scene handle");
+	}
+
+	uint32_t row = slotRows[handle.slot];
+	uint32_t lastSlot = rowSlots.back();
+	rowSlots[row] = lastSlot;
+	slotRows[lastSlot] = row;
+	rowSlots.pop_back();
+
+	// Old handles of the slot stop resolving
+	slotGenerations[handle.slot]++;
+	freeSlots.push_back(handle.slot);
+
+	return row;
+}
+
+bool SceneHandleTable::isValid(SceneHandle handle)
+{
+	return handle.slot < slotGenerations.size() && slotGenerations[handle.slot] == handle.generation;
+}
+
+uint32_t SceneHandleTable::getRow(SceneHandle handle)
+{
+	if (!isValid(handle))
+	{
+		throw std::runtime_error("Attempted to access an invalid scene handle");
+	}
+	return slotRows[handle.slot];
+}
+
+SceneHandle SceneHandleTable::getHandle(uint32_t row)
+{
+	uint32_t slot = rowSlots[row];
+	return { slot, slotGenerations[slot] };
+}
+
+size_t SceneHandleTable::size()
+{
+	return rowSlots.size();
+}
+
+SceneHandleTable::~SceneHandleTable()
+{
+}
+
+SceneStore::SceneStore()
+{
+}
+
+SceneHandle SceneStore::addModel(uint32_t rootNode, uint32_t nodeCount, const std::vector<uint32_t>& textures)
+{
+	SceneHandle model = models.add();
+	rootNodes.push_back(rootNode);
+	nodeCounts.push_back(nodeCount);
+	modelTextures.push_back(textures);
+	modelRenderables.emplace_back();
+	return model;
+}
+
+void SceneStore::removeModel(SceneHandle model, RemovedModel* removed)
+{
+	uint32_t modelRow = models.getRow(model);
+	removed->rootNode = rootNodes[modelRow];
+	removed->nodeCount = nodeCounts[modelRow];
+	removed->textures = modelTextures[modelRow];
+	removed->meshes.clear();
+
+	for (SceneHandle renderable : modelRenderables[modelRow])
+	{
+		uint32_t row = renderables.remove(renderable);
+		removed->meshes.push_back(meshes[row]);
+
+		removeRow(boundingSpheres, row);
+		removeRow(transformIds, row);
+		removeRow(materialIds, row);
+		removeRow(meshes, row);
+	}
+
+	models.remove(model);
+	removeRow(rootNodes, modelRow);
+	removeRow(nodeCounts, modelRow);
+	removeRow(modelTextures, modelRow);
+	removeRow(modelRenderables, modelRow);
+}
+
+bool SceneStore::isModelValid(SceneHandle model)
+{
+	return models.isValid(model);
+}
+
+uint32_t SceneStore::getRootNode(SceneHandle model)
+{
+	return rootNodes[models.getRow(model)];
+}
+
+size_t SceneStore::getModelCount()
+{
+	return models.size();
+}
+
+void SceneStore::addRenderable(SceneHandle model, const glm::vec4& boundingSphere, uint32_t transformId, uint32_t materialId,
+	const DrawMesh& mesh)
+{
+	uint32_t modelRow = models.getRow(model);
+
+	modelRenderables[modelRow].push_back(renderables.add());
+	boundingSpheres.push_back(boundingSphere);
+	transformIds.push_back(transformId);
+	materialIds.push_back(materialId);
+	meshes.push_back(mesh);
+}
+
+size_t SceneStore::getRenderableCount()
+{
+	return renderables.size();
+}
+
+const glm::vec4* SceneStore::getBoundingSpheres()
+{
+	return boundingSpheres.data();
+}
+
+const uint32_t* SceneStore::getTransformIds()
+{
+	return transformIds.data();
+}
+
+const uint32_t* SceneStore::getMaterialIds()
+{
+	return materialIds.data();
+}
+
+const DrawMesh* SceneStore::getMeshes()
+{
+	return meshes.data();
+}
+
+void SceneStore::writeDrawItems(DrawItem* draws)
+{
+	for (size_t i = 0; i < renderables.size(); i++)
+	{
+		const DrawMesh& mesh = meshes[i];
+		DrawItem& draw = draws[i];
+
+		draw.boundingSphere = boundingSpheres[i];
+		draw.positionOffset = mesh.positionOffset;
+		draw.positionScale = mesh.positionScale;
+		draw.transformId = transformIds[i];
+		draw.texId = materialIds[i];
+		draw.vertexOffset = mesh.vertexOffset;
+		draw.lodCount = mesh.lodCount;
+		draw.firstCluster = mesh.firstCluster;
+		draw.clusterCount = mesh.clusterCount;
+		draw.color = (mesh.color & 0x00FFFFFF) | (static_cast<uint32_t>(std::clamp(mesh.opacity, 0.0f, 1.0f) * 255.0f + 0.5f) << 24);
+		draw.shortIndices = mesh.shortIndices;
+		for (uint32_t lod = 0; lod < MAX_MESH_LODS; lod++)
+		{
+			draw.lods[lod] = mesh.lods[lod];
+		}
+	}
+}
+
+void SceneStore::writeClusterDraws(uint32_t* clusterDraws, size_t clusterCount)
+{
+	std::fill(clusterDraws, clusterDraws + clusterCount, ~0u);
+	for (size_t i = 0; i < renderables.size(); i++)
+	{
+		const DrawMesh& mesh = meshes[i];
+		std::fill(clusterDraws + mesh.firstCluster, clusterDraws + mesh.firstCluster + mesh.clusterCount, static_cast<uint32_t>(i));
+	}
+}
+
+SceneStore::~SceneStore()
+{
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+// Stable reference to a scene entry, stays valid while the entry exists whatever is added or removed around it
+// Generation 0 is never handed out, a zeroed handle is always invalid
+struct SceneHandle {
+	uint32_t slot;
+	uint32_t generation;
+};
+
+// Slot table giving stable handles to the rows of dense arrays
+// A removed row is filled by the last one, the slot of the moved row is pointed at its new place
+class SceneHandleTable
+{
+public:
+	SceneHandleTable();
+
+	// Handle of a new row at the end of the dense arrays
+	SceneHandle add();
+	// Returns the row of the handle, the caller then moves its last row into it and pops the end
+	uint32_t remove(SceneHandle handle);
+
+	bool isValid(SceneHandle handle);
+	uint32_t getRow(SceneHandle handle);
+	SceneHandle getHandle(uint32_t row);
+	size_t size();
+
+	~SceneHandleTable();
+
+private:
+	std::vector<uint32_t> slotRows;
+	std::vector<uint32_t> slotGenerations;
+	std::vector<uint32_t> freeSlots;
+	std::vector<uint32_t> rowSlots;		// Inverse of slotRows, to fix the slot of a moved row
+};
+
+// Geometry a renderable draws: where its mesh is in the geometry pool and how to draw it
+struct DrawMesh {
+	glm::vec4 positionOffset;	// Local position = offset + stored position * scale (xyz)
+	glm::vec4 positionScale;
+	int32_t vertexOffset;
+	uint32_t lodCount;
+	uint32_t firstCluster;		// In the scene cluster list
+	uint32_t clusterCount;
+	uint32_t color;				// RGBA8
+	uint32_t shortIndices;		// 1 when the indices are in the 16 bit buffer
+	float opacity;				// Under 1: transparent pass, sorted back to front
+	MeshLod lods[MAX_MESH_LODS];
+	GeometryRange geometry;		// Pool allocation of every LOD, released with the renderable
+};
+
+// What a removed model held, for the renderer to release once the GPU is done with it
+struct RemovedModel {
+	uint32_t rootNode;
+	uint32_t nodeCount;
+	std::vector<uint32_t> textures;
+	std::vector<DrawMesh> meshes;
+};
+
+// Scene state as components in dense arrays (structure of arrays), per frame systems walk only the ones they read
+// Models own a block of transform nodes (root first), their textures and one renderable per mesh
+// The row of a renderable is its draw index: draw data, cull results and indirect commands all follow the rows
+class SceneStore
+{
+public:
+	SceneStore();
+
+	SceneHandle addModel(uint32_t rootNode, uint32_t nodeCount, const std::vector<uint32_t>& textures);
+	// Removes the model and its renderables in O(renderables), the last rows fill the holes
+	void removeModel(SceneHandle model, RemovedModel* removed);
+	bool isModelValid(SceneHandle model);
+	uint32_t getRootNode(SceneHandle model);
+	size_t getModelCount();
+
+	void addRenderable(SceneHandle model, const glm::vec4& boundingSphere, uint32_t transformId, uint32_t materialId,
+		const DrawMesh& mesh);
+	size_t getRenderableCount();
+
+	// Components, one entry per renderable row
+	const glm::vec4* getBoundingSpheres();		// Local space, xyz centre, w radius
+	const uint32_t* getTransformIds();			// Index in the object storage buffer
+	const uint32_t* getMaterialIds();			// Index in the texture array
+	const DrawMesh* getMeshes();
+
+	// Draw records of every renderable in row order, in the shader layout
+	void writeDrawItems(DrawItem* draws);
+	// Row drawing each of the first clusterCount clusters of the scene list, ~0 for clusters nobody draws
+	void writeClusterDraws(uint32_t* clusterDraws, size_t clusterCount);
+
+	~SceneStore();
+
+private:
+	SceneHandleTable models;
+	std::vector<uint32_t> rootNodes;
+	std::vector<uint32_t> nodeCounts;
+	std::vector<std::vector<uint32_t>> modelTextures;
+	std::vector<std::vector<SceneHandle>> modelRenderables;
+
+	SceneHandleTable renderables;
+	std::vector<glm::vec4> boundingSpheres;
+	std::vector<uint32_t> transformIds;
+	std::vector<uint32_t> materialIds;
+	std::vector<DrawMesh> meshes;
+};
@@ -2,6 +2,22 @@ C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -V shader.vert
 C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -V shader.frag
 C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -o second_vert.spv -V second.vert 
 C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -o second_frag.spv -V second.frag 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -o cull_comp.spv -V cull.comp 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -o hiz_comp.spv -V hiz.comp 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -o lightcull_comp.spv -V lightcull.comp 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -o gbuffer_frag.spv -V gbuffer.frag 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -o deferred_frag.spv -V deferred.frag 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -DMULTISAMPLED -o deferred_ms_frag.spv -V deferred.frag 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -DPACKED_VERTICES -o shader_packed_vert.spv -V shader.vert 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -o shadow_vert.spv -V shadow.vert 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -DPACKED_VERTICES -o shadow_packed_vert.spv -V shadow.vert 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -o shadowclear_vert.spv -V shadowclear.vert 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -DMOTION_VECTORS -o shader_motion_vert.spv -V shader.vert 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -DPACKED_VERTICES -DMOTION_VECTORS -o shader_packed_motion_vert.spv -V shader.vert 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -DMOTION_VECTORS -o shader_motion_frag.spv -V shader.frag 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -DMOTION_VECTORS -o gbuffer_motion_frag.spv -V gbuffer.frag 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -DTEMPORAL_AA -o second_taa_frag.spv -V second.frag 
+C:\VulkanSDK\1.3.239.0\Bin\glslangValidator.exe -DDYNAMIC_RESOLUTION -o second_dynres_frag.spv -V second.frag 
 pause
 
 
@@ -0,0 +1,170 @@
+#version 450
+
+// Deferred pass subpass 1: lights every sample of the G-buffer with the lights of its froxel
+// MULTISAMPLED matches attachments with more than one sample (compiled to deferred_ms_frag.spv), shaded per sample
+#ifdef MULTISAMPLED
+layout(input_attachment_index = 0, set = 1, binding = 0) uniform subpassInputMS inputAlbedo;
+layout(input_attachment_index = 1, set = 1, binding = 1) uniform subpassInputMS inputNormal;
+layout(input_attachment_index = 2, set = 1, binding = 2) uniform subpassInputMS inputMaterial;
+layout(input_attachment_index = 3, set = 1, binding = 3) uniform subpassInputMS inputDepth;
+#define LOAD_INPUT(input) subpassLoad(input, gl_SampleID)
+#else
+layout(input_attachment_index = 0, set = 1, binding = 0) uniform subpassInput inputAlbedo;
+layout(input_attachment_index = 1, set = 1, binding = 1) uniform subpassInput inputNormal;
+layout(input_attachment_index = 2, set = 1, binding = 2) uniform subpassInput inputMaterial;
+layout(input_attachment_index = 3, set = 1, binding = 3) uniform subpassInput inputDepth;
+#define LOAD_INPUT(input) subpassLoad(input)
+#endif
+
+// LIGHT_GRID_X, LIGHT_GRID_Y, LIGHT_GRID_Z and MAX_LIGHTS_PER_CLUSTER in Utils.h
+#define LIGHT_GRID_X 16
+#define LIGHT_GRID_Y 9
+#define LIGHT_GRID_Z 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_GRID_X * LIGHT_GRID_Y * LIGHT_GRID_Z)
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+layout(set = 0, binding = 3) uniform LightParams {
+	mat4 view;
+	vec4 projection;	// P00, P11, near, far
+	vec2 screenSize;
+	float sliceScale;
+	float sliceBias;
+	uint lightCount;
+	float projectionP22;
+	float projectionP32;
+} lightParams;
+
+struct PointLight {
+	vec4 positionRadius;
+	vec4 color;
+};
+
+layout(std430, set = 0, binding = 4) readonly buffer LightBuffer {
+	PointLight lights[];
+} lightBuffer;
+
+layout(std430, set = 0, binding = 5) readonly buffer LightGrid {
+	uint counts[LIGHT_CLUSTER_COUNT];
+	uint indices[];
+} lightGrid;
+
+// Sun and its cascades, SHADOW_CASCADE_COUNT and SHADOW_MAP_SIZE in Utils.h
+#define SHADOW_CASCADE_COUNT 4
+#define SHADOW_MAP_SIZE 2048
+
+layout(set = 0, binding = 6) uniform ShadowParams {
+	mat4 cascadeMatrices[SHADOW_CASCADE_COUNT];
+	vec4 cascadeTexelSizes;
+	vec4 lightDirection;	// Direction the light travels
+	vec4 lightColor;
+	uint cascadeMask;		// Cascades holding a rendered map
+} shadowParams;
+
+layout(set = 0, binding = 7) uniform sampler2DArrayShadow shadowMap;
+
+// 1 lit, 0 in shadow: first cascade whose map covers the point, 3x3 PCF of bilinear compares
+float sampleShadow(vec3 worldPos, vec3 norm)
+{
+	for (uint i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		if ((shadowParams.cascadeMask & (1u << i)) == 0) continue;
+
+		// Offset along the normal by the cascade texel size against acne on surfaces facing away from the light
+		vec4 shadowPos = shadowParams.cascadeMatrices[i] * vec4(worldPos + norm * 2.0 * shadowParams.cascadeTexelSizes[i], 1.0);
+		vec2 uv = shadowPos.xy * 0.5 + 0.5;
+		vec2 border = vec2(2.0 / SHADOW_MAP_SIZE);
+		if (any(lessThan(uv, border)) || any(greaterThan(uv, 1.0 - border)) || shadowPos.z > 1.0) continue;
+
+		float lit = 0.0;
+		for (int y = -1; y <= 1; y++)
+		{
+			for (int x = -1; x <= 1; x++)
+			{
+				lit += texture(shadowMap, vec4(uv + vec2(x, y) / SHADOW_MAP_SIZE, float(i), shadowPos.z));
+			}
+		}
+		return lit / 9.0;
+	}
+	return 1.0;
+}
+
+layout(location = 0) out vec4 outColor;
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+// Same lighting as CreateLight in shader.frag, specular terms from the G-buffer
+vec3 CreateLight(PointLight light, vec3 norm, vec3 fragPos, vec3 viewDir, vec4 material)
+{
+	vec3 lightPos = light.positionRadius.xyz;
+	vec3 lightColor = light.color.rgb;
+
+	float dist = length(lightPos - fragPos);
+	float falloff = clamp(1.0 - (dist * dist) / (light.positionRadius.w * light.positionRadius.w), 0.0, 1.0);
+	float attenuation = falloff * falloff;
+
+	vec3 lightDir = (lightPos - fragPos) / max(dist, 0.0001);
+	float diff = max(dot(norm, lightDir), 0);
+	vec3 diffuse = diff * lightColor;
+
+	vec3 reflectDir = reflect(-lightDir, norm);
+	float spec = pow(max(dot(viewDir, reflectDir), 0), material.g * 256.0);
+	vec3 specular = material.r * spec * lightColor;
+
+	return attenuation * (diffuse + specular);
+}
+
+void main() {
+	// Nothing drawn: clear color of the color buffer
+	float depth = LOAD_INPUT(inputDepth).r;
+	if (depth >= 1.0)
+	{
+		outColor = vec4(0.1, 0.1, 0.1, 1.0);
+		return;
+	}
+
+	// View space position from the depth and the projection, then world space through the inverse of the rigid view
+	float viewDepth = lightParams.projectionP32 / (depth + lightParams.projectionP22);
+	vec2 ndc = gl_FragCoord.xy / lightParams.screenSize * 2.0 - 1.0;
+	vec3 viewSpacePos = vec3(ndc * viewDepth / lightParams.projection.xy, -viewDepth);
+	mat3 viewRotation = mat3(lightParams.view);
+	vec3 fragPos = transpose(viewRotation) * (viewSpacePos - lightParams.view[3].xyz);
+	vec3 cameraPos = transpose(viewRotation) * -lightParams.view[3].xyz;
+	vec3 viewDir = normalize(cameraPos - fragPos);
+
+	vec3 albedo = LOAD_INPUT(inputAlbedo).rgb;
+	vec3 norm = decodeOctahedral(LOAD_INPUT(inputNormal).xy);
+	vec4 material = LOAD_INPUT(inputMaterial);
+
+	// Froxel of the pixel, same as the forward path
+	uvec2 tile = min(uvec2(gl_FragCoord.xy / lightParams.screenSize * vec2(LIGHT_GRID_X, LIGHT_GRID_Y)),
+		uvec2(LIGHT_GRID_X - 1, LIGHT_GRID_Y - 1));
+	int slice = int(floor(log(viewDepth) * lightParams.sliceScale + lightParams.sliceBias));
+	uint cluster = tile.x + LIGHT_GRID_X * (tile.y + LIGHT_GRID_Y * uint(clamp(slice, 0, LIGHT_GRID_Z - 1)));
+
+	//ambient
+	vec3 lighting = vec3(0.1);
+
+	// Sun, shadowed through the cascades
+	vec3 sunDir = -shadowParams.lightDirection.xyz;
+	float sunDiffuse = max(dot(norm, sunDir), 0);
+	if (sunDiffuse > 0)
+	{
+		float sunSpec = material.r * pow(max(dot(viewDir, reflect(-sunDir, norm)), 0), material.g * 256.0);
+		lighting += (sunDiffuse + sunSpec) * shadowParams.lightColor.rgb * sampleShadow(fragPos, norm);
+	}
+
+	uint lightCount = lightGrid.counts[cluster];
+	for (uint i = 0; i < lightCount; i++)
+	{
+		uint light = lightGrid.indices[cluster * MAX_LIGHTS_PER_CLUSTER + i];
+		lighting += CreateLight(lightBuffer.lights[light], norm, fragPos, viewDir, material);
+	}
+
+	outColor = vec4(albedo * lighting, 1.0);
+}
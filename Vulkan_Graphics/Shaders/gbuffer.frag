@@ -0,0 +1,46 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Deferred pass subpass 0: surface attributes only, lighting is done once per pixel by deferred.frag
+layout(location = 0) in vec3 fragCol;
+layout(location = 1) in vec2 fragTex;
+layout(location = 4) in vec3 normal;
+layout(location = 6) flat in uint fragTexId;
+#ifdef MOTION_VECTORS
+layout(location = 9) in vec4 clipPos;
+layout(location = 10) in vec4 previousClipPos;
+#endif
+
+// Every texture of the scene, MAX_TEXTURES in Utils.h
+layout(set = 1, binding = 0) uniform sampler2D textureSamplers[128];
+
+layout(location = 0) out vec4 outAlbedo;
+layout(location = 1) out vec2 outNormal;		// Octahedral, world space
+layout(location = 2) out vec4 outMaterial;		// Specular strength, shininess / 256
+#ifdef MOTION_VECTORS
+layout(location = 3) out vec2 outVelocity;		// Same as shader.frag, velocity attachment after the G-buffer
+#endif
+
+vec2 encodeOctahedral(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.xy;
+	if (n.z < 0.0)
+	{
+		e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	}
+	return e;
+}
+
+void main() {
+	vec4 texColor = texture(textureSamplers[nonuniformEXT(fragTexId)], fragTex, 1.0f);
+
+	// Same material as the forward path in shader.frag
+	outAlbedo = vec4(fragCol * texColor.rgb, 1.0);
+	outNormal = encodeOctahedral(normalize(normal));
+	outMaterial = vec4(0.8, 32.0 / 256.0, 0.0, 0.0);
+
+#ifdef MOTION_VECTORS
+	outVelocity = previousClipPos.w > 0.0 ? (clipPos.xy / clipPos.w - previousClipPos.xy / previousClipPos.w) * 0.5 : vec2(0.0);
+#endif
+}
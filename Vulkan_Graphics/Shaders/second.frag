@@ -7,6 +7,33 @@ layout(input_attachment_index = 1, binding = 1) uniform subpassInput inputDepth;
 
 layout(location = 0) out vec4 color;
 
+// TEMPORAL_AA resolves the jittered color against the history first (compiled to second_taa_frag.spv)
+// DYNAMIC_RESOLUTION upscales the part of the scene drawn to instead of reading in place (second_dynres_frag.spv)
+#if defined(TEMPORAL_AA) || defined(DYNAMIC_RESOLUTION)
+// Same image as inputColor, read around the pixel to clamp the history or scaled to upscale
+layout(binding = 3) uniform sampler2D currentColor;
+
+layout(binding = 5) uniform PostParams {
+	vec2 renderScale;			// Part of the scene attachments drawn to
+	float historyWeight;		// 0 when the history does not hold a previous frame
+} postParams;
+#endif
+
+#ifdef TEMPORAL_AA
+// Screen motion since the last frame in uv units
+layout(input_attachment_index = 2, binding = 2) uniform subpassInput inputVelocity;
+// Resolved color of the last frame
+layout(binding = 4) uniform sampler2D historyColor;
+
+// Resolved color before the depth effect, copied to the history after the pass
+layout(location = 1) out vec4 resolvedColor;
+#endif
+
+#ifdef DYNAMIC_RESOLUTION
+// Same image as inputDepth
+layout(binding = 6) uniform sampler2D sceneDepth;
+#endif
+
 void main()
 {
 	// Keep as example of subpass use
@@ -16,11 +43,48 @@ void main()
 	float lowerBound = 0.995;
 	float upperBound = 1;
 
+#ifdef DYNAMIC_RESOLUTION
+	// Bilinear over the drawn part, kept half a texel inside it so nothing left from a larger scale bleeds in
+	vec2 size = vec2(textureSize(currentColor, 0));
+	vec2 sceneUv = gl_FragCoord.xy / size * postParams.renderScale;
+	sceneUv = clamp(sceneUv, 0.5 / size, postParams.renderScale - 0.5 / size);
+	float depth = texelFetch(sceneDepth, ivec2(sceneUv * size), 0).r;
+	vec4 a = textureLod(currentColor, sceneUv, 0.0);
+#else
 	float depth = subpassLoad(inputDepth).r;
-	float depthColorScaled = 1.0f - ((depth - lowerBound) / (upperBound - lowerBound));
 	vec4 a = subpassLoad(inputColor);
+#endif
+	float depthColorScaled = 1.0f - ((depth - lowerBound) / (upperBound - lowerBound));
+
+#ifdef TEMPORAL_AA
+	// Neighbourhood of the pixel bounds the history, what it holds outside of it was disoccluded or changed
+	ivec2 size = textureSize(currentColor, 0);
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec3 minColor = a.rgb;
+	vec3 maxColor = a.rgb;
+	for (int y = -1; y <= 1; y++)
+	{
+		for (int x = -1; x <= 1; x++)
+		{
+			vec3 neighbour = texelFetch(currentColor, clamp(pixel + ivec2(x, y), ivec2(0), size - 1), 0).rgb;
+			minColor = min(minColor, neighbour);
+			maxColor = max(maxColor, neighbour);
+		}
+	}
+
+	vec2 historyUv = gl_FragCoord.xy / vec2(size) - subpassLoad(inputVelocity).xy;
+	float historyWeight = postParams.historyWeight;
+	if (any(lessThan(historyUv, vec2(0.0))) || any(greaterThan(historyUv, vec2(1.0))))
+	{
+		historyWeight = 0.0;
+	}
+	vec3 history = clamp(textureLod(historyColor, historyUv, 0.0).rgb, minColor, maxColor);
+
+	a = vec4(mix(a.rgb, history, historyWeight), 1.0);
+	resolvedColor = a;
+#endif
 
-	color = min(subpassLoad(inputColor).rgba ,vec4( subpassLoad(inputColor).rgb * depthColorScaled, 1.0f));
+	color = min(a, vec4(a.rgb * depthColorScaled, 1.0f));
 //	}
 //	else 
 //	{
@@ -1,52 +1,163 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec3 fragCol;
 layout(location = 1) in vec2 fragTex;
 layout(location = 3) in vec3 viewPos;
 layout(location = 4) in vec3 normal;
 layout(location = 5) in vec3 fragPos;
+layout(location = 6) flat in uint fragTexId;
+layout(location = 7) flat in float fragOpacity;		// Only blended by the transparent pipeline
+layout(location = 8) in float viewDepth;
+#ifdef MOTION_VECTORS
+layout(location = 9) in vec4 clipPos;
+layout(location = 10) in vec4 previousClipPos;
+#endif
 
 
 
-layout(set = 1, binding = 0) uniform sampler2D textureSampler;
+// Every texture of the scene, MAX_TEXTURES in Utils.h
+layout(set = 1, binding = 0) uniform sampler2D textureSamplers[128];
 
-// TODO get the point lights here
-//#define NUM_LIGHTS 3 
-//layout (set =1, binding =1) uniform light light_data[NUM_LIGHTS];
+// LIGHT_GRID_X, LIGHT_GRID_Y, LIGHT_GRID_Z and MAX_LIGHTS_PER_CLUSTER in Utils.h
+#define LIGHT_GRID_X 16
+#define LIGHT_GRID_Y 9
+#define LIGHT_GRID_Z 24
+#define LIGHT_CLUSTER_COUNT (LIGHT_GRID_X * LIGHT_GRID_Y * LIGHT_GRID_Z)
+#define MAX_LIGHTS_PER_CLUSTER 128
 
-vec4 CreateLight(vec3 lightPos, vec3 lightColor, vec3 normal, vec3 fragPos, vec3 viewDir)
+layout(set = 0, binding = 3) uniform LightParams {
+	mat4 view;
+	vec4 projection;	// P00, P11, near, far
+	vec2 screenSize;
+	float sliceScale;
+	float sliceBias;
+	uint lightCount;
+	float projectionP22;
+	float projectionP32;
+} lightParams;
+
+struct PointLight {
+	vec4 positionRadius;	// w: range at which the light has faded to 0
+	vec4 color;
+};
+
+layout(std430, set = 0, binding = 4) readonly buffer LightBuffer {
+	PointLight lights[];
+} lightBuffer;
+
+// Filled by lightcull.comp at the start of the frame
+layout(std430, set = 0, binding = 5) readonly buffer LightGrid {
+	uint counts[LIGHT_CLUSTER_COUNT];
+	uint indices[];
+} lightGrid;
+
+// Sun and its cascades, SHADOW_CASCADE_COUNT and SHADOW_MAP_SIZE in Utils.h
+#define SHADOW_CASCADE_COUNT 4
+#define SHADOW_MAP_SIZE 2048
+
+layout(set = 0, binding = 6) uniform ShadowParams {
+	mat4 cascadeMatrices[SHADOW_CASCADE_COUNT];
+	vec4 cascadeTexelSizes;
+	vec4 lightDirection;	// Direction the light travels
+	vec4 lightColor;
+	uint cascadeMask;		// Cascades holding a rendered map
+} shadowParams;
+
+layout(set = 0, binding = 7) uniform sampler2DArrayShadow shadowMap;
+
+// 1 lit, 0 in shadow: first cascade whose map covers the point, 3x3 PCF of bilinear compares
+float sampleShadow(vec3 worldPos, vec3 norm)
 {
+	for (uint i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		if ((shadowParams.cascadeMask & (1u << i)) == 0) continue;
 
-    //ambient
-    float a_strength = 0.1;
-    vec3 ambient = a_strength * lightColor;
+		// Offset along the normal by the cascade texel size against acne on surfaces facing away from the light
+		vec4 shadowPos = shadowParams.cascadeMatrices[i] * vec4(worldPos + norm * 2.0 * shadowParams.cascadeTexelSizes[i], 1.0);
+		vec2 uv = shadowPos.xy * 0.5 + 0.5;
+		vec2 border = vec2(2.0 / SHADOW_MAP_SIZE);
+		if (any(lessThan(uv, border)) || any(greaterThan(uv, 1.0 - border)) || shadowPos.z > 1.0) continue;
+
+		float lit = 0.0;
+		for (int y = -1; y <= 1; y++)
+		{
+			for (int x = -1; x <= 1; x++)
+			{
+				lit += texture(shadowMap, vec4(uv + vec2(x, y) / SHADOW_MAP_SIZE, float(i), shadowPos.z));
+			}
+		}
+		return lit / 9.0;
+	}
+	return 1.0;
+}
+
+vec3 CreateLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+{
+    vec3 lightPos = light.positionRadius.xyz;
+    vec3 lightColor = light.color.rgb;
+
+    // Smooth falloff reaching 0 at the light radius, the froxels only list lights within it
+    float dist = length(lightPos - fragPos);
+    float falloff = clamp(1.0 - (dist * dist) / (light.positionRadius.w * light.positionRadius.w), 0.0, 1.0);
+    float attenuation = falloff * falloff;
 
     //diffuse
     vec3 norm = normalize(normal);
-    vec3 lightDir = normalize(lightPos - fragPos);
+    vec3 lightDir = (lightPos - fragPos) / max(dist, 0.0001);
     float diff = max(dot(norm, lightDir), 0);
     vec3 diffuse = diff * lightColor;
 
     //specular
     float s_strength = 0.8;
-    vec3 reflectDir = normalize(-lightDir - norm);
+    vec3 reflectDir = reflect(-lightDir, norm);
     float spec = pow(max(dot(viewDir, reflectDir), 0), 32);
     vec3 specular = s_strength * spec * lightColor;
 
-   return vec4(fragCol * (ambient + diffuse + specular), 1);
+    return attenuation * (diffuse + specular);
 }
 
 layout(location = 0) out vec4 outColor; //Final ouput color
+#ifdef MOTION_VECTORS
+// Screen motion since the last frame in uv units, the transparent pipeline masks it out
+layout(location = 1) out vec2 outVelocity;
+#endif
 
 void main() {
     vec3 viewDir = normalize(viewPos - fragPos);
-    vec3 lightPos = vec3(3.0, 5.0, 2.0);
-    vec3 lightColor = vec3(1.0, 1.0, 1.0);
 
-    outColor = CreateLight(lightPos, lightColor, normal, fragPos, viewDir);
-    outColor = outColor * texture(textureSampler, fragTex, 1.0f);
+    // Froxel of the fragment: screen tile, then exponential depth slice
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / lightParams.screenSize * vec2(LIGHT_GRID_X, LIGHT_GRID_Y)),
+        uvec2(LIGHT_GRID_X - 1, LIGHT_GRID_Y - 1));
+    int slice = int(floor(log(max(viewDepth, 0.0001)) * lightParams.sliceScale + lightParams.sliceBias));
+    uint cluster = tile.x + LIGHT_GRID_X * (tile.y + LIGHT_GRID_Y * uint(clamp(slice, 0, LIGHT_GRID_Z - 1)));
+
+    //ambient
+    vec3 lighting = vec3(0.1);
+
+    // Sun, shadowed through the cascades
+    vec3 norm = normalize(normal);
+    vec3 sunDir = -shadowParams.lightDirection.xyz;
+    float sunDiffuse = max(dot(norm, sunDir), 0);
+    if (sunDiffuse > 0)
+    {
+        float sunSpec = 0.8 * pow(max(dot(viewDir, reflect(-sunDir, norm)), 0), 32);
+        lighting += (sunDiffuse + sunSpec) * shadowParams.lightColor.rgb * sampleShadow(fragPos, norm);
+    }
+
+    uint lightCount = lightGrid.counts[cluster];
+    for (uint i = 0; i < lightCount; i++)
+    {
+        uint light = lightGrid.indices[cluster * MAX_LIGHTS_PER_CLUSTER + i];
+        lighting += CreateLight(lightBuffer.lights[light], normal, fragPos, viewDir);
+    }
 
-    //for(int i = 0; i < NUM_LIGHTS; i++){
-    //outColor += CreateLight(lightData[i].position, lightData[i].color, normal, fragPos, viewDir);
-    //}
-}
\ No newline at end of file
+    outColor = vec4(fragCol * lighting, 1.0);
+    outColor = outColor * texture(textureSamplers[nonuniformEXT(fragTexId)], fragTex, 1.0f);
+    outColor.a *= fragOpacity;
+
+#ifdef MOTION_VECTORS
+    // Behind the camera last frame: no usable history position, treated as static
+    outVelocity = previousClipPos.w > 0.0 ? (clipPos.xy / clipPos.w - previousClipPos.xy / previousClipPos.w) * 0.5 : vec2(0.0);
+#endif
+}
@@ -1,38 +1,122 @@
 #version 450 		// Use GLSL 4.5
 
+// PACKED_VERTICES matches VERTEX_FORMAT_PACKED (compiled to shader_packed_vert.spv)
+// MOTION_VECTORS adds the clip positions of this and the last frame for temporal anti-aliasing (shader_motion_vert.spv)
+#ifdef PACKED_VERTICES
+layout(location = 0) in vec4 pos;				// xyz unorm in the mesh bounds, w RGB565 color
+layout(location = 2) in vec2 tex;
+layout(location = 3) in vec2 octahedralNormal;
+#else
 layout(location = 0) in vec3 pos;
 layout(location = 1) in vec3 col;
 layout(location = 2) in vec2 tex;
 layout(location = 3) in vec3 vertexNormal;
+#endif
 
 layout(set = 0, binding = 0) uniform UboViewProjection {
-	mat4 projection;
+	mat4 projection;				// Jittered with temporal anti-aliasing
 	mat4 view;
+	mat4 viewProjection;			// Without the jitter
+	mat4 previousViewProjection;	// Last frame, without the jitter
 } uboViewProjection;
 
-layout( push_constant ) uniform PushModel {
+struct ObjectData {
 	mat4 model;
-} pushModel;
+	mat4 normal;		// Inverse transpose of model in the 3x3, camera world position in column 3
+	mat4 previousModel;
+};
+
+// Per object data updated every frame
+layout(std430, set = 0, binding = 1) readonly buffer ObjectBuffer {
+	ObjectData objects[];
+} objectBuffer;
+
+struct DrawLod {
+	uint firstIndex;
+	uint indexCount;
+	float error;
+	uint padding;
+};
 
+struct DrawData {
+	vec4 boundingSphere;
+	vec4 positionOffset;
+	vec4 positionScale;
+	uint transformId;
+	uint texId;
+	int vertexOffset;
+	uint lodCount;
+	uint firstCluster;
+	uint clusterCount;
+	uint color;
+	uint shortIndices;
+	DrawLod lods[4];		// MAX_MESH_LODS in Utils.h
+};
 
-// Not in use left for reference on Dynamic ubo
-//layout(set = 0, binding = 1) uniform UboModel {
-//	mat4 model;
-//} uboModel;
+// Per draw data, indirect draws pick theirs through firstInstance
+layout(std430, set = 0, binding = 2) readonly buffer DrawBuffer {
+	DrawData draws[];
+} drawBuffer;
 
 layout(location = 0) out vec3 fragCol;
 layout(location = 1) out vec2 fragTex;
 layout(location = 3) out vec3 viewPos;
 layout(location = 4) out vec3 normal;
 layout(location = 5) out vec3 fragPos;
+layout(location = 6) flat out uint fragTexId;
+layout(location = 7) flat out float fragOpacity;
+layout(location = 8) out float viewDepth;			// Positive distance along the view axis, picks the light froxel slice
+#ifdef MOTION_VECTORS
+layout(location = 9) out vec4 clipPos;
+layout(location = 10) out vec4 previousClipPos;
+#endif
+
+// The deferred G-buffer pass redraws the early pass draws with an equal depth test
+invariant gl_Position;
+
 
+#ifdef PACKED_VERTICES
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+vec3 decodeRgb565(float packed)
+{
+	uint c = uint(packed * 65535.0 + 0.5);
+	return vec3(float(c >> 11), float((c >> 5) & 63u), float(c & 31u)) / vec3(31.0, 63.0, 31.0);
+}
+#endif
 
 void main() {
-	viewPos = vec3(inverse(pushModel.model) * vec4(uboViewProjection.view[3][0], 
-		uboViewProjection.view[3][1], uboViewProjection.view[3][2], 1));
-	gl_Position = uboViewProjection.projection * uboViewProjection.view * pushModel.model * vec4(pos, 1.0);
-	normal = mat3(transpose(inverse(pushModel.model))) * vertexNormal;
-	fragPos = vec3(pushModel.model * vec4(pos, 1));
+	DrawData draw = drawBuffer.draws[gl_InstanceIndex];
+	ObjectData object = objectBuffer.objects[draw.transformId];
+
+#ifdef PACKED_VERTICES
+	vec3 localPos = draw.positionOffset.xyz + pos.xyz * draw.positionScale.xyz;
+	vec3 vertexNormal = decodeOctahedral(octahedralNormal);
+	vec3 col = unpackUnorm4x8(draw.color).rgb * decodeRgb565(pos.w);
+#else
+	vec3 localPos = pos;
+#endif
+
+	vec4 worldPos = object.model * vec4(localPos, 1.0);
+	viewPos = object.normal[3].xyz;
+	vec4 viewSpacePos = uboViewProjection.view * worldPos;
+	gl_Position = uboViewProjection.projection * viewSpacePos;
+	viewDepth = -viewSpacePos.z;
+	normal = mat3(object.normal) * vertexNormal;
+	fragPos = worldPos.xyz;
 	fragCol = col;
 	fragTex = tex;
+	fragTexId = draw.texId;
+	fragOpacity = unpackUnorm4x8(draw.color).a;
+
+#ifdef MOTION_VECTORS
+	clipPos = uboViewProjection.viewProjection * worldPos;
+	previousClipPos = uboViewProjection.previousViewProjection * object.previousModel * vec4(localPos, 1.0);
+#endif
 }
\ No newline at end of file
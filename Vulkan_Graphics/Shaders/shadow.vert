@@ -0,0 +1,65 @@
+#version 450 		// Use GLSL 4.5
+
+// Depth of the shadow casters into one cascade, same draw data as shader.vert
+// PACKED_VERTICES matches VERTEX_FORMAT_PACKED (compiled to shadow_packed_vert.spv)
+layout(location = 0) in vec3 pos;
+
+struct ObjectData {
+	mat4 model;
+	mat4 normal;
+	mat4 previousModel;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer ObjectBuffer {
+	ObjectData objects[];
+} objectBuffer;
+
+struct DrawLod {
+	uint firstIndex;
+	uint indexCount;
+	float error;
+	uint padding;
+};
+
+struct DrawData {
+	vec4 boundingSphere;
+	vec4 positionOffset;
+	vec4 positionScale;
+	uint transformId;
+	uint texId;
+	int vertexOffset;
+	uint lodCount;
+	uint firstCluster;
+	uint clusterCount;
+	uint color;
+	uint shortIndices;
+	DrawLod lods[4];		// MAX_MESH_LODS in Utils.h
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer DrawBuffer {
+	DrawData draws[];
+} drawBuffer;
+
+layout(set = 0, binding = 6) uniform ShadowParams {
+	mat4 cascadeMatrices[4];		// SHADOW_CASCADE_COUNT in Utils.h
+	vec4 cascadeTexelSizes;
+	vec4 lightDirection;
+	vec4 lightColor;
+	uint cascadeMask;
+} shadowParams;
+
+layout(push_constant) uniform Cascade {
+	uint index;
+} cascade;
+
+void main() {
+	DrawData draw = drawBuffer.draws[gl_InstanceIndex];
+
+#ifdef PACKED_VERTICES
+	vec3 localPos = draw.positionOffset.xyz + pos * draw.positionScale.xyz;
+#else
+	vec3 localPos = pos;
+#endif
+
+	gl_Position = shadowParams.cascadeMatrices[cascade.index] * (objectBuffer.objects[draw.transformId].model * vec4(localPos, 1.0));
+}
@@ -0,0 +1,7 @@
+#version 450 		// Use GLSL 4.5
+
+// Full screen triangle at far depth, clears the cascade being rendered from inside its render pass
+void main() {
+	vec2 uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+	gl_Position = vec4(uv * 2.0 - 1.0, 1.0, 1.0);
+}
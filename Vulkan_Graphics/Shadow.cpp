@@ -0,0 +1,197 @@
+#include "Shadow.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "SimdMath.h"
+
+ShadowCascades::ShadowCascades()
+{
+	setLight(glm::vec3(-0.4f, -1.0f, -0.3f), glm::vec3(0.6f));
+}
+
+void ShadowCascades::setLight(const glm::vec3& direction, const glm::vec3& color)
+{
+	glm::vec3 newDirection = glm::normalize(direction);
+	if (newDirection != glm::vec3(params.lightDirection))
+	{
+		// Light space looking along the light, up picked away from the direction
+		glm::vec3 up = std::abs(newDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+		lightView = glm::lookAt(glm::vec3(0.0f), newDirection, up);
+		lightChanged = true;
+	}
+
+	params.lightDirection = glm::vec4(newDirection, 0.0f);
+	params.lightColor = glm::vec4(color, 0.0f);
+}
+
+void ShadowCascades::update(const Camera& camera, float fovY, float aspect, const float* centerX, const float* centerY,
+	const float* centerZ, const float* radius, size_t count)
+{
+	frame++;
+
+	// Moved, added or removed renderables: their old and new spheres invalidate the cascades they touch
+	size_t previousCount = previousSpheres.size();
+	for (size_t i = 0; i < std::max(count, previousCount); i++)
+	{
+		glm::vec4 sphere = i < count ? glm::vec4(centerX[i], centerY[i], centerZ[i], radius[i]) : glm::vec4(0.0f);
+		if (i < previousCount && i < count && sphere == previousSpheres[i]) continue;
+
+		if (i < previousCount) markTouched(previousSpheres[i]);
+		if (i < count) markTouched(sphere);
+	}
+	if (count != previousCount)
+	{
+		previousSpheres.resize(count);
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		previousSpheres[i] = glm::vec4(centerX[i], centerY[i], centerZ[i], radius[i]);
+	}
+
+	// Bounding sphere of each slice of the view: on the view axis, equally far from the near and far corners
+	// It does not change as the camera turns, so a cascade only moves with the camera
+	float diagonalSlopeSquared = std::tan(glm::radians(fovY) * 0.5f);
+	diagonalSlopeSquared *= diagonalSlopeSquared * (1.0f + aspect * aspect);
+
+	std::array<glm::vec3, SHADOW_CASCADE_COUNT> sphereCenters;
+	std::array<float, SHADOW_CASCADE_COUNT> sphereRadii;
+	float sliceNear = CAMERA_NEAR_PLANE;
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		// Split distances between logarithmic and uniform
+		float t = static_cast<float>(i + 1) / static_cast<float>(SHADOW_CASCADE_COUNT);
+		float logSplit = CAMERA_NEAR_PLANE * std::pow(SHADOW_DISTANCE / CAMERA_NEAR_PLANE, t);
+		float uniformSplit = CAMERA_NEAR_PLANE + (SHADOW_DISTANCE - CAMERA_NEAR_PLANE) * t;
+		float sliceFar = SHADOW_SPLIT_LAMBDA * logSplit + (1.0f - SHADOW_SPLIT_LAMBDA) * uniformSplit;
+
+		float sphereDistance = std::min(0.5f * (sliceNear + sliceFar) * (1.0f + diagonalSlopeSquared), sliceFar);
+		float sphereRadius = std::sqrt((sliceFar - sphereDistance) * (sliceFar - sphereDistance)
+			+ sliceFar * sliceFar * diagonalSlopeSquared);
+		sphereCenters[i] = camera.Position + camera.Front * sphereDistance;
+		sphereRadii[i] = sphereRadius;
+		sliceNear = sliceFar;
+
+		// Stale once the slice leaves what the map covers, near cascades have no margin so any camera move counts
+		Cascade& cascade = cascades[i];
+		if (!cascade.valid || lightChanged || glm::length(sphereCenters[i] - cascade.center) + sphereRadius > cascade.radius)
+		{
+			cascade.stale = true;
+		}
+
+		// Near cascades are rendered whenever stale
+		cascade.render = cascade.stale && i < SHADOW_CACHED_CASCADE_START;
+	}
+
+	// Cached ones within the budget, those waiting the longest first
+	for (uint32_t update = 0; update < SHADOW_MAX_CACHED_UPDATES; update++)
+	{
+		Cascade* oldest = nullptr;
+		for (uint32_t i = SHADOW_CACHED_CASCADE_START; i < SHADOW_CASCADE_COUNT; i++)
+		{
+			Cascade& cascade = cascades[i];
+			if (cascade.stale && !cascade.render && (oldest == nullptr || cascade.renderedFrame < oldest->renderedFrame))
+			{
+				oldest = &cascade;
+			}
+		}
+		if (oldest == nullptr) break;
+		oldest->render = true;
+	}
+
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		if (!cascades[i].render) continue;
+
+		float margin = i < SHADOW_CACHED_CASCADE_START ? 1.0f : SHADOW_CACHE_MARGIN;
+		fitCascade(i, sphereCenters[i], sphereRadii[i] * margin);
+	}
+
+	lightChanged = false;
+
+	params.cascadeMask = 0;
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		params.cascadeMask |= cascades[i].valid ? 1u << i : 0u;
+	}
+}
+
+void ShadowCascades::markTouched(const glm::vec4& sphere)
+{
+	for (Cascade& cascade : cascades)
+	{
+		if (!cascade.valid || cascade.stale) continue;
+
+		bool inside = true;
+		for (uint32_t p = 0; p < 6 && inside; p++)
+		{
+			inside = glm::dot(glm::vec3(cascade.planes[p]), glm::vec3(sphere)) + cascade.planes[p].w >= -sphere.w;
+		}
+		cascade.stale = inside;
+	}
+}
+
+void ShadowCascades::fitCascade(uint32_t cascade, const glm::vec3& center, float radius)
+{
+	// Snapping moves the box by under a texel, one more texel keeps the sphere inside
+	float texelSize = 2.0f * radius / static_cast<float>(SHADOW_MAP_SIZE);
+	radius += texelSize;
+	texelSize = 2.0f * radius / static_cast<float>(SHADOW_MAP_SIZE);
+
+	// Centre on the texel grid of the light space so static shadow edges do not crawl as the cascade moves
+	glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+	lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+	lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+
+	// Light looks down -z, the box starts SHADOW_CASTER_DISTANCE before the sphere for casters outside it
+	glm::mat4 projection = glm::orthoRH_ZO(lightCenter.x - radius, lightCenter.x + radius,
+		lightCenter.y - radius, lightCenter.y + radius,
+		-lightCenter.z - radius - SHADOW_CASTER_DISTANCE, -lightCenter.z + radius);
+
+	Cascade& target = cascades[cascade];
+	target.center = center;
+	target.radius = radius;
+	target.renderedFrame = frame;
+	target.valid = true;
+	target.stale = false;
+
+	params.cascadeMatrices[cascade] = projection * lightView;
+	params.cascadeTexelSizes[cascade] = texelSize;
+	extractFrustumPlanes(params.cascadeMatrices[cascade], target.planes);
+}
+
+bool ShadowCascades::isRendered(uint32_t cascade)
+{
+	return cascades[cascade].render;
+}
+
+uint32_t ShadowCascades::getRenderedCount()
+{
+	uint32_t renderedCount = 0;
+	for (const Cascade& cascade : cascades)
+	{
+		renderedCount += cascade.render ? 1 : 0;
+	}
+	return renderedCount;
+}
+
+const glm::vec4* ShadowCascades::getCasterPlanes(uint32_t cascade)
+{
+	return cascades[cascade].planes;
+}
+
+float ShadowCascades::getTexelSize(uint32_t cascade)
+{
+	return params.cascadeTexelSizes[cascade];
+}
+
+const ShadowParams& ShadowCascades::getParams()
+{
+	return params;
+}
+
+ShadowCascades::~ShadowCascades()
+{
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "utils.h"
+#include "Camera.h"
+
+// Directional light and its cascades as read by shadow.vert and the lighting shaders (std140)
+struct ShadowParams {
+	glm::mat4 cascadeMatrices[SHADOW_CASCADE_COUNT];	// World to shadow map: xy -1..1, depth 0..1
+	glm::vec4 cascadeTexelSizes;		// World size of a shadow texel of each cascade, scales the normal offset
+	glm::vec4 lightDirection;			// Direction the light travels, w unused
+	glm::vec4 lightColor;				// Color times intensity, w unused
+	uint32_t cascadeMask;				// Bit per cascade holding a rendered map, the others are skipped
+	uint32_t padding[3];
+};
+
+// CPU side of the cascaded shadow maps of one directional light
+// Fits every cascade to its slice of the camera frustum and picks the ones rendered this frame
+// A cascade keeps its matrix until it is rendered again, so a cached one still shades what it covers correctly
+class ShadowCascades
+{
+public:
+	ShadowCascades();
+
+	void setLight(const glm::vec3& direction, const glm::vec3& color);
+
+	// World bounding spheres of every renderable as SoA (computeWorldSpheres layout), rows as in the scene store
+	// Spheres that changed since the last update mark the cascades they touch as stale
+	void update(const Camera& camera, float fovY, float aspect, const float* centerX, const float* centerY,
+		const float* centerZ, const float* radius, size_t count);
+
+	// Results of the last update
+	bool isRendered(uint32_t cascade);
+	uint32_t getRenderedCount();
+	// Cascade box extended towards the light, for caster culling
+	const glm::vec4* getCasterPlanes(uint32_t cascade);
+	float getTexelSize(uint32_t cascade);
+	const ShadowParams& getParams();
+
+	~ShadowCascades();
+
+private:
+	struct Cascade {
+		glm::vec3 center;		// World sphere the map covers
+		float radius;
+		glm::vec4 planes[6];	// Of the cascade matrix
+		uint64_t renderedFrame;
+		bool valid;
+		bool stale;
+		bool render;
+	};
+
+	std::array<Cascade, SHADOW_CASCADE_COUNT> cascades = {};
+	ShadowParams params = {};
+	glm::mat4 lightView = glm::mat4(1.0f);
+	bool lightChanged = true;
+	uint64_t frame = 0;
+
+	// Spheres of the last update, to find what moved
+	std::vector<glm::vec4> previousSpheres;
+
+	void markTouched(const glm::vec4& sphere);
+	void fitCascade(uint32_t cascade, const glm::vec3& center, float radius);
+};
@@ -0,0 +1,218 @@
+#include "SimdMath.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <emmintrin.h>
+
+// Scalar version, used for the objects left over after the SSE batches
+static void computeNormalMatrix(Model& object, const glm::vec3& viewPos)
+{
+	glm::vec3 a = glm::vec3(object.model[0]);
+	glm::vec3 b = glm::vec3(object.model[1]);
+	glm::vec3 c = glm::vec3(object.model[2]);
+
+	// Inverse transpose of [a b c] is [b x c, c x a, a x b] / det
+	glm::vec3 bc = glm::cross(b, c);
+	float det = glm::dot(a, bc);
+	float invDet = std::fabs(det) < FLT_MIN ? 1.0f : 1.0f / det;
+
+	object.normal[0] = glm::vec4(bc * invDet, 0.0f);
+	object.normal[1] = glm::vec4(glm::cross(c, a) * invDet, 0.0f);
+	object.normal[2] = glm::vec4(glm::cross(a, b) * invDet, 0.0f);
+	object.normal[3] = glm::vec4(viewPos, 1.0f);
+}
+
+void computeNormalMatrices(Model* objects, size_t count, const glm::vec3& viewPos)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minDet = _mm_set1_ps(FLT_MIN);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 viewColumn = _mm_set_ps(1.0f, viewPos.z, viewPos.y, viewPos.x);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		// Transpose each of the first 3 columns of 4 matrices so every register holds one element for all 4 objects
+		// m[column][row]
+		__m128 m[3][4];
+		for (int col = 0; col < 3; col++)
+		{
+			m[col][0] = _mm_loadu_ps(&objects[i + 0].model[col][0]);
+			m[col][1] = _mm_loadu_ps(&objects[i + 1].model[col][0]);
+			m[col][2] = _mm_loadu_ps(&objects[i + 2].model[col][0]);
+			m[col][3] = _mm_loadu_ps(&objects[i + 3].model[col][0]);
+			_MM_TRANSPOSE4_PS(m[col][0], m[col][1], m[col][2], m[col][3]);
+		}
+
+		// Columns a, b, c of the 3x3 part
+		const __m128 ax = m[0][0], ay = m[0][1], az = m[0][2];
+		const __m128 bx = m[1][0], by = m[1][1], bz = m[1][2];
+		const __m128 cx = m[2][0], cy = m[2][1], cz = m[2][2];
+
+		// Cofactor columns: b x c, c x a, a x b
+		__m128 n[3][4];
+		n[0][0] = _mm_sub_ps(_mm_mul_ps(by, cz), _mm_mul_ps(bz, cy));
+		n[0][1] = _mm_sub_ps(_mm_mul_ps(bz, cx), _mm_mul_ps(bx, cz));
+		n[0][2] = _mm_sub_ps(_mm_mul_ps(bx, cy), _mm_mul_ps(by, cx));
+
+		n[1][0] = _mm_sub_ps(_mm_mul_ps(cy, az), _mm_mul_ps(cz, ay));
+		n[1][1] = _mm_sub_ps(_mm_mul_ps(cz, ax), _mm_mul_ps(cx, az));
+		n[1][2] = _mm_sub_ps(_mm_mul_ps(cx, ay), _mm_mul_ps(cy, ax));
+
+		n[2][0] = _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by));
+		n[2][1] = _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz));
+		n[2][2] = _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+
+		// det = a . (b x c), degenerate matrices (zero scale) keep the raw cofactors
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, n[0][0]), _mm_mul_ps(ay, n[0][1])), _mm_mul_ps(az, n[0][2]));
+		__m128 degenerate = _mm_cmplt_ps(_mm_and_ps(det, absMask), minDet);
+		det = _mm_or_ps(_mm_and_ps(degenerate, one), _mm_andnot_ps(degenerate, det));
+		__m128 invDet = _mm_div_ps(one, det);
+
+		// Scale and transpose back to one column per object
+		for (int col = 0; col < 3; col++)
+		{
+			n[col][0] = _mm_mul_ps(n[col][0], invDet);
+			n[col][1] = _mm_mul_ps(n[col][1], invDet);
+			n[col][2] = _mm_mul_ps(n[col][2], invDet);
+			n[col][3] = zero;
+			_MM_TRANSPOSE4_PS(n[col][0], n[col][1], n[col][2], n[col][3]);
+
+			_mm_storeu_ps(&objects[i + 0].normal[col][0], n[col][0]);
+			_mm_storeu_ps(&objects[i + 1].normal[col][0], n[col][1]);
+			_mm_storeu_ps(&objects[i + 2].normal[col][0], n[col][2]);
+			_mm_storeu_ps(&objects[i + 3].normal[col][0], n[col][3]);
+		}
+
+		_mm_storeu_ps(&objects[i + 0].normal[3][0], viewColumn);
+		_mm_storeu_ps(&objects[i + 1].normal[3][0], viewColumn);
+		_mm_storeu_ps(&objects[i + 2].normal[3][0], viewColumn);
+		_mm_storeu_ps(&objects[i + 3].normal[3][0], viewColumn);
+	}
+
+	// Remainder
+	for (; i < count; i++)
+	{
+		computeNormalMatrix(objects[i], viewPos);
+	}
+}
+
+void multiplyMatrix(const glm::mat4& a, const glm::mat4& b, glm::mat4* result)
+{
+	const __m128 a0 = _mm_loadu_ps(&a[0][0]);
+	const __m128 a1 = _mm_loadu_ps(&a[1][0]);
+	const __m128 a2 = _mm_loadu_ps(&a[2][0]);
+	const __m128 a3 = _mm_loadu_ps(&a[3][0]);
+
+	// Column j of the result is a combination of the columns of a, weighted by column j of b
+	__m128 columns[4];
+	for (int j = 0; j < 4; j++)
+	{
+		__m128 column = _mm_mul_ps(a0, _mm_set1_ps(b[j][0]));
+		column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(b[j][1])));
+		column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(b[j][2])));
+		column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(b[j][3])));
+		columns[j] = column;
+	}
+
+	for (int j = 0; j < 4; j++)
+	{
+		_mm_storeu_ps(&(*result)[j][0], columns[j]);
+	}
+}
+
+void extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+	// Rows of the matrix (glm is column major)
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; i++)
+	{
+		row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	planes[0] = row[3] + row[0];		// Left
+	planes[1] = row[3] - row[0];		// Right
+	planes[2] = row[3] + row[1];		// Bottom (top once y is flipped, the pair is the same)
+	planes[3] = row[3] - row[1];		// Top
+	planes[4] = row[3] + row[2];		// Near
+	planes[5] = row[3] - row[2];		// Far
+
+	for (int i = 0; i < 6; i++)
+	{
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+}
+
+void computeWorldSpheres(const glm::vec4* spheres, const uint32_t* transformIds, size_t count, const Model* objects,
+	float* centerX, float* centerY, float* centerZ, float* radius)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		const glm::mat4& model = objects[transformIds[i]].model;
+		const glm::vec4& sphere = spheres[i];
+
+		glm::vec4 center = model * glm::vec4(glm::vec3(sphere), 1.0f);
+		float scale = std::max(std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+			glm::dot(glm::vec3(model[1]), glm::vec3(model[1]))), glm::dot(glm::vec3(model[2]), glm::vec3(model[2])));
+
+		centerX[i] = center.x;
+		centerY[i] = center.y;
+		centerZ[i] = center.z;
+		radius[i] = sphere.w * std::sqrt(scale);
+	}
+
+	// Padding fails every plane test
+	for (size_t i = count; i < ((count + 3) & ~static_cast<size_t>(3)); i++)
+	{
+		centerX[i] = 0.0f;
+		centerY[i] = 0.0f;
+		centerZ[i] = 0.0f;
+		radius[i] = -FLT_MAX;
+	}
+}
+
+uint32_t cullSpheres(const float* centerX, const float* centerY, const float* centerZ, const float* radius,
+	size_t count, const glm::vec4 planes[6], uint8_t* visible)
+{
+	// Broadcast plane components once
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++)
+	{
+		planeX[p] = _mm_set1_ps(planes[p].x);
+		planeY[p] = _mm_set1_ps(planes[p].y);
+		planeZ[p] = _mm_set1_ps(planes[p].z);
+		planeW[p] = _mm_set1_ps(planes[p].w);
+	}
+
+	uint32_t visibleCount = 0;
+	for (size_t i = 0; i < count; i += 4)
+	{
+		__m128 x = _mm_load_ps(centerX + i);
+		__m128 y = _mm_load_ps(centerY + i);
+		__m128 z = _mm_load_ps(centerZ + i);
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_load_ps(radius + i));
+
+		// Visible while the signed distance to every plane is above -radius
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+				_mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+			inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, negRadius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		size_t laneCount = count - i < 4 ? count - i : 4;
+		for (size_t lane = 0; lane < laneCount; lane++)
+		{
+			uint8_t laneVisible = static_cast<uint8_t>((mask >> lane) & 1);
+			visible[i + lane] = laneVisible;
+			visibleCount += laneVisible;
+		}
+	}
+
+	return visibleCount;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+
+// Batch maths over contiguous per object arrays
+// SSE path processes 4 objects per iteration (x64 always has SSE2), remainder goes through the scalar path
+
+// Fills Model::normal for every object from Model::model
+// Normal matrix is the inverse transpose of the model upper 3x3, camera world position goes in column 3
+void computeNormalMatrices(Model* objects, size_t count, const glm::vec3& viewPos);
+
+
+// result = a * b, one SSE multiply-add chain per column, result may alias a or b
+void multiplyMatrix(const glm::mat4& a, const glm::mat4& b, glm::mat4* result);
+
+// Frustum planes of a view projection matrix, xyz normal pointing inside and w distance, normalised
+// Near plane is taken for a -1..1 depth range so it stays conservative whichever convention the projection uses
+void extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+
+// World space bounding sphere of every draw into SoA arrays (padded to a multiple of 4 with never visible spheres)
+// Inputs are the local spheres and transform ids of the scene store, radius is scaled by the largest axis scale of the model matrix
+void computeWorldSpheres(const glm::vec4* spheres, const uint32_t* transformIds, size_t count, const Model* objects,
+	float* centerX, float* centerY, float* centerZ, float* radius);
+
+// Sphere/frustum test on SoA arrays, 16 byte aligned and padded to a multiple of 4
+// visible[i] is set to 1 or 0, returns the number of visible spheres
+uint32_t cullSpheres(const float* centerX, const float* centerY, const float* centerZ, const float* radius,
+	size_t count, const glm::vec4 planes[6], uint8_t* visible);
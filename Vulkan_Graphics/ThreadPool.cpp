@@ -0,0 +1,122 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool()
+{
+}
+
+void ThreadPool::start(uint32_t threadCount)
+{
+	stopping = false;
+
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+void ThreadPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	workReady.notify_all();
+
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+}
+
+uint32_t ThreadPool::getThreadCount()
+{
+	return static_cast<uint32_t>(workers.size());
+}
+
+void ThreadPool::dispatch(uint32_t newJobCount, Job job, void* context)
+{
+	if (newJobCount == 0) return;
+
+	// No worker, run everything on the calling thread
+	if (workers.empty())
+	{
+		for (uint32_t i = 0; i < newJobCount; i++)
+		{
+			job(context, i);
+		}
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	currentJob = job;
+	currentContext = context;
+	jobCount = newJobCount;
+	nextJob = 0;
+	jobsRemaining = newJobCount;
+	jobError = nullptr;
+	generation++;
+	workReady.notify_all();
+
+	// Wait for the last job to finish
+	workDone.wait(lock, [this] { return jobsRemaining == 0; });
+
+	if (jobError)
+	{
+		std::exception_ptr error = jobError;
+		jobError = nullptr;
+		std::rethrow_exception(error);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	if (!workers.empty())
+	{
+		stop();
+	}
+}
+
+void ThreadPool::workerLoop()
+{
+	uint64_t seenGeneration = 0;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		// Sleep until a new dispatch or shutdown
+		workReady.wait(lock, [&] { return stopping || (generation != seenGeneration && nextJob < jobCount); });
+		if (stopping) return;
+
+		// Grab jobs until this dispatch is drained
+		while (nextJob < jobCount)
+		{
+			uint32_t jobIndex = nextJob++;
+			Job job = currentJob;
+			void* context = currentContext;
+
+			lock.unlock();
+			std::exception_ptr error = nullptr;
+			try
+			{
+				job(context, jobIndex);
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+			lock.lock();
+
+			if (error && !jobError)
+			{
+				jobError = error;
+			}
+
+			if (--jobsRemaining == 0)
+			{
+				workDone.notify_one();
+			}
+		}
+		seenGeneration = generation;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small persistent worker pool, workers sleep between dispatches
+// Jobs are plain function pointers + context so dispatching never allocates
+class ThreadPool
+{
+public:
+	typedef void (*Job)(void* context, uint32_t jobIndex);
+
+	ThreadPool();
+
+	void start(uint32_t threadCount);
+	void stop();
+
+	uint32_t getThreadCount();
+
+	// Runs job(context, i) for every i in [0, jobCount) on the workers and blocks until all are done
+	// First exception thrown by a job is rethrown on the calling thread
+	void dispatch(uint32_t jobCount, Job job, void* context);
+
+	~ThreadPool();
+
+private:
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable workReady;
+	std::condition_variable workDone;
+
+	Job currentJob = nullptr;
+	void* currentContext = nullptr;
+	uint32_t jobCount = 0;
+	uint32_t nextJob = 0;
+	uint32_t jobsRemaining = 0;
+	uint64_t generation = 0;
+	bool stopping = false;
+	std::exception_ptr jobError;
+
+	void workerLoop();
+};
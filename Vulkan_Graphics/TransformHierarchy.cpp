@@ -0,0 +1,121 @@
+#include "TransformHierarchy.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "SimdMath.h"
+
+TransformHierarchy::TransformHierarchy()
+{
+}
+
+void TransformHierarchy::create(uint32_t newCapacity)
+{
+	nodeAllocator.create(newCapacity);
+}
+
+uint32_t TransformHierarchy::addNodes(uint32_t count)
+{
+	uint32_t firstNode;
+	if (!nodeAllocator.allocate(count, &firstNode))
+	{
+		throw std::runtime_error("Reached maximum number of transform nodes");
+	}
+
+	// Arrays follow the end of the allocator, grown nodes are set up below with the reused ones
+	size_t nodeCount = nodeAllocator.getEnd();
+	if (parents.size() < nodeCount)
+	{
+		parents.resize(nodeCount);
+		localTransforms.resize(nodeCount);
+		worldTransforms.resize(nodeCount);
+		dirty.resize(nodeCount);
+	}
+
+	for (uint32_t node = firstNode; node < firstNode + count; node++)
+	{
+		parents[node] = -1;
+		localTransforms[node] = glm::mat4(1.0f);
+		dirty[node] = 1;
+	}
+
+	return firstNode;
+}
+
+void TransformHierarchy::removeNodes(uint32_t firstNode, uint32_t count)
+{
+	// Left as clean roots so the update pass skips them
+	for (uint32_t node = firstNode; node < firstNode + count; node++)
+	{
+		parents[node] = -1;
+		dirty[node] = 0;
+	}
+	nodeAllocator.free(firstNode, count);
+
+	size_t nodeCount = nodeAllocator.getEnd();
+	parents.resize(nodeCount);
+	localTransforms.resize(nodeCount);
+	worldTransforms.resize(nodeCount);
+	dirty.resize(nodeCount);
+}
+
+void TransformHierarchy::setNode(uint32_t node, int32_t parent, const glm::mat4& localTransform)
+{
+	if (parent >= static_cast<int32_t>(node))
+	{
+		throw std::runtime_error("Transform node parent has to come before the node");
+	}
+
+	parents[node] = parent;
+	localTransforms[node] = localTransform;
+	dirty[node] = 1;
+}
+
+void TransformHierarchy::setLocalTransform(uint32_t node, const glm::mat4& localTransform)
+{
+	localTransforms[node] = localTransform;
+	dirty[node] = 1;
+}
+
+const glm::mat4& TransformHierarchy::getWorldTransform(uint32_t node)
+{
+	return worldTransforms[node];
+}
+
+size_t TransformHierarchy::getNodeCount()
+{
+	return parents.size();
+}
+
+size_t TransformHierarchy::update(Model* objects)
+{
+	size_t updated = 0;
+	for (size_t i = 0; i < parents.size(); i++)
+	{
+		// Parents come first, their flag already includes anything above them
+		int32_t parent = parents[i];
+		if (parent >= 0)
+		{
+			dirty[i] |= dirty[parent];
+		}
+		if (!dirty[i]) continue;
+
+		if (parent >= 0)
+		{
+			multiplyMatrix(worldTransforms[parent], localTransforms[i], &worldTransforms[i]);
+		}
+		else
+		{
+			worldTransforms[i] = localTransforms[i];
+		}
+		objects[i].model = worldTransforms[i];
+		updated++;
+	}
+
+	std::fill(dirty.begin(), dirty.end(), 0);
+	return updated;
+}
+
+TransformHierarchy::~TransformHierarchy()
+{
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "RangeAllocator.h"
+
+// Scene graph transforms as flat arrays, one entry per node
+// Parents always sit before their children, so walking the arrays in order visits a parent first
+// and world matrices are rebuilt in one linear pass without following pointers
+// Nodes come in blocks (one per model), a removed block is reused by a later one that fits
+class TransformHierarchy
+{
+public:
+	TransformHierarchy();
+
+	void create(uint32_t newCapacity);
+
+	// Block of count root nodes with identity transforms, returns the first one, throws when no block fits
+	uint32_t addNodes(uint32_t count);
+	void removeNodes(uint32_t firstNode, uint32_t count);
+
+	// parent is -1 for a root, otherwise a node before this one
+	void setNode(uint32_t node, int32_t parent, const glm::mat4& localTransform);
+
+	void setLocalTransform(uint32_t node, const glm::mat4& localTransform);
+	const glm::mat4& getWorldTransform(uint32_t node);
+	// Nodes are in [0, count), removed ones included
+	size_t getNodeCount();
+
+	// Rebuilds the world matrix of every dirty node and of everything under it, and writes it to objects[node].model
+	// objects holds one entry per node, returns the number of nodes updated
+	size_t update(Model* objects);
+
+	~TransformHierarchy();
+
+private:
+	RangeAllocator nodeAllocator;
+	std::vector<int32_t> parents;
+	std::vector<glm::mat4> localTransforms;
+	std::vector<glm::mat4> worldTransforms;
+	std::vector<uint8_t> dirty;		// Local transform changed since the last update
+};
@@ -8,6 +8,121 @@
 
 const int MAX_FRAMES_DRAWS = 2;
 const int MAX_OBJECTS = 40;
+const int MAX_MODEL_TRANSFORMS = 4096;		// Capacity of the per image object storage buffer
+const int MAX_DRAW_ITEMS = 16384;			// Capacity of the per image draw data and draw command regions (one per mesh)
+const int MAX_TEXTURES = 128;				// Size of the texture array, matches shader.frag
+
+// Perspective projection planes, the light froxel slices are spread between them
+const float CAMERA_FOV_Y = 45.0f;			// Degrees
+const float CAMERA_NEAR_PLANE = 0.1f;
+const float CAMERA_FAR_PLANE = 100.0f;
+
+// Clustered forward lighting: the view frustum is split in LIGHT_GRID_X x LIGHT_GRID_Y screen tiles and LIGHT_GRID_Z
+// exponential depth slices (froxels), a compute pass lists the lights touching each one for the fragment shader
+// Grid sizes and MAX_LIGHTS_PER_CLUSTER are repeated in lightcull.comp and shader.frag
+const uint32_t MAX_LIGHTS = 4096;
+const uint32_t LIGHT_GRID_X = 16;
+const uint32_t LIGHT_GRID_Y = 9;
+const uint32_t LIGHT_GRID_Z = 24;
+const uint32_t LIGHT_CLUSTER_COUNT = LIGHT_GRID_X * LIGHT_GRID_Y * LIGHT_GRID_Z;
+const uint32_t MAX_LIGHTS_PER_CLUSTER = 128;
+const uint32_t LIGHT_CULL_GROUP_SIZE = 64;		// local_size_x of lightcull.comp
+
+// Deferred shading G-buffer: albedo, octahedral normal, material params (specular strength, shininess / 256)
+// Attachments after the forward ones in the deferred render pass, never leave the pass
+const uint32_t GBUFFER_ATTACHMENT_COUNT = 3;
+
+// Shared geometry pool capacity, over every mesh of the scene
+const uint32_t MAX_SCENE_VERTICES = 2 * 1024 * 1024;
+const uint32_t MAX_SCENE_INDICES = 8 * 1024 * 1024;
+const uint32_t MAX_SCENE_SHORT_INDICES = 8 * 1024 * 1024;	// 16 bit, meshes under 65536 vertices
+
+// Mesh LODs built at import, each about half the triangles of the previous one
+// A LOD is used once its simplification error projects under LOD_ERROR_PIXELS on screen
+const uint32_t MAX_MESH_LODS = 4;
+const float LOD_ERROR_PIXELS = 1.0f;
+
+// Clusters of the full detail mesh, culled one by one (frustum, normal cone, depth pyramid)
+const uint32_t MAX_CLUSTER_VERTICES = 64;
+const uint32_t MAX_CLUSTER_TRIANGLES = 124;
+const uint32_t MAX_DRAW_CLUSTERS = 65536;		// Capacity of the scene cluster buffer
+const uint32_t MAX_DRAW_COMMANDS = MAX_DRAW_ITEMS + MAX_DRAW_CLUSTERS;	// One command per draw or cluster at most
+
+// Import time index reordering: triangles per overdraw sorting group, FIFO cache size the ACMR report simulates
+const uint32_t OVERDRAW_GROUP_TRIANGLES = 256;
+const uint32_t ACMR_CACHE_SIZE = 16;
+
+// Indirect draw regions start with the draw counts, then one command list per index type
+// List 0 draws from the 32 bit index buffer, list 1 from the 16 bit one, each with its count at 4 * list
+const uint32_t DRAW_COMMAND_LIST_COUNT = 2;
+const VkDeviceSize DRAW_COUNT_SIZE = 16;
+const VkDeviceSize DRAW_COMMAND_LIST_SIZE = sizeof(VkDrawIndexedIndirectCommand) * MAX_DRAW_COMMANDS;
+const VkDeviceSize DRAW_COMMAND_REGION_SIZE = DRAW_COUNT_SIZE + DRAW_COMMAND_LIST_SIZE * DRAW_COMMAND_LIST_COUNT;
+// Transparent draws are sorted back to front on the CPU into one list, always 32 bit indices, one command per draw
+const VkDeviceSize TRANSPARENT_COMMAND_REGION_SIZE = DRAW_COUNT_SIZE + sizeof(VkDrawIndexedIndirectCommand) * MAX_DRAW_ITEMS;
+
+// Directional light cascaded shadow maps, SHADOW_CASCADE_COUNT slices of the view between the near plane and SHADOW_DISTANCE
+// The first SHADOW_CACHED_CASCADE_START cascades follow the camera, the others are fitted SHADOW_CACHE_MARGIN larger
+// and only rendered again once the view leaves them, the light turns or geometry inside them moves
+// At most SHADOW_MAX_CACHED_UPDATES cached cascades are rendered per frame, SHADOW_CASCADE_COUNT is repeated in the shaders
+const uint32_t SHADOW_CASCADE_COUNT = 4;
+const uint32_t SHADOW_MAP_SIZE = 2048;
+const float SHADOW_DISTANCE = 60.0f;
+const float SHADOW_SPLIT_LAMBDA = 0.75f;		// Logarithmic (1) to uniform (0) split distances
+const float SHADOW_CASTER_DISTANCE = 50.0f;		// Casters this far towards the light from a cascade still shadow it
+const uint32_t SHADOW_CACHED_CASCADE_START = 2;
+const float SHADOW_CACHE_MARGIN = 1.3f;
+const uint32_t SHADOW_MAX_CACHED_UPDATES = 1;
+// Caster commands of each cascade: draw counts, then one list per index type, one command per draw (no clusters)
+const VkDeviceSize SHADOW_COMMAND_LIST_SIZE = sizeof(VkDrawIndexedIndirectCommand) * MAX_DRAW_ITEMS;
+const VkDeviceSize SHADOW_COMMAND_REGION_SIZE = DRAW_COUNT_SIZE + SHADOW_COMMAND_LIST_SIZE * DRAW_COMMAND_LIST_COUNT;
+
+// Sample count of the scene attachments, capped at what the device supports
+// MSAA_AUTO averages the GPU time of MSAA_ADAPT_FRAMES frames: above MSAA_TARGET_FRAME_TIME it halves the samples,
+// under MSAA_UPGRADE_RATIO of it it doubles them up to MSAA_AUTO_MAX_SAMPLES. A new count rebuilds the passes and targets
+enum MsaaMode {
+	MSAA_OFF,
+	MSAA_2X,
+	MSAA_4X,
+	MSAA_8X,
+	MSAA_AUTO
+};
+const MsaaMode DEFAULT_MSAA_MODE = MSAA_AUTO;
+const VkSampleCountFlagBits MSAA_AUTO_START_SAMPLES = VK_SAMPLE_COUNT_4_BIT;
+const VkSampleCountFlagBits MSAA_AUTO_MAX_SAMPLES = VK_SAMPLE_COUNT_8_BIT;
+const float MSAA_TARGET_FRAME_TIME = 16.6f;		// Milliseconds
+const float MSAA_UPGRADE_RATIO = 0.6f;
+const uint32_t MSAA_ADAPT_FRAMES = 60;
+
+// Temporal anti-aliasing, replaces MSAA (the scene attachments are single sampled while it is on)
+// The projection is offset by a sub-pixel jitter from the first TAA_JITTER_COUNT points of the Halton (2, 3) sequence,
+// the second pass blends TAA_HISTORY_WEIGHT of the reprojected history, clamped to the colors around the pixel
+const bool DEFAULT_TEMPORAL_AA = false;
+const uint32_t TAA_JITTER_COUNT = 8;
+const float TAA_HISTORY_WEIGHT = 0.9f;
+
+// Dynamic resolution: the scene is drawn to the top left part of the attachments and upscaled by the second pass
+// Over DYNAMIC_RESOLUTION_TARGET_FRAME_TIME the scale drops at once to what should fit (cost follows the pixel count),
+// under DYNAMIC_RESOLUTION_UPGRADE_RATIO of it for DYNAMIC_RESOLUTION_UPGRADE_FRAMES frames in a row it rises one step.
+// In between it holds. Steps of DYNAMIC_RESOLUTION_STEP keep small changes from re-recording the command buffers
+// Off while temporal anti-aliasing is on, MSAA_AUTO only changes the samples at the ends of the scale range
+const bool DEFAULT_DYNAMIC_RESOLUTION = true;
+const float DYNAMIC_RESOLUTION_TARGET_FRAME_TIME = 15.0f;		// Milliseconds, under MSAA_TARGET_FRAME_TIME to absorb spikes
+const float DYNAMIC_RESOLUTION_UPGRADE_RATIO = 0.8f;
+const uint32_t DYNAMIC_RESOLUTION_UPGRADE_FRAMES = 30;
+const float DYNAMIC_RESOLUTION_MIN_SCALE = 0.5f;
+const float DYNAMIC_RESOLUTION_STEP = 0.05f;
+
+const uint32_t CULL_GROUP_SIZE = 64;		// local_size_x of cull.comp
+const uint32_t HIZ_GROUP_SIZE = 8;			// local_size_x and y of hiz.comp
+
+// CPU culling threads, below MIN_DRAWS_PER_CULL_JOB draws per slice threading costs more than it saves
+const int MAX_WORKER_THREADS = 8;
+const int MIN_DRAWS_PER_CULL_JOB = 4096;
+
+// Per frame transient memory: CPU arena per frame in flight, GPU scratch after the fixed regions of each frame data buffer
+const size_t FRAME_ARENA_SIZE = 1024 * 1024;
+const size_t FRAME_GPU_SCRATCH_SIZE = 256 * 1024;
 
 const std::vector<const char*> deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
@@ -21,6 +136,20 @@ struct Vertex {
 	glm::vec3 normal; //Normal coord (x, y, z)
 };
 
+// Layout of the vertices in the geometry pool, Vertex is always the import format
+enum VertexFormat {
+	VERTEX_FORMAT_FLOAT,		// Vertex as is
+	VERTEX_FORMAT_PACKED		// PackedVertex, RGB565 color (exact when constant over the mesh)
+};
+const VertexFormat SCENE_VERTEX_FORMAT = VERTEX_FORMAT_PACKED;
+
+// 16 bytes instead of 44
+struct PackedVertex {
+	uint16_t pos[4];	// Unorm in the mesh bounds, dequantized with the draw's position offset and scale, w RGB565 color
+	uint32_t normal;	// Octahedral, 2 x snorm16
+	uint32_t tex;		// 2 x half float
+};
+
 // Indices (locations) of Queue Families (if they exist at all)
 struct QueueFamilyIndices {
 	int graphicsFamily = -1;
@@ -174,15 +303,15 @@ static void endAndSubmitCommandBuffer(VkDevice device, VkCommandPool commandPool
 }
 
 static void copyBuffer(VkDevice device, VkQueue transferQueue, VkCommandPool transferCommandPool,
-	VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize bufferSize)
+	VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize bufferSize, VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0)
 {
 	// Create buffer
 	VkCommandBuffer transferCommandBuffer = beginCommandBuffer(device, transferCommandPool);
 
 	// Region of data to copy from and region to copy to
 	VkBufferCopy bufferCopyRegion = {};
-	bufferCopyRegion.srcOffset = 0;
-	bufferCopyRegion.dstOffset = 0;
+	bufferCopyRegion.srcOffset = srcOffset;
+	bufferCopyRegion.dstOffset = dstOffset;
 	bufferCopyRegion.size = bufferSize;
 
 	// Command to copy src buffer to dst buffer
@@ -263,3 +392,17 @@ static void transitionImageLayout(VkDevice device, VkQueue queue, VkCommandPool
 
 	endAndSubmitCommandBuffer(device, commandPool, queue, commandBuffer);
 }
+
+// Element index (from 1) of the Halton sequence of a prime base, 0 to 1, evenly spread however many are taken
+static float halton(uint32_t index, uint32_t base)
+{
+	float result = 0.0f;
+	float fraction = 1.0f;
+	while (index > 0)
+	{
+		fraction /= static_cast<float>(base);
+		result += fraction * static_cast<float>(index % base);
+		index /= base;
+	}
+	return result;
+}
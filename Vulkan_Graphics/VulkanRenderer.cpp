@@ -13,21 +13,42 @@ int VulkanRenderer::init(GLFWwindow* newWindow)
 		createSurface();
 		getPhysicalDevice();
 		createLogicalDevice();
+		// Before the pipelines, they take their vertex input from its format
+		geometryPool.create(mainDevice.physicalDevice, mainDevice.logicalDevice, SCENE_VERTEX_FORMAT,
+			MAX_SCENE_VERTICES, MAX_SCENE_INDICES, MAX_SCENE_SHORT_INDICES);
+		transformHierarchy.create(MAX_MODEL_TRANSFORMS);
+		clusterAllocator.create(MAX_DRAW_CLUSTERS);
 		createSwapChain();
 		createRenderPass();
+		createEarlyRenderPass();
+		createDeferredRenderPass();
+		createShadowRenderPass();
 		createDescriptorSetLayout();
-		createPushConstantRange();
 		createGraphicsPipeline();
+		createShadowPipeline();
+		createCullPipeline();
+		createLightCullPipeline();
+		createHizPipeline();
+		// Before the attachments, the temporal anti-aliasing history is given its layout with a one time command
+		createCommandPool();
 		createColorBufferImage();
 		createResolvedColorBufferImage();
 		createDepthBufferImage();
 		createResolvedDepthBufferImage();
+		createGBufferImages();
+		createTemporalAAImages();
 		createFramebuffer();
-		createCommandPool();
 		createCommandBuffers();	
+		createTimestampQueries();
+		createDepthPyramid();
+		createShadowMap();
+		cullThreadPool.start(std::min(static_cast<uint32_t>(MAX_WORKER_THREADS), std::max(1u, std::thread::hardware_concurrency())));
 		createTextureSampler();
 		//allocateDynamicBufferTransferSpace();
 		createUniformBuffers();
+		createCullBuffers();
+		createLightBuffers();
+		createFrameArenas();
 		createDescriptorPool();
 		createDescriptorSets();
 		createInputDescriptorSets();
@@ -35,11 +56,13 @@ int VulkanRenderer::init(GLFWwindow* newWindow)
 
 
 
-		uboViewProjection.projection = glm::perspective(glm::radians(45.0f), (float)swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 100.0f);
+		uboViewProjection.projection = glm::perspective(glm::radians(CAMERA_FOV_Y), (float)swapChainExtent.width / (float)swapChainExtent.height,
+			CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE);
 		uboViewProjection.view = camera.GetViewMatrix();
 
 		// Vulkan inverts the y coordinates from openGL glm was built for
 		uboViewProjection.projection[1][1] *= -1;
+		previousViewProjection = uboViewProjection.projection * uboViewProjection.view;
 
 		// Fallback Texture (default)
 		createTexture("plain.png");
@@ -53,15 +76,22 @@ int VulkanRenderer::init(GLFWwindow* newWindow)
 	return 0;
 }
 
-void VulkanRenderer::updateModel(int modelId, glm::mat4 newModel)
+void VulkanRenderer::updateModel(SceneHandle model, glm::mat4 newModel)
 {
-	if (modelId >= modelList.size()) return;
+	if (!sceneStore.isModelValid(model)) return;
+
+	// Placed by the model root, the node matrices of the file stay below it
+	transformHierarchy.setLocalTransform(sceneStore.getRootNode(model), newModel);
+}
 
-	modelList[modelId].setModel(newModel);
+const VulkanRenderer::FrameStats& VulkanRenderer::getFrameStats()
+{
+	return frameStats;
 }
 
 void VulkanRenderer::draw()
 {
+	uint64_t heapAllocationsAtStart = getHeapAllocationCount();
 
 	// -- GET NEXT IMAGE --
 	// Wait for given fence to signal open 
@@ -69,12 +99,46 @@ void VulkanRenderer::draw()
 	// Reset close Fences
 	vkResetFences(mainDevice.logicalDevice, 1, &drawFences[currentFrame]);
 
+	// GPU is done with this frame, its transient memory can be reused
+	LinearAllocator& frameArena = frameArenas[currentFrame];
+	frameArena.reset();
+
+	// Same for anything destroyed before this frame's previous use
+	processPendingDeletions();
+
 	// Signals semaphore imageAvailable when ready to be drawn to
 	uint32_t imageIndex;
 	vkAcquireNextImageKHR(mainDevice.logicalDevice, swapchain, std::numeric_limits<uint64_t>::max(),
 		imageAvailable[currentFrame], VK_NULL_HANDLE, &imageIndex);
 
-	recordCommands(imageIndex);
+	// Per image buffers and command buffers are rewritten below, the previous frame using this image must be done
+	if (imageFences[imageIndex] != VK_NULL_HANDLE && imageFences[imageIndex] != drawFences[currentFrame])
+	{
+		vkWaitForFences(mainDevice.logicalDevice, 1, &imageFences[imageIndex], VK_TRUE, std::numeric_limits<uint64_t>::max());
+	}
+	imageFences[imageIndex] = drawFences[currentFrame];
+
+	// Last frame of this image is done: its GPU time feeds the resolution and MSAA policies, the latter may rebuild the targets here
+	if (readGpuFrameTime(imageIndex))
+	{
+		updateRenderScale();
+	}
+	updateMsaaSamples();
+
+	// Fixed regions of the frame data buffer stay, scratch from this image's last frame is released
+	frameDataAllocators[imageIndex].reset(frameDataScratchMarker);
+
+	updateModelTransforms();
+
+	// Only matrices and camera moved: reuse the recorded commands, per frame data comes from the buffers
+	if (commandBufferDirty[imageIndex])
+	{
+		updateDrawData(imageIndex);
+		recordCommands(imageIndex);
+		commandBufferDirty[imageIndex] = false;
+	}
+	cullDraws(imageIndex);
+	updateShadows(imageIndex);
 	updateUniformBuffers(imageIndex);
 
 	// -- SUBMIT COMMAND BUFFER TO RENDER -- 
@@ -98,6 +162,7 @@ void VulkanRenderer::draw()
 	{
 		throw std::runtime_error("Failed to submit Command Buffer to Queue");
 	}
+	timestampsSubmitted[imageIndex] = true;
 
 	// -- PRESENT RENDERED IMAGE TO SCREEN --
 	VkPresentInfoKHR presentInfo = {};
@@ -114,7 +179,13 @@ void VulkanRenderer::draw()
 		throw std::runtime_error("Failed to present image");
 	}
 
+	frameStats.heapAllocations = getHeapAllocationCount() - heapAllocationsAtStart;
+	frameStats.arenaBytes = frameArena.getUsed();
+	frameStats.gpuScratchBytes = frameDataAllocators[imageIndex].getUsed() - frameDataScratchMarker;
+	frameStats.renderScale = renderScale;
+
 	currentFrame = (currentFrame + 1) % MAX_FRAMES_DRAWS;
+	frameNumber++;
 
 }
 
@@ -126,18 +197,19 @@ void VulkanRenderer::cleanup()
 
 	//_aligned_free(modelTransferSpace);
 
-	for (size_t i = 0; i < modelList.size(); i++)
-	{
-		modelList[i].destroyMeshModel();
-	}
+	// Device is idle, textures of destroyed models go with the others below
+	pendingDeletions.clear();
+	geometryPool.destroy();
 
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, inputDescriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, inputSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, gBufferInputSetLayout, nullptr);
 
 	vkDestroyDescriptorPool(mainDevice.logicalDevice, samplerDescriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, samplerSetLayout, nullptr);
 
 	vkDestroySampler(mainDevice.logicalDevice, textureSampler, nullptr);
+	vkDestroySampler(mainDevice.logicalDevice, postSampler, nullptr);
 
 	for (size_t i = 0; i < textureImages.size(); i++)
 	{
@@ -151,13 +223,6 @@ void VulkanRenderer::cleanup()
 		vkDestroyImage(mainDevice.logicalDevice, resolvedDepthBufferImage[i], nullptr);
 		vkFreeMemory(mainDevice.logicalDevice, resolvedDepthBufferImageMemory[i], nullptr);
 	}
-
-	for (size_t i = 0; i < depthBufferImage.size(); i++)
-	{
-		vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView[i], nullptr);
-		vkDestroyImage(mainDevice.logicalDevice, depthBufferImage[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, depthBufferImageMemory[i], nullptr);
-	}
 	for (size_t i = 0; i < resolvedColorBufferImage.size(); i++)
 	{
 		vkDestroyImageView(mainDevice.logicalDevice, resolvedColorBufferImageView[i], nullptr);
@@ -165,20 +230,55 @@ void VulkanRenderer::cleanup()
 		vkFreeMemory(mainDevice.logicalDevice, resolvedColorBufferImageMemory[i], nullptr);
 	}
 
-	for (size_t i = 0; i < colorBufferImage.size(); i++)
+	vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, descriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, cullSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, lightCullSetLayout, nullptr);
+
+	vkDestroyDescriptorPool(mainDevice.logicalDevice, hizDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, hizSetLayout, nullptr);
+
+	vkDestroySampler(mainDevice.logicalDevice, depthPyramidSampler, nullptr);
+	for (auto mipView : depthPyramidMipViews)
+	{
+		vkDestroyImageView(mainDevice.logicalDevice, mipView, nullptr);
+	}
+	vkDestroyImageView(mainDevice.logicalDevice, depthPyramidImageView, nullptr);
+	vkDestroyImage(mainDevice.logicalDevice, depthPyramidImage, nullptr);
+	vkFreeMemory(mainDevice.logicalDevice, depthPyramidImageMemory, nullptr);
+
+	vkDestroySampler(mainDevice.logicalDevice, shadowMapSampler, nullptr);
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
 	{
-		vkDestroyImageView(mainDevice.logicalDevice, colorBufferImageView[i], nullptr);
-		vkDestroyImage(mainDevice.logicalDevice, colorBufferImage[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, colorBufferImageMemory[i], nullptr);
+		vkDestroyFramebuffer(mainDevice.logicalDevice, shadowFramebuffers[i], nullptr);
+		vkDestroyImageView(mainDevice.logicalDevice, shadowCascadeViews[i], nullptr);
 	}
+	vkDestroyImageView(mainDevice.logicalDevice, shadowMapImageView, nullptr);
+	vkDestroyImage(mainDevice.logicalDevice, shadowMapImage, nullptr);
+	vkFreeMemory(mainDevice.logicalDevice, shadowMapImageMemory, nullptr);
 
-	vkDestroyDescriptorPool(mainDevice.logicalDevice, descriptorPool, nullptr);
-	vkDestroyDescriptorSetLayout(mainDevice.logicalDevice, descriptorSetLayout, nullptr);
+	if (timestampQueryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(mainDevice.logicalDevice, timestampQueryPool, nullptr);
+	}
+
+	vkDestroyBuffer(mainDevice.logicalDevice, drawVisibilityBuffer, nullptr);
+	vkFreeMemory(mainDevice.logicalDevice, drawVisibilityBufferMemory, nullptr);
+	vkDestroyBuffer(mainDevice.logicalDevice, clusterBuffer, nullptr);
+	vkFreeMemory(mainDevice.logicalDevice, clusterBufferMemory, nullptr);
+	vkDestroyBuffer(mainDevice.logicalDevice, clusterVisibilityBuffer, nullptr);
+	vkFreeMemory(mainDevice.logicalDevice, clusterVisibilityBufferMemory, nullptr);
 
 	for (size_t i = 0; i < swapChainImages.size(); i++)
 	{
-		vkDestroyBuffer(mainDevice.logicalDevice, vpUniformBuffer[i], nullptr);
-		vkFreeMemory(mainDevice.logicalDevice, vpUniformBufferMemory[i], nullptr);
+		frameDataAllocators[i].destroy();
+		vkUnmapMemory(mainDevice.logicalDevice, frameDataBufferMemory[i]);
+		vkDestroyBuffer(mainDevice.logicalDevice, frameDataBuffer[i], nullptr);
+		vkFreeMemory(mainDevice.logicalDevice, frameDataBufferMemory[i], nullptr);
+		vkDestroyBuffer(mainDevice.logicalDevice, cullOutputBuffer[i], nullptr);
+		vkFreeMemory(mainDevice.logicalDevice, cullOutputBufferMemory[i], nullptr);
+		vkDestroyBuffer(mainDevice.logicalDevice, lightGridBuffer[i], nullptr);
+		vkFreeMemory(mainDevice.logicalDevice, lightGridBufferMemory[i], nullptr);
 		//vkDestroyBuffer(mainDevice.logicalDevice, modelDynUniformBuffer[i], nullptr);
 		//vkFreeMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[i], nullptr);
 	}
@@ -188,18 +288,21 @@ void VulkanRenderer::cleanup()
 		vkDestroySemaphore(mainDevice.logicalDevice, imageAvailable[i], nullptr);
 		vkDestroyFence(mainDevice.logicalDevice, drawFences[i], nullptr);
 	}
+	cullThreadPool.stop();
 	vkDestroyCommandPool(mainDevice.logicalDevice, graphicsCommandPool, nullptr);
 
-	for (auto framebuffer : swapChainFramebuffers)
-	{
-		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
-	}
-	vkDestroyPipeline(mainDevice.logicalDevice, secondPipeline, nullptr);
-	vkDestroyPipelineLayout(mainDevice.logicalDevice, secondPipelineLayout, nullptr);
-	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
+	destroyMultisampleTargets();
+	vkDestroyPipeline(mainDevice.logicalDevice, cullPipeline, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, cullPipelineLayout, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, lightCullPipeline, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, lightCullPipelineLayout, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, hizPipeline, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, hizPipelineLayout, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, shadowPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, shadowClearPipeline, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, shadowPipelineLayout, nullptr);
 
-	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, shadowRenderPass, nullptr);
 
 	for (auto image : swapChainImages)
 	{
@@ -222,6 +325,108 @@ void VulkanRenderer::cleanup()
 
 }
 
+void VulkanRenderer::recreateMultisampleTargets(VkSampleCountFlagBits samples)
+{
+	// Nothing in flight may still use the old targets
+	vkDeviceWaitIdle(mainDevice.logicalDevice);
+	destroyMultisampleTargets();
+
+	msaaSamples = samples;
+	temporalAATargets = temporalAA;
+	dynamicResolutionTargets = dynamicResolution && !temporalAA;
+	if (!dynamicResolutionTargets)
+	{
+		renderScale = 1.0f;
+	}
+	createRenderPass();
+	createEarlyRenderPass();
+	createDeferredRenderPass();
+	createGraphicsPipeline();
+	createColorBufferImage();
+	createDepthBufferImage();
+	createGBufferImages();
+	createTemporalAAImages();
+	createFramebuffer();
+
+	// Views of the second pass and the first pyramid level depend on whether anything is resolved
+	writeInputDescriptorSets();
+	writeHizDescriptorSets();
+
+	// New history image, nothing rendered into it yet
+	taaHistoryValid = false;
+
+	// Timestamps of frames submitted before measured the old count
+	timestampsSubmitted.assign(timestampsSubmitted.size(), false);
+	msaaFrameTimeSum = 0.0f;
+	msaaFrameCount = 0;
+	renderScaleUpgradeFrames = 0;
+
+	markSceneDirty();
+}
+
+void VulkanRenderer::destroyMultisampleTargets()
+{
+	for (auto framebuffer : swapChainFramebuffers)
+	{
+		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+	}
+	for (auto framebuffer : earlyFramebuffers)
+	{
+		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+	}
+	for (auto framebuffer : deferredFramebuffers)
+	{
+		vkDestroyFramebuffer(mainDevice.logicalDevice, framebuffer, nullptr);
+	}
+
+	vkDestroyPipeline(mainDevice.logicalDevice, earlyDepthPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, gBufferPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, lightingPipeline, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, lightingPipelineLayout, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, deferredTransparentPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, deferredSecondPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, secondPipeline, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, secondPipelineLayout, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, graphicsPipeline, nullptr);
+	vkDestroyPipelineLayout(mainDevice.logicalDevice, pipelineLayout, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, earlyGraphicsPipeline, nullptr);
+	vkDestroyPipeline(mainDevice.logicalDevice, transparentPipeline, nullptr);
+
+	vkDestroyRenderPass(mainDevice.logicalDevice, renderPass, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, earlyRenderPass, nullptr);
+	vkDestroyRenderPass(mainDevice.logicalDevice, deferredRenderPass, nullptr);
+
+	for (size_t i = 0; i < GBUFFER_ATTACHMENT_COUNT; i++)
+	{
+		vkDestroyImageView(mainDevice.logicalDevice, gBufferImageView[i], nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, gBufferImage[i], nullptr);
+		vkFreeMemory(mainDevice.logicalDevice, gBufferImageMemory[i], nullptr);
+	}
+	vkDestroyImageView(mainDevice.logicalDevice, depthBufferImageView, nullptr);
+	vkDestroyImage(mainDevice.logicalDevice, depthBufferImage, nullptr);
+	vkFreeMemory(mainDevice.logicalDevice, depthBufferImageMemory, nullptr);
+	vkDestroyImageView(mainDevice.logicalDevice, colorBufferImageView, nullptr);
+	vkDestroyImage(mainDevice.logicalDevice, colorBufferImage, nullptr);
+	vkFreeMemory(mainDevice.logicalDevice, colorBufferImageMemory, nullptr);
+
+	// Temporal anti-aliasing targets exist only when the targets were built with it
+	if (velocityImage != VK_NULL_HANDLE)
+	{
+		vkDestroyImageView(mainDevice.logicalDevice, velocityImageView, nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, velocityImage, nullptr);
+		vkFreeMemory(mainDevice.logicalDevice, velocityImageMemory, nullptr);
+		vkDestroyImageView(mainDevice.logicalDevice, taaResolveImageView, nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, taaResolveImage, nullptr);
+		vkFreeMemory(mainDevice.logicalDevice, taaResolveImageMemory, nullptr);
+		vkDestroyImageView(mainDevice.logicalDevice, historyImageView, nullptr);
+		vkDestroyImage(mainDevice.logicalDevice, historyImage, nullptr);
+		vkFreeMemory(mainDevice.logicalDevice, historyImageMemory, nullptr);
+		velocityImage = VK_NULL_HANDLE;
+		taaResolveImage = VK_NULL_HANDLE;
+		historyImage = VK_NULL_HANDLE;
+	}
+}
+
 VulkanRenderer::~VulkanRenderer()
 {
 }
@@ -329,9 +534,24 @@ void VulkanRenderer::createLogicalDevice()
 	// Empty struct as of now, will update with features used (check def and set to true)
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
+	deviceFeatures.drawIndirectFirstInstance = VK_TRUE;		// Indirect draws select their draw data with firstInstance
+	deviceFeatures.sampleRateShading = VK_TRUE;				// Deferred lighting runs per sample under MSAA
+	deviceFeatures.depthClamp = VK_TRUE;					// Shadow casters in front of a cascade box are flattened onto it
 
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
 
+	// 1.2 features: whole scene in one indirect count draw, texture array indexed per draw
+	// and updated while frames are in flight as textures are loaded and unloaded
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	vulkan12Features.drawIndirectCount = VK_TRUE;
+	vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	vulkan12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+
+	deviceCreateInfo.pNext = &vulkan12Features;
+
 	//Create logical device for given physical device
 	VkResult result = vkCreateDevice(mainDevice.physicalDevice, &deviceCreateInfo, nullptr, &mainDevice.logicalDevice);
 	if (result != VK_SUCCESS)
@@ -449,6 +669,9 @@ void VulkanRenderer::createRenderPass()
 	// Array of our subpasses zero-init
 	std::array<VkSubpassDescription2, 2> subpasses {};
 
+	// Motion vectors of temporal anti-aliasing, same attachment in the early and deferred passes
+	velocityFormat = chooseSupportedFormat({ VK_FORMAT_R16G16_SFLOAT }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+
 	// ATTACHMENTS
 
 	// Subpass 1 Attachment + References (Inputs)
@@ -462,11 +685,11 @@ void VulkanRenderer::createRenderPass()
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
 	colorAttachment.samples = msaaSamples;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;			// Early pass draws first
 	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; 
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
 	// Depth attachment (Input)
@@ -480,11 +703,13 @@ void VulkanRenderer::createRenderPass()
 		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
 	);
 	depthAttachment.samples = msaaSamples;
-	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
 	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	// Without MSAA the early pass leaves it readable by hiz.comp
+	depthAttachment.initialLayout = msaaSamples == VK_SAMPLE_COUNT_1_BIT ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+		: VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 	// Resolved color attachment (Input)
@@ -559,14 +784,37 @@ void VulkanRenderer::createRenderPass()
 
 	std::array<VkAttachmentReference2, 2> resolveReferences = { resolvedColorAttachmentReference, resolvedDepthAttachmentReference };
 
+	// Single sample attachments cannot be resolved, subpass 2 then reads them directly
+	bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
+	// Temporal anti-aliasing attachments (always single sampled): velocity from the early pass,
+	// resolved color written by subpass 2 and copied to the history once the pass is done
+	VkAttachmentDescription2 velocityAttachment = {};
+	velocityAttachment.sType = VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2;
+	velocityAttachment.format = velocityFormat;
+	velocityAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	velocityAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	velocityAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	velocityAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	velocityAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	velocityAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	velocityAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentDescription2 taaResolveAttachment = resolvedColorAttachment;
+	taaResolveAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	taaResolveAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+	std::array<VkAttachmentReference2, 2> sceneColorReferences = { colorAttachmentReference, colorAttachmentReference };
+	sceneColorReferences[1].attachment = 5;
+
 	// Description Info about subpass 1
 	subpasses[0].sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2;
-	subpasses[0].pNext = &depthResolveInfo;
+	subpasses[0].pNext = resolve ? &depthResolveInfo : nullptr;
 	subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpasses[0].colorAttachmentCount = 1;
-	subpasses[0].pColorAttachments = &colorAttachmentReference;
+	subpasses[0].colorAttachmentCount = temporalAATargets ? 2 : 1;
+	subpasses[0].pColorAttachments = sceneColorReferences.data();
 	subpasses[0].pDepthStencilAttachment = &depthAttachmentReference;
-	subpasses[0].pResolveAttachments = resolveReferences.data();
+	subpasses[0].pResolveAttachments = resolve ? resolveReferences.data() : nullptr;
 
 	// Subpass 2 Attachments and references
 	// Sawpchain Color attachment
@@ -607,27 +855,32 @@ void VulkanRenderer::createRenderPass()
 	inputReferences[1].pNext = nullptr;
 	inputReferences[1].aspectMask = VK_IMAGE_ASPECT_METADATA_BIT;
 
-	inputReferences[2].attachment = 3;
+	inputReferences[2].attachment = resolve ? 3 : 1;
 	inputReferences[2].sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2;
 	inputReferences[2].layout =  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 	inputReferences[2].pNext = nullptr;
 	inputReferences[2].aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 
-	inputReferences[3].attachment = 4;
+	inputReferences[3].attachment = resolve ? 4 : 2;
 	inputReferences[3].sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2;
 	inputReferences[3].layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 	inputReferences[3].pNext = nullptr;
 	inputReferences[3].aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
 
-	std::array<VkAttachmentReference2, 2> usedInputReferences = { inputReferences[2], inputReferences[3] };
+	// Velocity as the third input with temporal anti-aliasing
+	std::array<VkAttachmentReference2, 3> usedInputReferences = { inputReferences[2], inputReferences[3], inputReferences[2] };
+	usedInputReferences[2].attachment = 5;
+
+	std::array<VkAttachmentReference2, 2> postColorReferences = { swapchainColorAttachmentReference, swapchainColorAttachmentReference };
+	postColorReferences[1].attachment = 6;
 
 	// Set up subpass 2	
 	subpasses[1].sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2;
 	subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpasses[1].pNext = nullptr;
-	subpasses[1].colorAttachmentCount = 1;
-	subpasses[1].pColorAttachments = &swapchainColorAttachmentReference;
-	subpasses[1].inputAttachmentCount = static_cast<uint32_t>(usedInputReferences.size());
+	subpasses[1].colorAttachmentCount = temporalAATargets ? 2 : 1;
+	subpasses[1].pColorAttachments = postColorReferences.data();
+	subpasses[1].inputAttachmentCount = temporalAATargets ? 3 : 2;
 	subpasses[1].pInputAttachments = usedInputReferences.data();
 
 	// Subpass Dependencies
@@ -643,10 +896,11 @@ void VulkanRenderer::createRenderPass()
 	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
 	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
 	subpassDependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-	// Transition must happen before
+	// Transition must happen before, color and depth are loaded from the early pass
 	subpassDependencies[0].dstSubpass = 0;
-	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;	
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	subpassDependencies[0].dependencyFlags = 0;
 
 	// Subpass 1 layout (color/depth) to Subpass 2 layout (shader read)
@@ -654,8 +908,8 @@ void VulkanRenderer::createRenderPass()
 	subpassDependencies[1].pNext = nullptr;
 	subpassDependencies[1].viewOffset = 0;
 	subpassDependencies[1].srcSubpass = 0;
-	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	// Transition must happen before
 	subpassDependencies[1].dstSubpass = 1;
 	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
@@ -675,14 +929,21 @@ void VulkanRenderer::createRenderPass()
 	subpassDependencies[2].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
 	subpassDependencies[2].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
 	subpassDependencies[2].dependencyFlags = 0;
+	if (temporalAATargets)
+	{
+		// Resolved color to the history copy
+		subpassDependencies[2].dstStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+		subpassDependencies[2].dstAccessMask |= VK_ACCESS_TRANSFER_READ_BIT;
+	}
 	
-	std::array<VkAttachmentDescription2, 5> renderPassAttachments = { swapchainColorAttachment, colorAttachment, 
-		depthAttachment, resolvedColorAttachment, resolvedDepthAttachment };
+	// The temporal anti-aliasing attachments are left out without it
+	std::array<VkAttachmentDescription2, 7> renderPassAttachments = { swapchainColorAttachment, colorAttachment, 
+		depthAttachment, resolvedColorAttachment, resolvedDepthAttachment, velocityAttachment, taaResolveAttachment };
 
 	//Create info for renderpass
 	VkRenderPassCreateInfo2 renderPassCreateInfo = {};
 	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO_2;
-	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(renderPassAttachments.size());
+	renderPassCreateInfo.attachmentCount = temporalAATargets ? 7 : 5;
 	renderPassCreateInfo.pAttachments = renderPassAttachments.data();
 	renderPassCreateInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
 	renderPassCreateInfo.pSubpasses = subpasses.data();
@@ -699,196 +960,774 @@ void VulkanRenderer::createRenderPass()
 	}
 }
 
-void VulkanRenderer::createDescriptorSetLayout()
+void VulkanRenderer::createEarlyRenderPass()
 {
-	// UNIFORM VALUES 
-	// UboViewProjection Binding info
-	VkDescriptorSetLayoutBinding vpLayoutBinding = {};
-	vpLayoutBinding.binding = 0;
-	vpLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	vpLayoutBinding.descriptorCount = 1;
-	vpLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;				// Shader stage to bind to
-	vpLayoutBinding.pImmutableSamplers = nullptr;							// For textures
-
-	/*
-	// Model Binding info
-	VkDescriptorSetLayoutBinding modelLayoutBinding = {};
-	modelLayoutBinding.binding = 1;
-	modelLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-	modelLayoutBinding.descriptorCount = 1;
-	modelLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	modelLayoutBinding.pImmutableSamplers = nullptr;
-	*/
-
-	std::vector<VkDescriptorSetLayoutBinding> layoutBindings = { vpLayoutBinding };
+	// Same color and depth attachments as subpass 0 of the main pass, kept for it to load
+	VkAttachmentDescription2 colorAttachment = {};
+	colorAttachment.sType = VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2;
+	colorAttachment.format = chooseSupportedFormat(
+		{ VK_FORMAT_R8G8B8A8_UNORM },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+	colorAttachment.samples = msaaSamples;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-	// Create descriptor set layout for given bindings
-	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
-	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutCreateInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
-	layoutCreateInfo.pBindings = layoutBindings.data();
+	VkAttachmentDescription2 depthAttachment = {};
+	depthAttachment.sType = VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2;
+	depthAttachment.format = chooseSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+	);
+	depthAttachment.samples = msaaSamples;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-	// Create descriptor set layout
-	VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice,
-		&layoutCreateInfo, nullptr, &descriptorSetLayout);
-	if (result != VK_SUCCESS)
+	// Single sample depth, read by hiz.comp for the first pyramid level
+	// Without MSAA there is nothing to resolve and hiz.comp reads the depth attachment itself
+	bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+	if (!resolve)
 	{
-		throw std::runtime_error("Unable to create Descriptor set layout");
+		depthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 	}
 
-	// TEXTURE SAMPLER 
-	// Texture binding infos
-	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-	samplerLayoutBinding.binding = 0;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
+	VkAttachmentDescription2 resolvedDepthAttachment = depthAttachment;
+	resolvedDepthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	resolvedDepthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	resolvedDepthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-	// Create a descriptor Set layout with binding for texture
-	VkDescriptorSetLayoutCreateInfo textureLayoutCreateInfo = {};
-	textureLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	textureLayoutCreateInfo.bindingCount = 1;
-	textureLayoutCreateInfo.pBindings = &samplerLayoutBinding;
+	// Temporal anti-aliasing motion vectors, cleared to no motion where nothing is drawn
+	// The depth only pipeline of deferred shading leaves it cleared, the G-buffer subpass writes it
+	VkAttachmentDescription2 velocityAttachment = colorAttachment;
+	velocityAttachment.format = velocityFormat;
+	velocityAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
 
-	// Create descriptor set layout
-	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &textureLayoutCreateInfo, nullptr, &samplerSetLayout);
+	std::array<VkAttachmentReference2, 2> colorAttachmentReferences = {};
+	VkAttachmentReference2& colorAttachmentReference = colorAttachmentReferences[0];
+	colorAttachmentReference.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2;
+	colorAttachmentReference.attachment = 0;
+	colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colorAttachmentReferences[1] = colorAttachmentReference;
+	colorAttachmentReferences[1].attachment = 3;
 
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Unable to create Descriptor set layout");
-	}
+	VkAttachmentReference2 depthAttachmentReference = {};
+	depthAttachmentReference.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2;
+	depthAttachmentReference.attachment = 1;
+	depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-	// Create input atachment image descriptor set layout
-	// Color input binding
-	VkDescriptorSetLayoutBinding colorInputLayoutBinding = {};
-	colorInputLayoutBinding.binding = 0;
-	colorInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	colorInputLayoutBinding.descriptorCount = 1;
-	colorInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	VkAttachmentReference2 resolvedDepthAttachmentReference = {};
+	resolvedDepthAttachmentReference.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2;
+	resolvedDepthAttachmentReference.attachment = 2;
+	resolvedDepthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-	// Depth input Binding
-	VkDescriptorSetLayoutBinding depthInputLayoutBinding = {};
-	depthInputLayoutBinding.binding = 1;
-	depthInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	depthInputLayoutBinding.descriptorCount = 1;
-	depthInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	VkSubpassDescriptionDepthStencilResolve depthResolveInfo = {};
+	depthResolveInfo.sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_DEPTH_STENCIL_RESOLVE;
+	depthResolveInfo.pDepthStencilResolveAttachment = &resolvedDepthAttachmentReference;
+	depthResolveInfo.depthResolveMode = VK_RESOLVE_MODE_SAMPLE_ZERO_BIT;
+	depthResolveInfo.stencilResolveMode = VK_RESOLVE_MODE_SAMPLE_ZERO_BIT;
 
-	// Resolved Color Binding
-	VkDescriptorSetLayoutBinding resolvedColorInputLayoutBinding = {};
-	resolvedColorInputLayoutBinding.binding = 2;
-	resolvedColorInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	resolvedColorInputLayoutBinding.descriptorCount = 1;
-	resolvedColorInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	VkSubpassDescription2 subpass = {};
+	subpass.sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2;
+	subpass.pNext = resolve ? &depthResolveInfo : nullptr;
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = temporalAATargets ? 2 : 1;
+	subpass.pColorAttachments = colorAttachmentReferences.data();
+	subpass.pDepthStencilAttachment = &depthAttachmentReference;
 
-	// Resolved Color Binding
-	VkDescriptorSetLayoutBinding resolvedDepthInputLayoutBinding = {};
-	resolvedDepthInputLayoutBinding.binding = 3;
-	resolvedDepthInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	resolvedDepthInputLayoutBinding.descriptorCount = 1;
-	resolvedDepthInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	std::array<VkSubpassDependency2, 2> subpassDependencies = {};
 
+	// Previous users of the attachments must be done, color and depth are shared with the frames submitted before
+	subpassDependencies[0].sType = VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2;
+	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		| VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[0].dstSubpass = 0;
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
-	// Array of input attachment bindings
-	std::vector<VkDescriptorSetLayoutBinding> inputBindings = { colorInputLayoutBinding, depthInputLayoutBinding, 
-		resolvedColorInputLayoutBinding, resolvedDepthInputLayoutBinding };
-	
-	// Create a descriptor set layout for input attachments
-	VkDescriptorSetLayoutCreateInfo inputLayoutCreateInfo = {};
-	inputLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	inputLayoutCreateInfo.bindingCount = static_cast<uint32_t>(inputBindings.size());
-	inputLayoutCreateInfo.pBindings = inputBindings.data();
+	// Resolved depth to the pyramid build, color and depth to the main pass
+	subpassDependencies[1].sType = VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2;
+	subpassDependencies[1].srcSubpass = 0;
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+		| VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
 
-	// Create Input descriptor set layout
-	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &inputLayoutCreateInfo, nullptr, &inputSetLayout);
+	std::array<VkAttachmentDescription2, 4> renderPassAttachments = { colorAttachment, depthAttachment, resolvedDepthAttachment,
+		velocityAttachment };
+
+	VkRenderPassCreateInfo2 renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO_2;
+	renderPassCreateInfo.attachmentCount = temporalAATargets ? 4 : 3;
+	renderPassCreateInfo.pAttachments = renderPassAttachments.data();
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &subpass;
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
+	renderPassCreateInfo.pDependencies = subpassDependencies.data();
 
+	VkResult result = vkCreateRenderPass2(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &earlyRenderPass);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Unable to create input Descriptor set layout");
+		throw std::runtime_error("Failed to create early renderPass");
 	}
-
 }
 
-void VulkanRenderer::createPushConstantRange()
+void VulkanRenderer::createDeferredRenderPass()
 {
-	// Define range values
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	pushConstantRange.offset = 0;
-	pushConstantRange.size = sizeof(Model);
-}
+	// G-buffer formats, two 16 bit channels keep the octahedral normal precise enough for specular
+	gBufferFormats[0] = chooseSupportedFormat({ VK_FORMAT_R8G8B8A8_UNORM }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+	gBufferFormats[1] = chooseSupportedFormat({ VK_FORMAT_R16G16_SNORM, VK_FORMAT_R16G16_SFLOAT }, VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+	gBufferFormats[2] = chooseSupportedFormat({ VK_FORMAT_R8G8B8A8_UNORM }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
 
-void VulkanRenderer::createGraphicsPipeline()
-{
-	// Read our Spir-V code 
-	auto vertexShaderCode = readFile("Shaders/vert.spv");
-	auto fragmentShaderCode = readFile("Shaders/frag.spv");
+	VkFormat colorFormat = chooseSupportedFormat(
+		{ VK_FORMAT_R8G8B8A8_UNORM },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT);
+	VkFormat depthFormat = chooseSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT);
 
-	// Build shader Module
-	VkShaderModule vertexShaderModule = createShaderModule(vertexShaderCode);
-	VkShaderModule fragmentShaderModule = createShaderModule(fragmentShaderCode);
+	// ATTACHMENTS
+	// 0 swapchain, 1 color, 2 depth, 3 resolved color, 4 resolved depth: same images as the forward pass
+	// 5 to 7 G-buffer, then velocity and the resolved color with temporal anti-aliasing
+	const uint32_t velocityAttachment = 5 + GBUFFER_ATTACHMENT_COUNT;
+	const uint32_t taaResolveAttachment = velocityAttachment + 1;
+	std::array<VkAttachmentDescription2, 5 + GBUFFER_ATTACHMENT_COUNT + 2> attachments = {};
+	for (auto& attachment : attachments)
+	{
+		attachment.sType = VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2;
+		attachment.samples = msaaSamples;
+		attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	}
 
-	// Shader Stage Creation 1 - Information
-	// Vert stage Creation
-	VkPipelineShaderStageCreateInfo vertexShaderCreateInfo = {};
-	vertexShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertexShaderCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertexShaderCreateInfo.module = vertexShaderModule;
-	// Entry point function on shader
-	vertexShaderCreateInfo.pName = "main"; 
+	attachments[0].format = swapChainImageFormat;
+	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
-	// Frag stage Creation
-	VkPipelineShaderStageCreateInfo fragmentShaderCreateInfo = {};
-	fragmentShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragmentShaderCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragmentShaderCreateInfo.module = fragmentShaderModule;
-	// Entry point function on shader
-	fragmentShaderCreateInfo.pName = "main"; 
+	// Lighting writes every sample, nothing from the early pass is kept
+	attachments[1].format = colorFormat;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-	// Pipeline requires array of shader stage info
-	VkPipelineShaderStageCreateInfo shaderStages[] = {
-		vertexShaderCreateInfo,
-		fragmentShaderCreateInfo,
-	};
+	// Single sample attachments cannot be resolved, subpass 3 then reads them directly
+	bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
 
-	// Description for single Vertex as whole
-	VkVertexInputBindingDescription bindingDescription = {};
-	bindingDescription.binding = 0;
-	bindingDescription.stride = sizeof(Vertex);
-	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;		// How to move between data after each vertex
-
-	// How data for an attribute is defined within a vertex
-	std::array<VkVertexInputAttributeDescription, 4> attributeDescription;
-
-	// Position attribute
-	attributeDescription[0].binding = 0;
-	attributeDescription[0].location = 0;
-	attributeDescription[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescription[0].offset = offsetof(Vertex, pos);			// Offset of Data within Struct Vertex
-
-	// Color Attribute	
-	attributeDescription[1].binding = 0;
-	attributeDescription[1].location = 1;
-	attributeDescription[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-	attributeDescription[1].offset = offsetof(Vertex, col);
-
-	// Texture Attribute
-	attributeDescription[2].binding = 0;
-	attributeDescription[2].location = 2;
-	attributeDescription[2].format = VK_FORMAT_R32G32_SFLOAT;
-	attributeDescription[2].offset = offsetof(Vertex, tex);
-
-	// Normal Attribute
-	attributeDescription[3].binding = 0;
-	attributeDescription[3].location = 3;
-	attributeDescription[3].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-	attributeDescription[3].offset = offsetof(Vertex, normal);
+	// Depth of the early pass, completed by the late draws then only read
+	attachments[2].format = depthFormat;
+	attachments[2].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[2].initialLayout = resolve ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	attachments[2].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
-	// Create Pipeline
-	// -- Vertex input --
-	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
-	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
-	vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
+	attachments[3].format = colorFormat;
+	attachments[3].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[3].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	attachments[4].format = depthFormat;
+	attachments[4].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[4].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	// G-buffer is cleared so pixels nothing covers read as empty, and never stored
+	for (uint32_t i = 0; i < GBUFFER_ATTACHMENT_COUNT; i++)
+	{
+		attachments[5 + i].format = gBufferFormats[i];
+		attachments[5 + i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		attachments[5 + i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
+	// Velocity of the early pass, written again with the G-buffer. Resolved color as in the forward pass
+	attachments[velocityAttachment].format = velocityFormat;
+	attachments[velocityAttachment].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[velocityAttachment].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[velocityAttachment].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	attachments[velocityAttachment].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	attachments[taaResolveAttachment].format = colorFormat;
+	attachments[taaResolveAttachment].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[taaResolveAttachment].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[taaResolveAttachment].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+	// References
+	auto makeReference = [](uint32_t attachment, VkImageLayout layout, VkImageAspectFlags aspectMask) {
+		VkAttachmentReference2 reference = {};
+		reference.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2;
+		reference.attachment = attachment;
+		reference.layout = layout;
+		reference.aspectMask = aspectMask;
+		return reference;
+	};
+
+	std::array<VkAttachmentReference2, GBUFFER_ATTACHMENT_COUNT + 1> gBufferOutputReferences;
+	std::array<VkAttachmentReference2, GBUFFER_ATTACHMENT_COUNT + 1> gBufferInputReferences;
+	for (uint32_t i = 0; i < GBUFFER_ATTACHMENT_COUNT; i++)
+	{
+		gBufferOutputReferences[i] = makeReference(5 + i, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0);
+		gBufferInputReferences[i] = makeReference(5 + i, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+	}
+	gBufferOutputReferences[GBUFFER_ATTACHMENT_COUNT] = makeReference(velocityAttachment, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0);
+	gBufferInputReferences[GBUFFER_ATTACHMENT_COUNT] = makeReference(2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+	VkAttachmentReference2 depthReference = makeReference(2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 0);
+	VkAttachmentReference2 readOnlyDepthReference = makeReference(2, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, 0);
+	VkAttachmentReference2 colorReference = makeReference(1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0);
+	VkAttachmentReference2 resolvedColorReference = makeReference(3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0);
+	VkAttachmentReference2 resolvedDepthReference = makeReference(4, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 0);
+	std::array<VkAttachmentReference2, 2> postColorReferences = {
+		makeReference(0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0),
+		makeReference(taaResolveAttachment, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0)
+	};
+	std::array<VkAttachmentReference2, 3> resolvedInputReferences = {
+		makeReference(resolve ? 3 : 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT),
+		makeReference(resolve ? 4 : 2, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_DEPTH_BIT),
+		makeReference(velocityAttachment, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT)
+	};
+
+	VkSubpassDescriptionDepthStencilResolve depthResolveInfo = {};
+	depthResolveInfo.sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_DEPTH_STENCIL_RESOLVE;
+	depthResolveInfo.pDepthStencilResolveAttachment = &resolvedDepthReference;
+	depthResolveInfo.depthResolveMode = VK_RESOLVE_MODE_SAMPLE_ZERO_BIT;
+	depthResolveInfo.stencilResolveMode = VK_RESOLVE_MODE_SAMPLE_ZERO_BIT;
+
+	std::array<VkSubpassDescription2, 4> subpasses = {};
+	for (auto& subpass : subpasses)
+	{
+		subpass.sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2;
+		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	}
+
+	// Subpass 0: opaque draws write the G-buffer, and the velocity with temporal anti-aliasing
+	subpasses[0].colorAttachmentCount = GBUFFER_ATTACHMENT_COUNT + (temporalAATargets ? 1 : 0);
+	subpasses[0].pColorAttachments = gBufferOutputReferences.data();
+	subpasses[0].pDepthStencilAttachment = &depthReference;
+
+	// Subpass 1: full screen lighting, G-buffer and depth read at the same pixel
+	subpasses[1].inputAttachmentCount = static_cast<uint32_t>(gBufferInputReferences.size());
+	subpasses[1].pInputAttachments = gBufferInputReferences.data();
+	subpasses[1].colorAttachmentCount = 1;
+	subpasses[1].pColorAttachments = &colorReference;
+
+	// Subpass 2: transparent draws forward shaded over the lit color, then both resolved
+	subpasses[2].pNext = resolve ? &depthResolveInfo : nullptr;
+	subpasses[2].colorAttachmentCount = 1;
+	subpasses[2].pColorAttachments = &colorReference;
+	subpasses[2].pResolveAttachments = resolve ? &resolvedColorReference : nullptr;
+	subpasses[2].pDepthStencilAttachment = &readOnlyDepthReference;
+
+	// Subpass 3: second pass shader to the swapchain image, as in the forward pass
+	subpasses[3].inputAttachmentCount = temporalAATargets ? 3 : 2;
+	subpasses[3].pInputAttachments = resolvedInputReferences.data();
+	subpasses[3].colorAttachmentCount = temporalAATargets ? 2 : 1;
+	subpasses[3].pColorAttachments = postColorReferences.data();
+
+	// Dependencies between subpasses are by region, each pixel only reads what was written at that pixel
+	std::array<VkSubpassDependency2, 5> subpassDependencies = {};
+	for (auto& dependency : subpassDependencies)
+	{
+		dependency.sType = VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2;
+		dependency.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+	}
+
+	// Depth of the early pass and previous uses of the attachments, the G-buffer is shared with the frames submitted before
+	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT
+		| VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[0].dstSubpass = 0;
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+		| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[0].dependencyFlags = 0;
+
+	// G-buffer and depth writes to the lighting reads
+	subpassDependencies[1].srcSubpass = 0;
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[1].dstSubpass = 1;
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+
+	// Lit color to the blended draws
+	subpassDependencies[2].srcSubpass = 1;
+	subpassDependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[2].dstSubpass = 2;
+	subpassDependencies[2].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[2].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	// Resolved color and depth to the second pass shader
+	subpassDependencies[3].srcSubpass = 2;
+	subpassDependencies[3].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[3].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[3].dstSubpass = 3;
+	subpassDependencies[3].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	subpassDependencies[3].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT;
+	if (temporalAATargets || dynamicResolutionTargets)
+	{
+		// Temporal anti-aliasing also samples the color around each pixel, dynamic resolution away from it
+		subpassDependencies[3].dstAccessMask |= VK_ACCESS_SHADER_READ_BIT;
+		subpassDependencies[3].dependencyFlags = 0;
+	}
+
+	// Swapchain image to presentation
+	subpassDependencies[4].srcSubpass = 3;
+	subpassDependencies[4].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	subpassDependencies[4].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[4].dstSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[4].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	subpassDependencies[4].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	subpassDependencies[4].dependencyFlags = 0;
+	if (temporalAATargets)
+	{
+		// Resolved color to the history copy
+		subpassDependencies[4].dstStageMask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+		subpassDependencies[4].dstAccessMask |= VK_ACCESS_TRANSFER_READ_BIT;
+	}
+
+	VkRenderPassCreateInfo2 renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO_2;
+	renderPassCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size()) - (temporalAATargets ? 0 : 2);
+	renderPassCreateInfo.pAttachments = attachments.data();
+	renderPassCreateInfo.subpassCount = static_cast<uint32_t>(subpasses.size());
+	renderPassCreateInfo.pSubpasses = subpasses.data();
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
+	renderPassCreateInfo.pDependencies = subpassDependencies.data();
+
+	VkResult result = vkCreateRenderPass2(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &deferredRenderPass);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create deferred renderPass");
+	}
+}
+
+void VulkanRenderer::createShadowRenderPass()
+{
+	// Depth only, filtered compare lookups in the lighting shaders
+	shadowMapFormat = chooseSupportedFormat(
+		{ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+	);
+
+	// One cascade layer, loaded: a cascade not rendered this frame keeps its cached map
+	// Sits in SHADER_READ_ONLY_OPTIMAL between passes, cleared by a draw when the cascade is rendered
+	VkAttachmentDescription2 shadowAttachment = {};
+	shadowAttachment.sType = VK_STRUCTURE_TYPE_ATTACHMENT_DESCRIPTION_2;
+	shadowAttachment.format = shadowMapFormat;
+	shadowAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	shadowAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	shadowAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	shadowAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	shadowAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	shadowAttachment.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	shadowAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkAttachmentReference2 shadowAttachmentReference = {};
+	shadowAttachmentReference.sType = VK_STRUCTURE_TYPE_ATTACHMENT_REFERENCE_2;
+	shadowAttachmentReference.attachment = 0;
+	shadowAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription2 subpass = {};
+	subpass.sType = VK_STRUCTURE_TYPE_SUBPASS_DESCRIPTION_2;
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 0;
+	subpass.pDepthStencilAttachment = &shadowAttachmentReference;
+
+	std::array<VkSubpassDependency2, 2> subpassDependencies = {};
+
+	// The map is shared by every image: lookups and writes of frames submitted before must be done
+	subpassDependencies[0].sType = VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2;
+	subpassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[0].dstSubpass = 0;
+	subpassDependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// Depth to the lookups of the scene passes
+	subpassDependencies[1].sType = VK_STRUCTURE_TYPE_SUBPASS_DEPENDENCY_2;
+	subpassDependencies[1].srcSubpass = 0;
+	subpassDependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	subpassDependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	subpassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	subpassDependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkRenderPassCreateInfo2 renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO_2;
+	renderPassCreateInfo.attachmentCount = 1;
+	renderPassCreateInfo.pAttachments = &shadowAttachment;
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &subpass;
+	renderPassCreateInfo.dependencyCount = static_cast<uint32_t>(subpassDependencies.size());
+	renderPassCreateInfo.pDependencies = subpassDependencies.data();
+
+	VkResult result = vkCreateRenderPass2(mainDevice.logicalDevice, &renderPassCreateInfo, nullptr, &shadowRenderPass);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow renderPass");
+	}
+}
+
+void VulkanRenderer::createDescriptorSetLayout()
+{
+	// UNIFORM VALUES 
+	// UboViewProjection Binding info
+	VkDescriptorSetLayoutBinding vpLayoutBinding = {};
+	vpLayoutBinding.binding = 0;
+	vpLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	vpLayoutBinding.descriptorCount = 1;
+	vpLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;				// Shader stage to bind to
+	vpLayoutBinding.pImmutableSamplers = nullptr;							// For textures
+
+	// Object data Binding info, indexed with the draw firstInstance
+	VkDescriptorSetLayoutBinding objectLayoutBinding = {};
+	objectLayoutBinding.binding = 1;
+	objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	objectLayoutBinding.descriptorCount = 1;
+	objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	objectLayoutBinding.pImmutableSamplers = nullptr;
+
+	// Draw data Binding info, indexed with the draw firstInstance
+	VkDescriptorSetLayoutBinding drawLayoutBinding = {};
+	drawLayoutBinding.binding = 2;
+	drawLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	drawLayoutBinding.descriptorCount = 1;
+	drawLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	drawLayoutBinding.pImmutableSamplers = nullptr;
+
+	// Light params, lights and light grid, read by the fragment shader to shade with the lights of its froxel
+	VkDescriptorSetLayoutBinding lightParamsLayoutBinding = {};
+	lightParamsLayoutBinding.binding = 3;
+	lightParamsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	lightParamsLayoutBinding.descriptorCount = 1;
+	lightParamsLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	lightParamsLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding lightLayoutBinding = {};
+	lightLayoutBinding.binding = 4;
+	lightLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	lightLayoutBinding.descriptorCount = 1;
+	lightLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	lightLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding lightGridLayoutBinding = {};
+	lightGridLayoutBinding.binding = 5;
+	lightGridLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	lightGridLayoutBinding.descriptorCount = 1;
+	lightGridLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	lightGridLayoutBinding.pImmutableSamplers = nullptr;
+
+	// Sun and cascade matrices, read by shadow.vert and the lighting shaders, and the cascaded shadow map
+	VkDescriptorSetLayoutBinding shadowParamsLayoutBinding = {};
+	shadowParamsLayoutBinding.binding = 6;
+	shadowParamsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	shadowParamsLayoutBinding.descriptorCount = 1;
+	shadowParamsLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	shadowParamsLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding shadowMapLayoutBinding = {};
+	shadowMapLayoutBinding.binding = 7;
+	shadowMapLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	shadowMapLayoutBinding.descriptorCount = 1;
+	shadowMapLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shadowMapLayoutBinding.pImmutableSamplers = nullptr;
+
+	/*
+	// Model Binding info
+	VkDescriptorSetLayoutBinding modelLayoutBinding = {};
+	modelLayoutBinding.binding = 1;
+	modelLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	modelLayoutBinding.descriptorCount = 1;
+	modelLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	modelLayoutBinding.pImmutableSamplers = nullptr;
+	*/
+
+	std::vector<VkDescriptorSetLayoutBinding> layoutBindings = { vpLayoutBinding, objectLayoutBinding, drawLayoutBinding,
+		lightParamsLayoutBinding, lightLayoutBinding, lightGridLayoutBinding, shadowParamsLayoutBinding, shadowMapLayoutBinding };
+
+	// Create descriptor set layout for given bindings
+	VkDescriptorSetLayoutCreateInfo layoutCreateInfo = {};
+	layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutCreateInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
+	layoutCreateInfo.pBindings = layoutBindings.data();
+
+	// Create descriptor set layout
+	VkResult result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice,
+		&layoutCreateInfo, nullptr, &descriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Unable to create Descriptor set layout");
+	}
+
+	// TEXTURE SAMPLER 
+	// Texture binding infos, one array holds every texture
+	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
+	samplerLayoutBinding.binding = 0;
+	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	samplerLayoutBinding.descriptorCount = MAX_TEXTURES;
+	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	samplerLayoutBinding.pImmutableSamplers = nullptr;
+
+	// Elements not used by a pending frame can be rewritten, textures come and go without waiting for the queue
+	VkDescriptorBindingFlags samplerBindingFlags = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+		| VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+	VkDescriptorSetLayoutBindingFlagsCreateInfo samplerBindingFlagsInfo = {};
+	samplerBindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	samplerBindingFlagsInfo.bindingCount = 1;
+	samplerBindingFlagsInfo.pBindingFlags = &samplerBindingFlags;
+
+	// Create a descriptor Set layout with binding for texture
+	VkDescriptorSetLayoutCreateInfo textureLayoutCreateInfo = {};
+	textureLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	textureLayoutCreateInfo.pNext = &samplerBindingFlagsInfo;
+	textureLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	textureLayoutCreateInfo.bindingCount = 1;
+	textureLayoutCreateInfo.pBindings = &samplerLayoutBinding;
+
+	// Create descriptor set layout
+	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &textureLayoutCreateInfo, nullptr, &samplerSetLayout);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Unable to create Descriptor set layout");
+	}
+
+	// Create input atachment image descriptor set layout
+	// Color input binding
+	VkDescriptorSetLayoutBinding colorInputLayoutBinding = {};
+	colorInputLayoutBinding.binding = 0;
+	colorInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	colorInputLayoutBinding.descriptorCount = 1;
+	colorInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// Depth input Binding
+	VkDescriptorSetLayoutBinding depthInputLayoutBinding = {};
+	depthInputLayoutBinding.binding = 1;
+	depthInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	depthInputLayoutBinding.descriptorCount = 1;
+	depthInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// Temporal anti-aliasing and dynamic resolution bindings, only written and read while they are on
+	// Velocity input Binding
+	VkDescriptorSetLayoutBinding velocityInputLayoutBinding = {};
+	velocityInputLayoutBinding.binding = 2;
+	velocityInputLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	velocityInputLayoutBinding.descriptorCount = 1;
+	velocityInputLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// Color and history sampler Bindings
+	VkDescriptorSetLayoutBinding currentColorLayoutBinding = {};
+	currentColorLayoutBinding.binding = 3;
+	currentColorLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	currentColorLayoutBinding.descriptorCount = 1;
+	currentColorLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutBinding historyLayoutBinding = currentColorLayoutBinding;
+	historyLayoutBinding.binding = 4;
+
+	// PostParams Binding
+	VkDescriptorSetLayoutBinding postParamsLayoutBinding = {};
+	postParamsLayoutBinding.binding = 5;
+	postParamsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	postParamsLayoutBinding.descriptorCount = 1;
+	postParamsLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// Depth sampler Binding, upscaled with the color
+	VkDescriptorSetLayoutBinding sceneDepthLayoutBinding = currentColorLayoutBinding;
+	sceneDepthLayoutBinding.binding = 6;
+
+	// Array of input attachment bindings
+	std::vector<VkDescriptorSetLayoutBinding> inputBindings = { colorInputLayoutBinding, depthInputLayoutBinding, 
+		velocityInputLayoutBinding, currentColorLayoutBinding, historyLayoutBinding, postParamsLayoutBinding, sceneDepthLayoutBinding };
+	
+	// Create a descriptor set layout for input attachments
+	VkDescriptorSetLayoutCreateInfo inputLayoutCreateInfo = {};
+	inputLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	inputLayoutCreateInfo.bindingCount = static_cast<uint32_t>(inputBindings.size());
+	inputLayoutCreateInfo.pBindings = inputBindings.data();
+
+	// Create Input descriptor set layout
+	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &inputLayoutCreateInfo, nullptr, &inputSetLayout);
+
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Unable to create input Descriptor set layout");
+	}
+
+	// G-buffer input attachments then depth, for the deferred lighting subpass
+	std::array<VkDescriptorSetLayoutBinding, GBUFFER_ATTACHMENT_COUNT + 1> gBufferInputBindings = {};
+	for (uint32_t i = 0; i < gBufferInputBindings.size(); i++)
+	{
+		gBufferInputBindings[i].binding = i;
+		gBufferInputBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+		gBufferInputBindings[i].descriptorCount = 1;
+		gBufferInputBindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo gBufferInputLayoutCreateInfo = {};
+	gBufferInputLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	gBufferInputLayoutCreateInfo.bindingCount = static_cast<uint32_t>(gBufferInputBindings.size());
+	gBufferInputLayoutCreateInfo.pBindings = gBufferInputBindings.data();
+
+	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &gBufferInputLayoutCreateInfo, nullptr, &gBufferInputSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Unable to create G-buffer input Descriptor set layout");
+	}
+
+	// CULL COMPUTE
+	// Params, object data, draw data, early and late output commands, draw visibility, depth pyramid, clusters, cluster visibility,
+	// cluster draws
+	std::array<VkDescriptorType, 10> cullTypes = {
+		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+		VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+	};
+	std::array<VkDescriptorSetLayoutBinding, 10> cullBindings = {};
+	for (uint32_t i = 0; i < cullBindings.size(); i++)
+	{
+		cullBindings[i].binding = i;
+		cullBindings[i].descriptorType = cullTypes[i];
+		cullBindings[i].descriptorCount = 1;
+		cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		cullBindings[i].pImmutableSamplers = nullptr;
+	}
+
+	VkDescriptorSetLayoutCreateInfo cullLayoutCreateInfo = {};
+	cullLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	cullLayoutCreateInfo.bindingCount = static_cast<uint32_t>(cullBindings.size());
+	cullLayoutCreateInfo.pBindings = cullBindings.data();
+
+	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &cullLayoutCreateInfo, nullptr, &cullSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Unable to create cull Descriptor set layout");
+	}
+
+	// LIGHT CULL COMPUTE
+	// Light params, lights, light grid
+	std::array<VkDescriptorType, 3> lightCullTypes = {
+		VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+	};
+	std::array<VkDescriptorSetLayoutBinding, 3> lightCullBindings = {};
+	for (uint32_t i = 0; i < lightCullBindings.size(); i++)
+	{
+		lightCullBindings[i].binding = i;
+		lightCullBindings[i].descriptorType = lightCullTypes[i];
+		lightCullBindings[i].descriptorCount = 1;
+		lightCullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		lightCullBindings[i].pImmutableSamplers = nullptr;
+	}
+
+	VkDescriptorSetLayoutCreateInfo lightCullLayoutCreateInfo = {};
+	lightCullLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	lightCullLayoutCreateInfo.bindingCount = static_cast<uint32_t>(lightCullBindings.size());
+	lightCullLayoutCreateInfo.pBindings = lightCullBindings.data();
+
+	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &lightCullLayoutCreateInfo, nullptr, &lightCullSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Unable to create light cull Descriptor set layout");
+	}
+
+	// HI-Z BUILD
+	// Source depth or previous level, destination level
+	std::array<VkDescriptorSetLayoutBinding, 2> hizBindings = {};
+	hizBindings[0].binding = 0;
+	hizBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	hizBindings[0].descriptorCount = 1;
+	hizBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	hizBindings[1].binding = 1;
+	hizBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	hizBindings[1].descriptorCount = 1;
+	hizBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo hizLayoutCreateInfo = {};
+	hizLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	hizLayoutCreateInfo.bindingCount = static_cast<uint32_t>(hizBindings.size());
+	hizLayoutCreateInfo.pBindings = hizBindings.data();
+
+	result = vkCreateDescriptorSetLayout(mainDevice.logicalDevice, &hizLayoutCreateInfo, nullptr, &hizSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Unable to create Hi-Z Descriptor set layout");
+	}
+
+}
+
+void VulkanRenderer::createGraphicsPipeline()
+{
+	// Read our Spir-V code 
+	// Vertex inputs depend on the geometry pool format, temporal anti-aliasing adds the motion vectors
+	bool packedVertices = geometryPool.getVertexFormat() == VERTEX_FORMAT_PACKED;
+	const char* vertexShaderFile = packedVertices ? "Shaders/shader_packed_vert.spv" : "Shaders/vert.spv";
+	if (temporalAATargets)
+	{
+		vertexShaderFile = packedVertices ? "Shaders/shader_packed_motion_vert.spv" : "Shaders/shader_motion_vert.spv";
+	}
+	auto vertexShaderCode = readFile(vertexShaderFile);
+	auto fragmentShaderCode = readFile(temporalAATargets ? "Shaders/shader_motion_frag.spv" : "Shaders/frag.spv");
+
+	// Build shader Module
+	VkShaderModule vertexShaderModule = createShaderModule(vertexShaderCode);
+	VkShaderModule fragmentShaderModule = createShaderModule(fragmentShaderCode);
+
+	// Shader Stage Creation 1 - Information
+	// Vert stage Creation
+	VkPipelineShaderStageCreateInfo vertexShaderCreateInfo = {};
+	vertexShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vertexShaderCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vertexShaderCreateInfo.module = vertexShaderModule;
+	// Entry point function on shader
+	vertexShaderCreateInfo.pName = "main"; 
+
+	// Frag stage Creation
+	VkPipelineShaderStageCreateInfo fragmentShaderCreateInfo = {};
+	fragmentShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	fragmentShaderCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	fragmentShaderCreateInfo.module = fragmentShaderModule;
+	// Entry point function on shader
+	fragmentShaderCreateInfo.pName = "main"; 
+
+	// Pipeline requires array of shader stage info
+	VkPipelineShaderStageCreateInfo shaderStages[] = {
+		vertexShaderCreateInfo,
+		fragmentShaderCreateInfo,
+	};
+
+	// Binding and attributes generated for the vertex format of the geometry pool
+	VkVertexInputBindingDescription bindingDescription = {};
+	std::vector<VkVertexInputAttributeDescription> attributeDescription;
+	GeometryPool::getVertexInputDescription(geometryPool.getVertexFormat(), &bindingDescription, &attributeDescription);
+
+	// Create Pipeline
+	// -- Vertex input --
+	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
+	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
+	vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
 	vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescription.size());
 	vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescription.data();
 
@@ -921,8 +1760,8 @@ void VulkanRenderer::createGraphicsPipeline()
 	viewPortStateCreateInfo.scissorCount = 1;
 	viewPortStateCreateInfo.pScissors = &scissor;
 	
-	/*
-	// -- Dynamic State -- For later use
+	// -- Dynamic State --
+	// Scene subpasses draw to the dynamic resolution part of the attachments, the second pass to all of them
 	std::vector<VkDynamicState> dynamicStateEnables;
 	dynamicStateEnables.push_back(VK_DYNAMIC_STATE_VIEWPORT);
 	dynamicStateEnables.push_back(VK_DYNAMIC_STATE_SCISSOR);
@@ -931,7 +1770,6 @@ void VulkanRenderer::createGraphicsPipeline()
 	dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
 	dynamicStateCreateInfo.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size());
 	dynamicStateCreateInfo.pDynamicStates = dynamicStateEnables.data();
-	*/
 
 	// -- Rasterizer -- 
 	VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = {};
@@ -961,7 +1799,7 @@ void VulkanRenderer::createGraphicsPipeline()
 		VK_COLOR_COMPONENT_G_BIT |
 		VK_COLOR_COMPONENT_B_BIT |
 		VK_COLOR_COMPONENT_A_BIT;
-	colorState.blendEnable = VK_TRUE;
+	colorState.blendEnable = VK_FALSE;		// Opaque pipelines, the transparent one turns it on
 
 	// Blending uses the following eq: (sourceColorBlendFactor * newColor) colorBlendOp (dstColorBlendFactor * old Color)
 	colorState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
@@ -972,11 +1810,18 @@ void VulkanRenderer::createGraphicsPipeline()
 	colorState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
 	colorState.alphaBlendOp = VK_BLEND_OP_ADD;
 
+	// Temporal anti-aliasing velocity after the color in the scene subpasses, never blended
+	const VkColorComponentFlags velocityWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT;
+	VkPipelineColorBlendAttachmentState velocityState = colorState;
+	velocityState.colorWriteMask = velocityWriteMask;
+	std::array<VkPipelineColorBlendAttachmentState, 2> sceneColorStates = { colorState, velocityState };
+	uint32_t sceneColorCount = temporalAATargets ? 2 : 1;
+
 	VkPipelineColorBlendStateCreateInfo colorBlendingCreateInfo = {};
 	colorBlendingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
 	colorBlendingCreateInfo.logicOpEnable = VK_FALSE;
-	colorBlendingCreateInfo.attachmentCount = 1;
-	colorBlendingCreateInfo.pAttachments = &colorState;
+	colorBlendingCreateInfo.attachmentCount = sceneColorCount;
+	colorBlendingCreateInfo.pAttachments = sceneColorStates.data();
 
 	// -- Pipeline Layout -- 
 
@@ -987,8 +1832,8 @@ void VulkanRenderer::createGraphicsPipeline()
 	pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
 	pipelineLayoutCreateInfo.pSetLayouts = descriptorSetLayouts.data();
-	pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
-	pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+	pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
+	pipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
 
 	// Create Pipeline Layout
 	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &pipelineLayoutCreateInfo, nullptr, &pipelineLayout);
@@ -1015,7 +1860,7 @@ void VulkanRenderer::createGraphicsPipeline()
 	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
 	pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
 	pipelineCreateInfo.pViewportState = &viewPortStateCreateInfo;
-	pipelineCreateInfo.pDynamicState = nullptr;
+	pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
 	pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
 	pipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
 	pipelineCreateInfo.pColorBlendState = &colorBlendingCreateInfo;
@@ -1034,17 +1879,97 @@ void VulkanRenderer::createGraphicsPipeline()
 	{
 		throw std::runtime_error("Failed to create graphics Pipeline");
 	}
-	// Destroy Modules
-	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
-	vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
 
-	// TODO WHEN MORE PIPELINE ARE NEEDED CREATE PROPER FUNCTIONS TO AVOID REPETITION
-	// AT THE MOMENT WE HAVE ONLY 2 SIMILAR PIPELINES, SO IT CAN STAY LIKE THIS 
+	// Same pipeline for the early pass, render pass is not compatible with the main one
+	pipelineCreateInfo.renderPass = earlyRenderPass;
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &earlyGraphicsPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create early graphics Pipeline");
+	}
+	pipelineCreateInfo.renderPass = renderPass;
 
-	// CREATE SECOND SUBPASS PIPELINE
-	// Second pass shaders
+	// Transparent pipeline: blends over the opaque result, depth tested against it but not written
+	// Velocity keeps the surface behind, the history of a blended pixel follows what is under it
+	sceneColorStates[0].blendEnable = VK_TRUE;
+	sceneColorStates[1].colorWriteMask = 0;
+	depthStencilCreateInfo.depthWriteEnable = VK_FALSE;
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &transparentPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create transparent graphics Pipeline");
+	}
+
+	// Same blending for the transparent subpass of the deferred pass, color only
+	colorBlendingCreateInfo.attachmentCount = 1;
+	pipelineCreateInfo.renderPass = deferredRenderPass;
+	pipelineCreateInfo.subpass = 2;
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &deferredTransparentPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create deferred transparent graphics Pipeline");
+	}
+	colorBlendingCreateInfo.attachmentCount = sceneColorCount;
+	sceneColorStates[0].blendEnable = VK_FALSE;
+	depthStencilCreateInfo.depthWriteEnable = VK_TRUE;
+
+	// Deferred early pass: depth only, no fragment shader and nothing written to color
+	sceneColorStates[0].colorWriteMask = 0;
+	pipelineCreateInfo.stageCount = 1;
+	pipelineCreateInfo.renderPass = earlyRenderPass;
+	pipelineCreateInfo.subpass = 0;
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &earlyDepthPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create early depth graphics Pipeline");
+	}
+	sceneColorStates[0].colorWriteMask = colorState.colorWriteMask;
+	sceneColorStates[1].colorWriteMask = velocityWriteMask;
+	pipelineCreateInfo.stageCount = 2;
+
+	// G-buffer pipeline: one blend state per G-buffer attachment, equal depth passes for the draws of the early pass
+	auto gBufferShaderCode = readFile(temporalAATargets ? "Shaders/gbuffer_motion_frag.spv" : "Shaders/gbuffer_frag.spv");
+	VkShaderModule gBufferShaderModule = createShaderModule(gBufferShaderCode);
+	shaderStages[1].module = gBufferShaderModule;
+
+	std::array<VkPipelineColorBlendAttachmentState, GBUFFER_ATTACHMENT_COUNT + 1> gBufferColorStates;
+	gBufferColorStates.fill(colorState);
+	gBufferColorStates[GBUFFER_ATTACHMENT_COUNT] = velocityState;
+	colorBlendingCreateInfo.attachmentCount = GBUFFER_ATTACHMENT_COUNT + (temporalAATargets ? 1 : 0);
+	colorBlendingCreateInfo.pAttachments = gBufferColorStates.data();
+	depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	pipelineCreateInfo.renderPass = deferredRenderPass;
+	pipelineCreateInfo.subpass = 0;
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &gBufferPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create G-buffer graphics Pipeline");
+	}
+	depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+	pipelineCreateInfo.renderPass = renderPass;
+
+	// Destroy Modules
+	vkDestroyShaderModule(mainDevice.logicalDevice, gBufferShaderModule, nullptr);
+	vkDestroyShaderModule(mainDevice.logicalDevice, fragmentShaderModule, nullptr);
+	vkDestroyShaderModule(mainDevice.logicalDevice, vertexShaderModule, nullptr);
+
+	// TODO WHEN MORE PIPELINE ARE NEEDED CREATE PROPER FUNCTIONS TO AVOID REPETITION
+	// AT THE MOMENT WE HAVE ONLY 2 SIMILAR PIPELINES, SO IT CAN STAY LIKE THIS 
+
+	// CREATE SECOND SUBPASS PIPELINE
+	// Second pass shaders
 	auto secondVertexShaderCode = readFile("Shaders/second_vert.spv");
-	auto secondFragmentShaderCode = readFile("Shaders/second_frag.spv");
+	// Temporal resolve or upscale of the scene before the depth effect, never both
+	const char* secondFragmentShaderFile = "Shaders/second_frag.spv";
+	if (temporalAATargets)
+	{
+		secondFragmentShaderFile = "Shaders/second_taa_frag.spv";
+	}
+	else if (dynamicResolutionTargets)
+	{
+		secondFragmentShaderFile = "Shaders/second_dynres_frag.spv";
+	}
+	auto secondFragmentShaderCode = readFile(secondFragmentShaderFile);
 	
 	// Build shaders
 	VkShaderModule secondVertexShaderModule = createShaderModule(secondVertexShaderCode);
@@ -1068,6 +1993,11 @@ void VulkanRenderer::createGraphicsPipeline()
 	// No need to do multisampling
 	multisamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 
+	// Swapchain image, then the resolved color with temporal anti-aliasing
+	std::array<VkPipelineColorBlendAttachmentState, 2> postColorStates = { colorState, colorState };
+	colorBlendingCreateInfo.attachmentCount = temporalAATargets ? 2 : 1;
+	colorBlendingCreateInfo.pAttachments = postColorStates.data();
+
 	// Create new Pipeline layout
 	VkPipelineLayoutCreateInfo secondPipelineLayoutCreateInfo = {};
 	secondPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -1093,18 +2023,332 @@ void VulkanRenderer::createGraphicsPipeline()
 		throw std::runtime_error("Failed to create second Pipeline");
 	}
 
+	// Same second pass shader as the last subpass of the deferred pass
+	pipelineCreateInfo.renderPass = deferredRenderPass;
+	pipelineCreateInfo.subpass = 3;
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &deferredSecondPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create deferred second Pipeline");
+	}
+
+	// DEFERRED LIGHTING PIPELINE
+	// Full screen triangle, shaded once per sample so MSAA edges keep their coverage
+	auto lightingShaderCode = readFile(msaaSamples == VK_SAMPLE_COUNT_1_BIT ? "Shaders/deferred_frag.spv" : "Shaders/deferred_ms_frag.spv");
+	VkShaderModule lightingShaderModule = createShaderModule(lightingShaderCode);
+	fragmentShaderCreateInfo.module = lightingShaderModule;
+
+	VkPipelineShaderStageCreateInfo lightingShaderStages[] = { vertexShaderCreateInfo, fragmentShaderCreateInfo };
+
+	// Lights from the scene set, G-buffer from the input attachments
+	std::array<VkDescriptorSetLayout, 2> lightingSetLayouts = { descriptorSetLayout, gBufferInputSetLayout };
+	VkPipelineLayoutCreateInfo lightingPipelineLayoutCreateInfo = {};
+	lightingPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	lightingPipelineLayoutCreateInfo.setLayoutCount = static_cast<uint32_t>(lightingSetLayouts.size());
+	lightingPipelineLayoutCreateInfo.pSetLayouts = lightingSetLayouts.data();
+	lightingPipelineLayoutCreateInfo.pushConstantRangeCount = 0;
+	lightingPipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+
+	result = vkCreatePipelineLayout(mainDevice.logicalDevice, &lightingPipelineLayoutCreateInfo, nullptr, &lightingPipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create lighting Pipeline Layout");
+	}
+
+	multisamplingCreateInfo.rasterizationSamples = msaaSamples;
+	multisamplingCreateInfo.sampleShadingEnable = msaaSamples == VK_SAMPLE_COUNT_1_BIT ? VK_FALSE : VK_TRUE;
+	multisamplingCreateInfo.minSampleShading = 1.0f;
+	depthStencilCreateInfo.depthTestEnable = VK_FALSE;
+	colorBlendingCreateInfo.attachmentCount = 1;
+
+	pipelineCreateInfo.pStages = lightingShaderStages;
+	pipelineCreateInfo.layout = lightingPipelineLayout;
+	pipelineCreateInfo.subpass = 1;
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &lightingPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create lighting Pipeline");
+	}
+
+	vkDestroyShaderModule(mainDevice.logicalDevice, lightingShaderModule, nullptr);
+
 	// Destroy second shader Modules
 	vkDestroyShaderModule(mainDevice.logicalDevice, secondFragmentShaderModule, nullptr);
 	vkDestroyShaderModule(mainDevice.logicalDevice, secondVertexShaderModule, nullptr);
 
 }
 
-void VulkanRenderer::createColorBufferImage()
+void VulkanRenderer::createCullPipeline()
+{
+	auto cullShaderCode = readFile("Shaders/cull_comp.spv");
+	VkShaderModule cullShaderModule = createShaderModule(cullShaderCode);
+
+	VkPipelineShaderStageCreateInfo cullShaderCreateInfo = {};
+	cullShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	cullShaderCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	cullShaderCreateInfo.module = cullShaderModule;
+	cullShaderCreateInfo.pName = "main";
+
+	// Cull phase
+	VkPushConstantRange phaseRange = {};
+	phaseRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	phaseRange.offset = 0;
+	phaseRange.size = sizeof(uint32_t);
+
+	VkPipelineLayoutCreateInfo cullPipelineLayoutCreateInfo = {};
+	cullPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	cullPipelineLayoutCreateInfo.setLayoutCount = 1;
+	cullPipelineLayoutCreateInfo.pSetLayouts = &cullSetLayout;
+	cullPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	cullPipelineLayoutCreateInfo.pPushConstantRanges = &phaseRange;
+
+	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &cullPipelineLayoutCreateInfo, nullptr, &cullPipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull Pipeline Layout");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage = cullShaderCreateInfo;
+	pipelineCreateInfo.layout = cullPipelineLayout;
+
+	result = vkCreateComputePipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &cullPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create cull Pipeline");
+	}
+
+	vkDestroyShaderModule(mainDevice.logicalDevice, cullShaderModule, nullptr);
+}
+
+void VulkanRenderer::createLightCullPipeline()
+{
+	auto lightCullShaderCode = readFile("Shaders/lightcull_comp.spv");
+	VkShaderModule lightCullShaderModule = createShaderModule(lightCullShaderCode);
+
+	VkPipelineShaderStageCreateInfo lightCullShaderCreateInfo = {};
+	lightCullShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	lightCullShaderCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	lightCullShaderCreateInfo.module = lightCullShaderModule;
+	lightCullShaderCreateInfo.pName = "main";
+
+	VkPipelineLayoutCreateInfo lightCullPipelineLayoutCreateInfo = {};
+	lightCullPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	lightCullPipelineLayoutCreateInfo.setLayoutCount = 1;
+	lightCullPipelineLayoutCreateInfo.pSetLayouts = &lightCullSetLayout;
+	lightCullPipelineLayoutCreateInfo.pushConstantRangeCount = 0;
+	lightCullPipelineLayoutCreateInfo.pPushConstantRanges = nullptr;
+
+	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &lightCullPipelineLayoutCreateInfo, nullptr, &lightCullPipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create light cull Pipeline Layout");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage = lightCullShaderCreateInfo;
+	pipelineCreateInfo.layout = lightCullPipelineLayout;
+
+	result = vkCreateComputePipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &lightCullPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create light cull Pipeline");
+	}
+
+	vkDestroyShaderModule(mainDevice.logicalDevice, lightCullShaderModule, nullptr);
+}
+
+void VulkanRenderer::createShadowPipeline()
+{
+	// Depth only: shadow.vert and no fragment stage, plus a full screen triangle at far depth to clear a cascade
+	auto shadowShaderCode = readFile(geometryPool.getVertexFormat() == VERTEX_FORMAT_PACKED
+		? "Shaders/shadow_packed_vert.spv" : "Shaders/shadow_vert.spv");
+	auto shadowClearShaderCode = readFile("Shaders/shadowclear_vert.spv");
+	VkShaderModule shadowShaderModule = createShaderModule(shadowShaderCode);
+	VkShaderModule shadowClearShaderModule = createShaderModule(shadowClearShaderCode);
+
+	VkPipelineShaderStageCreateInfo shaderStageCreateInfo = {};
+	shaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	shaderStageCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStageCreateInfo.module = shadowShaderModule;
+	shaderStageCreateInfo.pName = "main";
+
+	VkVertexInputBindingDescription bindingDescription = {};
+	std::vector<VkVertexInputAttributeDescription> attributeDescription;
+	GeometryPool::getVertexInputDescription(geometryPool.getVertexFormat(), &bindingDescription, &attributeDescription);
+
+	VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {};
+	vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputCreateInfo.vertexBindingDescriptionCount = 1;
+	vertexInputCreateInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputCreateInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescription.size());
+	vertexInputCreateInfo.pVertexAttributeDescriptions = attributeDescription.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(SHADOW_MAP_SIZE);
+	viewport.height = static_cast<float>(SHADOW_MAP_SIZE);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE };
+
+	VkPipelineViewportStateCreateInfo viewPortStateCreateInfo = {};
+	viewPortStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewPortStateCreateInfo.viewportCount = 1;
+	viewPortStateCreateInfo.pViewports = &viewport;
+	viewPortStateCreateInfo.scissorCount = 1;
+	viewPortStateCreateInfo.pScissors = &scissor;
+
+	// Casters between the light and the cascade box are clamped onto its near plane instead of clipped
+	// No culling: thin and open meshes still cast, slope scaled bias against acne
+	VkPipelineRasterizationStateCreateInfo rasterizerCreateInfo = {};
+	rasterizerCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizerCreateInfo.depthClampEnable = VK_TRUE;
+	rasterizerCreateInfo.rasterizerDiscardEnable = VK_FALSE;
+	rasterizerCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizerCreateInfo.lineWidth = 1.0f;
+	rasterizerCreateInfo.cullMode = VK_CULL_MODE_NONE;
+	rasterizerCreateInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterizerCreateInfo.depthBiasEnable = VK_TRUE;
+	rasterizerCreateInfo.depthBiasConstantFactor = 1.25f;
+	rasterizerCreateInfo.depthBiasSlopeFactor = 1.75f;
+
+	VkPipelineMultisampleStateCreateInfo multisamplingCreateInfo = {};
+	multisamplingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisamplingCreateInfo.sampleShadingEnable = VK_FALSE;
+	multisamplingCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineColorBlendStateCreateInfo colorBlendingCreateInfo = {};
+	colorBlendingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlendingCreateInfo.attachmentCount = 0;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencilCreateInfo = {};
+	depthStencilCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencilCreateInfo.depthTestEnable = VK_TRUE;
+	depthStencilCreateInfo.depthWriteEnable = VK_TRUE;
+	depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+	depthStencilCreateInfo.depthBoundsTestEnable = VK_FALSE;
+	depthStencilCreateInfo.stencilTestEnable = VK_FALSE;
+
+	// Scene set for the shadow params and draw data, cascade index as a push constant
+	VkPushConstantRange cascadeRange = {};
+	cascadeRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	cascadeRange.offset = 0;
+	cascadeRange.size = sizeof(uint32_t);
+
+	VkPipelineLayoutCreateInfo shadowPipelineLayoutCreateInfo = {};
+	shadowPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	shadowPipelineLayoutCreateInfo.setLayoutCount = 1;
+	shadowPipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
+	shadowPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	shadowPipelineLayoutCreateInfo.pPushConstantRanges = &cascadeRange;
+
+	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &shadowPipelineLayoutCreateInfo, nullptr, &shadowPipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow Pipeline Layout");
+	}
+
+	VkGraphicsPipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stageCount = 1;
+	pipelineCreateInfo.pStages = &shaderStageCreateInfo;
+	pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
+	pipelineCreateInfo.pInputAssemblyState = &inputAssembly;
+	pipelineCreateInfo.pViewportState = &viewPortStateCreateInfo;
+	pipelineCreateInfo.pDynamicState = nullptr;
+	pipelineCreateInfo.pRasterizationState = &rasterizerCreateInfo;
+	pipelineCreateInfo.pMultisampleState = &multisamplingCreateInfo;
+	pipelineCreateInfo.pColorBlendState = &colorBlendingCreateInfo;
+	pipelineCreateInfo.pDepthStencilState = &depthStencilCreateInfo;
+	pipelineCreateInfo.layout = shadowPipelineLayout;
+	pipelineCreateInfo.renderPass = shadowRenderPass;
+	pipelineCreateInfo.subpass = 0;
+	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
+	pipelineCreateInfo.basePipelineIndex = -1;
+
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &shadowPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow graphics Pipeline");
+	}
+
+	// Clear: no vertex data, written whatever is there
+	shaderStageCreateInfo.module = shadowClearShaderModule;
+	vertexInputCreateInfo.vertexBindingDescriptionCount = 0;
+	vertexInputCreateInfo.pVertexBindingDescriptions = nullptr;
+	vertexInputCreateInfo.vertexAttributeDescriptionCount = 0;
+	vertexInputCreateInfo.pVertexAttributeDescriptions = nullptr;
+	rasterizerCreateInfo.depthBiasEnable = VK_FALSE;
+	depthStencilCreateInfo.depthCompareOp = VK_COMPARE_OP_ALWAYS;
+
+	result = vkCreateGraphicsPipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &shadowClearPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow clear graphics Pipeline");
+	}
+
+	vkDestroyShaderModule(mainDevice.logicalDevice, shadowClearShaderModule, nullptr);
+	vkDestroyShaderModule(mainDevice.logicalDevice, shadowShaderModule, nullptr);
+}
+
+void VulkanRenderer::createHizPipeline()
 {
-	colorBufferImage.resize(swapChainImages.size());
-	colorBufferImageMemory.resize(swapChainImages.size());
-	colorBufferImageView.resize(swapChainImages.size());
+	auto hizShaderCode = readFile("Shaders/hiz_comp.spv");
+	VkShaderModule hizShaderModule = createShaderModule(hizShaderCode);
+
+	VkPipelineShaderStageCreateInfo hizShaderCreateInfo = {};
+	hizShaderCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	hizShaderCreateInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	hizShaderCreateInfo.module = hizShaderModule;
+	hizShaderCreateInfo.pName = "main";
+
+	// Source size in use
+	VkPushConstantRange sourceRange = {};
+	sourceRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	sourceRange.offset = 0;
+	sourceRange.size = sizeof(int32_t) * 2;
+
+	VkPipelineLayoutCreateInfo hizPipelineLayoutCreateInfo = {};
+	hizPipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	hizPipelineLayoutCreateInfo.setLayoutCount = 1;
+	hizPipelineLayoutCreateInfo.pSetLayouts = &hizSetLayout;
+	hizPipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+	hizPipelineLayoutCreateInfo.pPushConstantRanges = &sourceRange;
+
+	VkResult result = vkCreatePipelineLayout(mainDevice.logicalDevice, &hizPipelineLayoutCreateInfo, nullptr, &hizPipelineLayout);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create Hi-Z Pipeline Layout");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = {};
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.stage = hizShaderCreateInfo;
+	pipelineCreateInfo.layout = hizPipelineLayout;
+
+	result = vkCreateComputePipelines(mainDevice.logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &hizPipeline);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create Hi-Z Pipeline");
+	}
+
+	vkDestroyShaderModule(mainDevice.logicalDevice, hizShaderModule, nullptr);
+}
 
+void VulkanRenderer::createColorBufferImage()
+{
 	// Get supported format color attachment
 	VkFormat colorFormat = chooseSupportedFormat(
 		{ VK_FORMAT_R8G8B8A8_UNORM }, 
@@ -1112,17 +2356,20 @@ void VulkanRenderer::createColorBufferImage()
 		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT
 	);
 
-	for (size_t i = 0; i < swapChainImages.size(); i++)
+	// The temporal resolve samples the neighbourhood of each pixel to clamp the history, dynamic resolution upscales it
+	VkImageUsageFlags colorUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+	if (temporalAATargets || dynamicResolutionTargets)
 	{
-		// Create Color Buffer Image
-		colorBufferImage[i] = createImage(swapChainExtent.width, swapChainExtent.height,
-			colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &colorBufferImageMemory[i], 1, msaaSamples);
+		colorUsage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+	}
 
-		// Create Color Buffer ImageView
-		colorBufferImageView[i] = createImageView(colorBufferImage[i], colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+	// Create Color Buffer Image, stored by the early pass for the main pass to load so not transient
+	colorBufferImage = createImage(swapChainExtent.width, swapChainExtent.height,
+		colorFormat, VK_IMAGE_TILING_OPTIMAL, colorUsage,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &colorBufferImageMemory, 1, msaaSamples);
 
-	}
+	// Create Color Buffer ImageView
+	colorBufferImageView = createImageView(colorBufferImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
 }
 
 void VulkanRenderer::createResolvedColorBufferImage()
@@ -1140,9 +2387,10 @@ void VulkanRenderer::createResolvedColorBufferImage()
 
 	for (size_t i = 0; i < swapChainImages.size(); i++)
 	{
-		// Create Color Buffer Image
+		// Create Color Buffer Image, sampled when dynamic resolution upscales it (kept across MSAA changes)
 		resolvedColorBufferImage[i] = createImage(swapChainExtent.width, swapChainExtent.height,
-			colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+			colorFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &resolvedColorBufferImageMemory[i], 1, VK_SAMPLE_COUNT_1_BIT);
 
 		// Create Color Buffer ImageView
@@ -1152,10 +2400,6 @@ void VulkanRenderer::createResolvedColorBufferImage()
 
 void VulkanRenderer::createDepthBufferImage()
 {
-	depthBufferImage.resize(swapChainImages.size());
-	depthBufferImageMemory.resize(swapChainImages.size());
-	depthBufferImageView.resize(swapChainImages.size());
-
 	// Get supported format
 	VkFormat depthFormat = chooseSupportedFormat(
 		{ VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D32_SFLOAT, VK_FORMAT_D24_UNORM_S8_UINT },
@@ -1163,16 +2407,20 @@ void VulkanRenderer::createDepthBufferImage()
 		VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
 	);
 
-	for (size_t i = 0; i < swapChainImages.size(); i++)
+	// Without MSAA hiz.comp samples it in place of the resolved depth
+	VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+	if (msaaSamples == VK_SAMPLE_COUNT_1_BIT)
 	{
-		// Create Depth Buffer Image
-		depthBufferImage[i] = createImage(swapChainExtent.width, swapChainExtent.height, 
-			depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
-			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory[i], 1, msaaSamples);
-
-		// Create depth buffer image view
-		depthBufferImageView[i] = createImageView(depthBufferImage[i], depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+		depthUsage |= VK_IMAGE_USAGE_SAMPLED_BIT;
 	}
+
+	// Create Depth Buffer Image, loaded across passes like the color buffer
+	depthBufferImage = createImage(swapChainExtent.width, swapChainExtent.height, 
+		depthFormat, VK_IMAGE_TILING_OPTIMAL, depthUsage,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthBufferImageMemory, 1, msaaSamples);
+
+	// Create depth buffer image view
+	depthBufferImageView = createImageView(depthBufferImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
 }
 
 void VulkanRenderer::createResolvedDepthBufferImage()
@@ -1192,7 +2440,8 @@ void VulkanRenderer::createResolvedDepthBufferImage()
 	{
 		// Create Resolved Depth Buffer Image SAMPLE_1_BIT
 		resolvedDepthBufferImage[i] = createImage(swapChainExtent.width, swapChainExtent.height, 
-			depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+			depthFormat, VK_IMAGE_TILING_OPTIMAL, 
+			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &resolvedDepthBufferImageMemory[i], 1, VK_SAMPLE_COUNT_1_BIT);
 
 		// Create resolved depth buffer image view
@@ -1201,79 +2450,452 @@ void VulkanRenderer::createResolvedDepthBufferImage()
 
 }
 
-void VulkanRenderer::createFramebuffer()
+void VulkanRenderer::createGBufferImages()
 {
-	swapChainFramebuffers.resize(swapChainImages.size());
-	
-	// Create a framebuffer for each swapchain image
-	for (size_t i = 0; i < swapChainFramebuffers.size(); i++)
+	// Formats picked with the deferred render pass
+	for (size_t i = 0; i < GBUFFER_ATTACHMENT_COUNT; i++)
 	{
-		std::array<VkImageView, 5> attachments = {
-			swapChainImages[i].imageView,
-			colorBufferImageView[i],
-			depthBufferImageView[i],
-			resolvedColorBufferImageView[i],
-			resolvedDepthBufferImageView[i]
-		};
+		// Only read as input attachments inside the pass, never stored: contents never need to reach memory
+		gBufferImage[i] = createImage(swapChainExtent.width, swapChainExtent.height,
+			gBufferFormats[i], VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, &gBufferImageMemory[i], 1, msaaSamples);
 
-		VkFramebufferCreateInfo framebufferCreateInfo = {};
-		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebufferCreateInfo.renderPass = renderPass;
-		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-		framebufferCreateInfo.pAttachments = attachments.data();
-		framebufferCreateInfo.width = swapChainExtent.width;
-		framebufferCreateInfo.height = swapChainExtent.height;
-		framebufferCreateInfo.layers = 1;
+		gBufferImageView[i] = createImageView(gBufferImage[i], gBufferFormats[i], VK_IMAGE_ASPECT_COLOR_BIT, 1);
+	}
+}
 
-		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &swapChainFramebuffers[i]);
+void VulkanRenderer::createTemporalAAImages()
+{
+	if (!temporalAATargets) return;
+
+	// Velocity: written by the scene draws, read in place by the post subpass
+	velocityImage = createImage(swapChainExtent.width, swapChainExtent.height,
+		velocityFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &velocityImageMemory, 1, VK_SAMPLE_COUNT_1_BIT);
+	velocityImageView = createImageView(velocityImage, velocityFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+	VkFormat colorFormat = chooseSupportedFormat(
+		{ VK_FORMAT_R8G8B8A8_UNORM },
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT
+	);
+
+	// Resolved frame, written by the post subpass and copied to the history once the pass ends
+	taaResolveImage = createImage(swapChainExtent.width, swapChainExtent.height,
+		colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &taaResolveImageMemory, 1, VK_SAMPLE_COUNT_1_BIT);
+	taaResolveImageView = createImageView(taaResolveImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+	// One history for every swapchain image: frames run in order on the graphics queue
+	historyImage = createImage(swapChainExtent.width, swapChainExtent.height,
+		colorFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &historyImageMemory, 1, VK_SAMPLE_COUNT_1_BIT);
+	historyImageView = createImageView(historyImage, colorFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+
+	// Kept in the layout the post subpass samples it in, between copies
+	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool,
+		historyImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1);
+	transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool,
+		historyImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
+}
+
+void VulkanRenderer::createDepthPyramid()
+{
+	// Power of two at or below the depth size, every level halves exactly
+	depthPyramidWidth = 1;
+	while (depthPyramidWidth * 2 <= swapChainExtent.width) depthPyramidWidth *= 2;
+	depthPyramidHeight = 1;
+	while (depthPyramidHeight * 2 <= swapChainExtent.height) depthPyramidHeight *= 2;
+	depthPyramidLevels = 1;
+	while ((std::max(depthPyramidWidth, depthPyramidHeight) >> depthPyramidLevels) > 0) depthPyramidLevels++;
+
+	// Transfer dst for the far depth clear before the first pyramid is built
+	depthPyramidImage = createImage(depthPyramidWidth, depthPyramidHeight, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &depthPyramidImageMemory, depthPyramidLevels, VK_SAMPLE_COUNT_1_BIT);
+
+	// Whole pyramid for culling, one view per level for the build
+	depthPyramidImageView = createImageView(depthPyramidImage, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, depthPyramidLevels);
+
+	depthPyramidMipViews.resize(depthPyramidLevels);
+	for (uint32_t i = 0; i < depthPyramidLevels; i++)
+	{
+		VkImageViewCreateInfo viewCreateInfo = {};
+		viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewCreateInfo.image = depthPyramidImage;
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.format = VK_FORMAT_R32_SFLOAT;
+		viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewCreateInfo.subresourceRange.baseMipLevel = i;
+		viewCreateInfo.subresourceRange.levelCount = 1;
+		viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+		viewCreateInfo.subresourceRange.layerCount = 1;
+
+		VkResult result = vkCreateImageView(mainDevice.logicalDevice, &viewCreateInfo, nullptr, &depthPyramidMipViews[i]);
 		if (result != VK_SUCCESS)
 		{
-			throw std::runtime_error("Failed to create framebuffer.");
+			throw std::runtime_error("Failed to create depth pyramid image view");
 		}
 	}
-}
-
-void VulkanRenderer::createCommandPool()
-{
-	// Get indices of queue families from device
-	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
 
-	VkCommandPoolCreateInfo poolInfo = {};
-	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily; 
+	// Only read with texelFetch, filtering is never used
+	VkSamplerCreateInfo samplerCreateInfo = {};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+	samplerCreateInfo.minFilter = VK_FILTER_NEAREST;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.minLod = 0;
+	samplerCreateInfo.maxLod = static_cast<float>(depthPyramidLevels);
 
-	// Create a graphics queue family command pool
-	VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &graphicsCommandPool);
+	VkResult result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &depthPyramidSampler);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to create a command pool");
+		throw std::runtime_error("Failed to create depth pyramid sampler");
 	}
+
+	// Written and read by compute only, stays in GENERAL. Cleared to far so the first frame culls nothing
+	VkCommandBuffer commandBuffer = beginCommandBuffer(mainDevice.logicalDevice, graphicsCommandPool);
+
+	VkImageMemoryBarrier imageBarrier = {};
+	imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.image = depthPyramidImage;
+	imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageBarrier.subresourceRange.baseMipLevel = 0;
+	imageBarrier.subresourceRange.levelCount = depthPyramidLevels;
+	imageBarrier.subresourceRange.baseArrayLayer = 0;
+	imageBarrier.subresourceRange.layerCount = 1;
+	imageBarrier.srcAccessMask = 0;
+	imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+	VkClearColorValue farDepth = { { 1.0f, 1.0f, 1.0f, 1.0f } };
+	vkCmdClearColorImage(commandBuffer, depthPyramidImage, VK_IMAGE_LAYOUT_GENERAL, &farDepth, 1, &imageBarrier.subresourceRange);
+
+	endAndSubmitCommandBuffer(mainDevice.logicalDevice, graphicsCommandPool, graphicsQueue, commandBuffer);
 }
 
-void VulkanRenderer::createCommandBuffers()
+void VulkanRenderer::createShadowMap()
 {
-	commandBuffers.resize(swapChainFramebuffers.size());
+	// One layer per cascade, shared by every image: frames are ordered on the queue by the shadow render pass dependencies
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.extent.width = SHADOW_MAP_SIZE;
+	imageCreateInfo.extent.height = SHADOW_MAP_SIZE;
+	imageCreateInfo.extent.depth = 1;
+	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.arrayLayers = SHADOW_CASCADE_COUNT;
+	imageCreateInfo.format = shadowMapFormat;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-	VkCommandBufferAllocateInfo cbAllocInfo = {};
-	cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	cbAllocInfo.commandPool = graphicsCommandPool;
-	cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	cbAllocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
-	
-	// Allocates and places handles in array of buffers
-	VkResult result =vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, commandBuffers.data());
+	VkResult result = vkCreateImage(mainDevice.logicalDevice, &imageCreateInfo, nullptr, &shadowMapImage);
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to allocate Command Buffers");
+		throw std::runtime_error("Failed to create shadow map image");
 	}
-}
+
+	VkMemoryRequirements memoryRequirements;
+	vkGetImageMemoryRequirements(mainDevice.logicalDevice, shadowMapImage, &memoryRequirements);
+
+	VkMemoryAllocateInfo memoryAllocInfo = {};
+	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memoryAllocInfo.allocationSize = memoryRequirements.size;
+	memoryAllocInfo.memoryTypeIndex = findMemoryTypeIndex(mainDevice.physicalDevice, memoryRequirements.memoryTypeBits,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	result = vkAllocateMemory(mainDevice.logicalDevice, &memoryAllocInfo, nullptr, &shadowMapImageMemory);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate memory for shadow map image");
+	}
+	vkBindImageMemory(mainDevice.logicalDevice, shadowMapImage, shadowMapImageMemory, 0);
+
+	// Array view for the lookups, one view per layer for the cascade framebuffers
+	VkImageViewCreateInfo viewCreateInfo = {};
+	viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewCreateInfo.image = shadowMapImage;
+	viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	viewCreateInfo.format = shadowMapFormat;
+	viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	viewCreateInfo.subresourceRange.baseMipLevel = 0;
+	viewCreateInfo.subresourceRange.levelCount = 1;
+	viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+	viewCreateInfo.subresourceRange.layerCount = SHADOW_CASCADE_COUNT;
+
+	result = vkCreateImageView(mainDevice.logicalDevice, &viewCreateInfo, nullptr, &shadowMapImageView);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow map image view");
+	}
+
+	for (uint32_t i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewCreateInfo.subresourceRange.baseArrayLayer = i;
+		viewCreateInfo.subresourceRange.layerCount = 1;
+
+		result = vkCreateImageView(mainDevice.logicalDevice, &viewCreateInfo, nullptr, &shadowCascadeViews[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create shadow cascade image view");
+		}
+
+		VkFramebufferCreateInfo framebufferCreateInfo = {};
+		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferCreateInfo.renderPass = shadowRenderPass;
+		framebufferCreateInfo.attachmentCount = 1;
+		framebufferCreateInfo.pAttachments = &shadowCascadeViews[i];
+		framebufferCreateInfo.width = SHADOW_MAP_SIZE;
+		framebufferCreateInfo.height = SHADOW_MAP_SIZE;
+		framebufferCreateInfo.layers = 1;
+
+		result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &shadowFramebuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create shadow framebuffer.");
+		}
+	}
+
+	// Hardware compare, bilinear so each tap is already a 2x2 filter, outside the map is lit
+	VkSamplerCreateInfo samplerCreateInfo = {};
+	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.compareEnable = VK_TRUE;
+	samplerCreateInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+	samplerCreateInfo.minLod = 0.0f;
+	samplerCreateInfo.maxLod = 0.0f;
+
+	result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &shadowMapSampler);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create shadow map sampler");
+	}
+
+	// Far depth in every layer and left in the layout the shadow render pass expects
+	VkCommandBuffer commandBuffer = beginCommandBuffer(mainDevice.logicalDevice, graphicsCommandPool);
+
+	VkImageMemoryBarrier imageBarrier = {};
+	imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.image = shadowMapImage;
+	imageBarrier.subresourceRange = viewCreateInfo.subresourceRange;
+	imageBarrier.subresourceRange.baseArrayLayer = 0;
+	imageBarrier.subresourceRange.layerCount = SHADOW_CASCADE_COUNT;
+	imageBarrier.srcAccessMask = 0;
+	imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+	VkClearDepthStencilValue farDepth = { 1.0f, 0 };
+	vkCmdClearDepthStencilImage(commandBuffer, shadowMapImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &farDepth, 1, &imageBarrier.subresourceRange);
+
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+	endAndSubmitCommandBuffer(mainDevice.logicalDevice, graphicsCommandPool, graphicsQueue, commandBuffer);
+}
+
+void VulkanRenderer::createFramebuffer()
+{
+	swapChainFramebuffers.resize(swapChainImages.size());
+	
+	// Create a framebuffer for each swapchain image
+	for (size_t i = 0; i < swapChainFramebuffers.size(); i++)
+	{
+		// Temporal anti-aliasing velocity and resolve last, left out without it
+		std::array<VkImageView, 7> attachments = {
+			swapChainImages[i].imageView,
+			colorBufferImageView,
+			depthBufferImageView,
+			resolvedColorBufferImageView[i],
+			resolvedDepthBufferImageView[i],
+			velocityImageView,
+			taaResolveImageView
+		};
+
+		VkFramebufferCreateInfo framebufferCreateInfo = {};
+		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferCreateInfo.renderPass = renderPass;
+		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size()) - (temporalAATargets ? 0 : 2);
+		framebufferCreateInfo.pAttachments = attachments.data();
+		framebufferCreateInfo.width = swapChainExtent.width;
+		framebufferCreateInfo.height = swapChainExtent.height;
+		framebufferCreateInfo.layers = 1;
+
+		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &swapChainFramebuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create framebuffer.");
+		}
+	}
+
+	// Early pass framebuffers share the color and depth images
+	earlyFramebuffers.resize(swapChainImages.size());
+	for (size_t i = 0; i < earlyFramebuffers.size(); i++)
+	{
+		std::array<VkImageView, 4> attachments = {
+			colorBufferImageView,
+			depthBufferImageView,
+			resolvedDepthBufferImageView[i],
+			velocityImageView
+		};
+
+		VkFramebufferCreateInfo framebufferCreateInfo = {};
+		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferCreateInfo.renderPass = earlyRenderPass;
+		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size()) - (temporalAATargets ? 0 : 1);
+		framebufferCreateInfo.pAttachments = attachments.data();
+		framebufferCreateInfo.width = swapChainExtent.width;
+		framebufferCreateInfo.height = swapChainExtent.height;
+		framebufferCreateInfo.layers = 1;
+
+		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &earlyFramebuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create early framebuffer.");
+		}
+	}
+
+	// Deferred framebuffers, forward attachments then the G-buffer
+	deferredFramebuffers.resize(swapChainImages.size());
+	for (size_t i = 0; i < deferredFramebuffers.size(); i++)
+	{
+		std::array<VkImageView, 5 + GBUFFER_ATTACHMENT_COUNT + 2> attachments = {
+			swapChainImages[i].imageView,
+			colorBufferImageView,
+			depthBufferImageView,
+			resolvedColorBufferImageView[i],
+			resolvedDepthBufferImageView[i]
+		};
+		for (size_t j = 0; j < GBUFFER_ATTACHMENT_COUNT; j++)
+		{
+			attachments[5 + j] = gBufferImageView[j];
+		}
+		attachments[5 + GBUFFER_ATTACHMENT_COUNT] = velocityImageView;
+		attachments[5 + GBUFFER_ATTACHMENT_COUNT + 1] = taaResolveImageView;
+
+		VkFramebufferCreateInfo framebufferCreateInfo = {};
+		framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		framebufferCreateInfo.renderPass = deferredRenderPass;
+		framebufferCreateInfo.attachmentCount = static_cast<uint32_t>(attachments.size()) - (temporalAATargets ? 0 : 2);
+		framebufferCreateInfo.pAttachments = attachments.data();
+		framebufferCreateInfo.width = swapChainExtent.width;
+		framebufferCreateInfo.height = swapChainExtent.height;
+		framebufferCreateInfo.layers = 1;
+
+		VkResult result = vkCreateFramebuffer(mainDevice.logicalDevice, &framebufferCreateInfo, nullptr, &deferredFramebuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to create deferred framebuffer.");
+		}
+	}
+}
+
+void VulkanRenderer::createCommandPool()
+{
+	// Get indices of queue families from device
+	QueueFamilyIndices queueFamilyIndices = getQueueFamilies(mainDevice.physicalDevice);
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily; 
+
+	// Create a graphics queue family command pool
+	VkResult result = vkCreateCommandPool(mainDevice.logicalDevice, &poolInfo, nullptr, &graphicsCommandPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a command pool");
+	}
+}
+
+void VulkanRenderer::createCommandBuffers()
+{
+	commandBuffers.resize(swapChainFramebuffers.size());
+	commandBufferDirty.assign(swapChainFramebuffers.size(), true);
+
+	VkCommandBufferAllocateInfo cbAllocInfo = {};
+	cbAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cbAllocInfo.commandPool = graphicsCommandPool;
+	cbAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cbAllocInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+	
+	// Allocates and places handles in array of buffers
+	VkResult result =vkAllocateCommandBuffers(mainDevice.logicalDevice, &cbAllocInfo, commandBuffers.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate Command Buffers");
+	}
+}
+
+void VulkanRenderer::createTimestampQueries()
+{
+	timestampsSubmitted.assign(swapChainImages.size(), false);
+
+	// Only the graphics queue writes them, some queues have no timestamps at all
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(mainDevice.physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilyList(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(mainDevice.physicalDevice, &queueFamilyCount, queueFamilyList.data());
+
+	uint32_t validBits = queueFamilyList[getQueueFamilies(mainDevice.physicalDevice).graphicsFamily].timestampValidBits;
+	if (validBits == 0)
+	{
+		// No GPU frame time: MSAA_AUTO stays at its start count
+		return;
+	}
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
+	timestampPeriod = deviceProperties.limits.timestampPeriod;
+	timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+	// Start and end of each image's command buffer
+	VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+	queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolCreateInfo.queryCount = static_cast<uint32_t>(swapChainImages.size() * 2);
+
+	VkResult result = vkCreateQueryPool(mainDevice.logicalDevice, &queryPoolCreateInfo, nullptr, &timestampQueryPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create timestamp query pool");
+	}
+}
 
 void VulkanRenderer::createSynchronisation()
 {
 	imageAvailable.resize(MAX_FRAMES_DRAWS);
 	renderFinished.resize(MAX_FRAMES_DRAWS);
 	drawFences.resize(MAX_FRAMES_DRAWS);
+	imageFences.resize(swapChainImages.size(), VK_NULL_HANDLE);
 
 	// Semaphore creation information
 	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
@@ -1321,6 +2943,20 @@ void VulkanRenderer::createTextureSampler()
 		throw std::runtime_error("Failed to create texture sampler");
 	}
 
+	// Second pass reads of the history and the upscaled scene: between texels, never outside the image
+	samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerCreateInfo.maxLod = 0.0f;
+	samplerCreateInfo.anisotropyEnable = VK_FALSE;
+	samplerCreateInfo.maxAnisotropy = 1;
+
+	result = vkCreateSampler(mainDevice.logicalDevice, &samplerCreateInfo, nullptr, &postSampler);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create post sampler");
+	}
 }
 
 void VulkanRenderer::getPhysicalDevice()
@@ -1344,7 +2980,10 @@ void VulkanRenderer::getPhysicalDevice()
 		if (checkDeviceSuitable(device))
 		{
 			mainDevice.physicalDevice = device;
-			msaaSamples = getMaxUsableSampleCount();
+			supportedMsaaSamples = getSupportedSampleCounts();
+			// MSAA_AUTO adapts from its start count, fixed modes take theirs
+			msaaSamples = MSAA_AUTO_START_SAMPLES;
+			msaaSamples = chooseMsaaSamples();
 			break;
 		}
 	}
@@ -1352,7 +2991,8 @@ void VulkanRenderer::getPhysicalDevice()
 	VkPhysicalDeviceProperties deviceProperties;
 	vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &deviceProperties);
 
-	//minUniformBufferOffset = deviceProperties.limits.minUniformBufferOffsetAlignment;
+	minUniformBufferOffset = deviceProperties.limits.minUniformBufferOffsetAlignment;
+	minStorageBufferOffset = deviceProperties.limits.minStorageBufferOffsetAlignment;
 }
 
 bool VulkanRenderer::checkInstanceExtensionSupport(std::vector<const char*>* checkExtensions)
@@ -1431,6 +3071,26 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
 	// Information on features
 	VkPhysicalDeviceFeatures deviceFeatures;
 	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+
+	VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+	vulkan12Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	deviceFeatures2.pNext = &vulkan12Features;
+	vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
+
+	// Texture array has to fit in one stage, as an update after bind binding
+	VkPhysicalDeviceVulkan12Properties vulkan12Properties = {};
+	vulkan12Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+	VkPhysicalDeviceProperties2 deviceProperties2 = {};
+	deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	deviceProperties2.pNext = &vulkan12Properties;
+	vkGetPhysicalDeviceProperties2(device, &deviceProperties2);
+	const VkPhysicalDeviceLimits& limits = deviceProperties2.properties.limits;
+	bool texturesSupported = limits.maxPerStageDescriptorSamplers >= MAX_TEXTURES
+		&& limits.maxPerStageDescriptorSampledImages >= MAX_TEXTURES
+		&& vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSamplers >= MAX_TEXTURES
+		&& vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages >= MAX_TEXTURES;
 	
 	
 	QueueFamilyIndices indices = getQueueFamilies(device);
@@ -1443,7 +3103,11 @@ bool VulkanRenderer::checkDeviceSuitable(VkPhysicalDevice device)
 		swapChainValid = !swapChainDetails.presentationModes.empty() && !swapChainDetails.formats.empty();
 	}
 
-	return indices.isValid() && extensionsSupported && swapChainValid && deviceFeatures.samplerAnisotropy;
+	return indices.isValid() && extensionsSupported && swapChainValid && deviceFeatures.samplerAnisotropy
+		&& deviceFeatures.drawIndirectFirstInstance && deviceFeatures.sampleRateShading && deviceFeatures.depthClamp && vulkan12Features.drawIndirectCount
+		&& vulkan12Features.shaderSampledImageArrayNonUniformIndexing && vulkan12Features.descriptorBindingSampledImageUpdateAfterBind
+		&& vulkan12Features.descriptorBindingUpdateUnusedWhilePending && vulkan12Features.descriptorBindingPartiallyBound
+		&& texturesSupported;
 }
 
 std::vector<const char*> VulkanRenderer::getRequiredExtensions()
@@ -1543,6 +3207,38 @@ void VulkanRenderer::updateView()
 	uboViewProjection.view = camera.GetViewMatrix();
 }
 
+int VulkanRenderer::addLight(glm::vec3 position, glm::vec3 color, float radius)
+{
+	if (lights.size() >= MAX_LIGHTS)
+	{
+		throw std::runtime_error("Reached maximum number of lights");
+	}
+
+	lights.push_back({ glm::vec4(position, radius), glm::vec4(color, 0.0f) });
+	return static_cast<int>(lights.size()) - 1;
+}
+
+void VulkanRenderer::updateLight(int light, glm::vec3 position, glm::vec3 color, float radius)
+{
+	if (light < 0 || light >= static_cast<int>(lights.size()))
+	{
+		throw std::runtime_error("Attempted to update an invalid light");
+	}
+
+	lights[light] = { glm::vec4(position, radius), glm::vec4(color, 0.0f) };
+}
+
+void VulkanRenderer::setSunLight(glm::vec3 direction, glm::vec3 color)
+{
+	if (glm::dot(direction, direction) == 0.0f)
+	{
+		throw std::runtime_error("Sun light direction must not be zero");
+	}
+
+	// A new direction invalidates every cascade, they are refitted over the next frames
+	shadowCascades.setLight(direction, color);
+}
+
 void VulkanRenderer::setupDebugMessenger() {
 	if (!enableValidationLayers) return;
 
@@ -1568,24 +3264,58 @@ void VulkanRenderer::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreat
 
 void VulkanRenderer::createUniformBuffers()
 {
-	// View projection buffer size
-	VkDeviceSize vpBufferSize = sizeof(UboViewProjection);
-
 	// Model buffer size
 	//VkDeviceSize modelBufferSize = modelUniformAligment * MAX_OBJECTS;
 
-	//One uniform buffer for each image
-	vpUniformBuffer.resize(swapChainImages.size());
-	vpUniformBufferMemory.resize(swapChainImages.size());
+	// Frame data layout: view projection, object data, draw data, cluster draws, draw commands, transparent commands,
+	// cull params and stats, light params and lights, shadow params, caster and clear commands, post params, then scratch
+	// Every region starts on the strictest alignment so the same offsets work whatever the buffer is bound as
+	VkDeviceSize regionAlignment = std::max(minUniformBufferOffset, minStorageBufferOffset);
+	auto alignRegion = [regionAlignment](VkDeviceSize size) { return (size + regionAlignment - 1) & ~(regionAlignment - 1); };
+	VkDeviceSize frameDataSize = alignRegion(sizeof(UboViewProjection)) + alignRegion(sizeof(Model) * MAX_MODEL_TRANSFORMS)
+		+ alignRegion(sizeof(DrawItem) * MAX_DRAW_ITEMS) + alignRegion(sizeof(uint32_t) * MAX_DRAW_CLUSTERS) + alignRegion(DRAW_COMMAND_REGION_SIZE)
+		+ alignRegion(TRANSPARENT_COMMAND_REGION_SIZE) + alignRegion(sizeof(CullParams)) + alignRegion(sizeof(uint32_t) * 4)
+		+ alignRegion(sizeof(LightParams)) + alignRegion(sizeof(PointLight) * MAX_LIGHTS) + alignRegion(sizeof(ShadowParams))
+		+ alignRegion(SHADOW_COMMAND_REGION_SIZE * SHADOW_CASCADE_COUNT) + alignRegion(sizeof(VkDrawIndirectCommand) * SHADOW_CASCADE_COUNT)
+		+ alignRegion(sizeof(PostParams)) + FRAME_GPU_SCRATCH_SIZE;
+
+	// One frame data buffer for each image
+	frameDataBuffer.resize(swapChainImages.size());
+	frameDataBufferMemory.resize(swapChainImages.size());
+	frameDataAllocators.resize(swapChainImages.size());
 	//modelDynUniformBuffer.resize(swapChainImages.size());
 	//modelDynUniformBufferMemory.resize(swapChainImages.size());
 
-	// Create uniform buffers
 	for (size_t i = 0; i < swapChainImages.size(); i++)
 	{
-		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, vpBufferSize,
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			&vpUniformBuffer[i], &vpUniformBufferMemory[i]);
+		// Written every frame, keep it mapped for the renderer lifetime
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, frameDataSize,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&frameDataBuffer[i], &frameDataBufferMemory[i]);
+
+		void* mapped;
+		vkMapMemory(mainDevice.logicalDevice, frameDataBufferMemory[i], 0, frameDataSize, 0, &mapped);
+		frameDataAllocators[i].createExternal(mapped, static_cast<size_t>(frameDataSize));
+
+		// Fixed regions, same layout in every image
+		size_t alignment = static_cast<size_t>(regionAlignment);
+		vpUniformOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(UboViewProjection), alignment));
+		objectDataOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(Model) * MAX_MODEL_TRANSFORMS, alignment));
+		drawDataOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(DrawItem) * MAX_DRAW_ITEMS, alignment));
+		clusterDrawOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(uint32_t) * MAX_DRAW_CLUSTERS, alignment));
+		drawCommandOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(DRAW_COMMAND_REGION_SIZE, alignment));
+		transparentCommandOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(TRANSPARENT_COMMAND_REGION_SIZE, alignment));
+		cullParamsOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(CullParams), alignment));
+		cullStatsOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(uint32_t) * 4, alignment));
+		memset(static_cast<uint8_t*>(mapped) + cullStatsOffset, 0, sizeof(uint32_t) * 4);
+		lightParamsOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(LightParams), alignment));
+		lightDataOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(PointLight) * MAX_LIGHTS, alignment));
+		shadowParamsOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(ShadowParams), alignment));
+		shadowCommandOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(SHADOW_COMMAND_REGION_SIZE * SHADOW_CASCADE_COUNT, alignment));
+		shadowClearOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(VkDrawIndirectCommand) * SHADOW_CASCADE_COUNT, alignment));
+		postParamsOffset = frameDataAllocators[i].getOffset(frameDataAllocators[i].allocate(sizeof(PostParams), alignment));
+		frameDataScratchMarker = frameDataAllocators[i].getMarker();
 		/*
 		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, modelBufferSize,
 			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
@@ -1594,28 +3324,101 @@ void VulkanRenderer::createUniformBuffers()
 	}
 }
 
+void VulkanRenderer::createCullBuffers()
+{
+	// Early region then late region, the late one bound at an aligned offset
+	cullLateOutputOffset = (DRAW_COMMAND_REGION_SIZE + minStorageBufferOffset - 1) & ~(minStorageBufferOffset - 1);
+	VkDeviceSize cullOutputSize = cullLateOutputOffset + DRAW_COMMAND_REGION_SIZE;
+
+	cullOutputBuffer.resize(swapChainImages.size());
+	cullOutputBufferMemory.resize(swapChainImages.size());
+
+	// Written and read by the GPU only, the count is copied back to the frame data buffer
+	for (size_t i = 0; i < swapChainImages.size(); i++)
+	{
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, cullOutputSize,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+			| VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &cullOutputBuffer[i], &cullOutputBufferMemory[i]);
+	}
+
+	// Shared by every frame, nothing was visible before the first one
+	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, sizeof(uint32_t) * MAX_DRAW_ITEMS,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &drawVisibilityBuffer, &drawVisibilityBufferMemory);
+
+	// Clusters are copied in as models are added, their visibility starts like the draws'
+	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, sizeof(MeshCluster) * MAX_DRAW_CLUSTERS,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &clusterBuffer, &clusterBufferMemory);
+	createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, sizeof(uint32_t) * MAX_DRAW_CLUSTERS,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &clusterVisibilityBuffer, &clusterVisibilityBufferMemory);
+
+	VkCommandBuffer commandBuffer = beginCommandBuffer(mainDevice.logicalDevice, graphicsCommandPool);
+	vkCmdFillBuffer(commandBuffer, drawVisibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+	vkCmdFillBuffer(commandBuffer, clusterVisibilityBuffer, 0, VK_WHOLE_SIZE, 0);
+	endAndSubmitCommandBuffer(mainDevice.logicalDevice, graphicsCommandPool, graphicsQueue, commandBuffer);
+}
+
+void VulkanRenderer::createLightBuffers()
+{
+	lightGridSize = sizeof(uint32_t) * LIGHT_CLUSTER_COUNT * (1 + MAX_LIGHTS_PER_CLUSTER);
+
+	lightGridBuffer.resize(swapChainImages.size());
+	lightGridBufferMemory.resize(swapChainImages.size());
+
+	// Written by the light cull compute and read by the fragment shader, never seen by the CPU
+	for (size_t i = 0; i < swapChainImages.size(); i++)
+	{
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, lightGridSize,
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&lightGridBuffer[i], &lightGridBufferMemory[i]);
+	}
+}
+
+void VulkanRenderer::createFrameArenas()
+{
+	// Sized for the steady state, an arena that overflows grows once on its next reset
+	for (auto& arena : frameArenas)
+	{
+		arena.create(FRAME_ARENA_SIZE);
+	}
+}
+
 void VulkanRenderer::createDescriptorPool()
 {
 	// CREATE UNIFORM DESCRIPTOR POOL
 
 	// Describe types of descriptors and how many there are, not descriptor sets! (combine makes the pool size)
-	// View Projection
+	// View Projection, cull params, light params for graphics and light culling, shadow params
 	VkDescriptorPoolSize vpPoolSize = {};
 	vpPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	vpPoolSize.descriptorCount = static_cast<uint32_t>(vpUniformBuffer.size());
+	vpPoolSize.descriptorCount = static_cast<uint32_t>(frameDataBuffer.size() * 5);
 
 	// Model (DYNAMIC)
 	/*VkDescriptorPoolSize modelPoolsize = {};
 	modelPoolsize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	modelPoolsize.descriptorCount = static_cast<uint32_t>(modelDynUniformBuffer.size());*/
 
+	// Object and draw data for graphics, object, draw, early and late output, clusters, cluster draws and both visibilities for culling
+	// Lights and light grid for graphics and light culling
+	VkDescriptorPoolSize objectPoolSize = {};
+	objectPoolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	objectPoolSize.descriptorCount = static_cast<uint32_t>(frameDataBuffer.size() * 14);
+
+	// Depth pyramid for culling, shadow map for graphics
+	VkDescriptorPoolSize pyramidPoolSize = {};
+	pyramidPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	pyramidPoolSize.descriptorCount = static_cast<uint32_t>(frameDataBuffer.size() * 2);
+
 	// List of pool sizes
-	std::vector<VkDescriptorPoolSize> descriptorPoolSizes = { vpPoolSize };
+	std::vector<VkDescriptorPoolSize> descriptorPoolSizes = { vpPoolSize, objectPoolSize, pyramidPoolSize };
 
 	// data to create Descriptor Pool
 	VkDescriptorPoolCreateInfo poolCreateInfo = {};
 	poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolCreateInfo.maxSets = static_cast<uint32_t>(swapChainImages.size());
+	poolCreateInfo.maxSets = static_cast<uint32_t>(swapChainImages.size() * 3);
 	poolCreateInfo.poolSizeCount = static_cast<uint32_t>(descriptorPoolSizes.size());
 	poolCreateInfo.pPoolSizes = descriptorPoolSizes.data();
 
@@ -1630,11 +3433,12 @@ void VulkanRenderer::createDescriptorPool()
 	// texture sampler pool
 	VkDescriptorPoolSize samplerPoolSize = {};
 	samplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerPoolSize.descriptorCount = MAX_OBJECTS;
+	samplerPoolSize.descriptorCount = MAX_TEXTURES;
 	
 	VkDescriptorPoolCreateInfo samplerPoolCreateInfo = {};
 	samplerPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	samplerPoolCreateInfo.maxSets = MAX_OBJECTS;
+	samplerPoolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	samplerPoolCreateInfo.maxSets = 1;
 	samplerPoolCreateInfo.poolSizeCount = 1;
 	samplerPoolCreateInfo.pPoolSizes = &samplerPoolSize;
 	
@@ -1648,30 +3452,38 @@ void VulkanRenderer::createDescriptorPool()
 	// Color Attachment pool size
 	VkDescriptorPoolSize colorInputPoolSize = {};
 	colorInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	colorInputPoolSize.descriptorCount = static_cast<uint32_t>(colorBufferImageView.size());
+	colorInputPoolSize.descriptorCount = static_cast<uint32_t>(swapChainImages.size());
 
 	// Depth Attachment Pool size
 	VkDescriptorPoolSize depthInputPoolSize = {};
 	depthInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	depthInputPoolSize.descriptorCount = static_cast<uint32_t>(depthBufferImageView.size());
+	depthInputPoolSize.descriptorCount = static_cast<uint32_t>(swapChainImages.size());
 
-	// Resolved Color pool size
-	VkDescriptorPoolSize resolvedColorInputPoolSize = {};
-	resolvedColorInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	resolvedColorInputPoolSize.descriptorCount = static_cast<uint32_t>(resolvedColorBufferImageView.size());
+	// Temporal anti-aliasing and dynamic resolution: velocity input, color, history and depth samplers, PostParams
+	VkDescriptorPoolSize velocityInputPoolSize = {};
+	velocityInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	velocityInputPoolSize.descriptorCount = static_cast<uint32_t>(swapChainImages.size());
 
-	// Resolved Color pool size
-	VkDescriptorPoolSize resolvedDepthInputPoolSize = {};
-	resolvedDepthInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-	resolvedDepthInputPoolSize.descriptorCount = static_cast<uint32_t>(resolvedDepthBufferImageView.size());
+	VkDescriptorPoolSize postSamplerPoolSize = {};
+	postSamplerPoolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	postSamplerPoolSize.descriptorCount = static_cast<uint32_t>(swapChainImages.size() * 3);
+
+	VkDescriptorPoolSize postParamsPoolSize = {};
+	postParamsPoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	postParamsPoolSize.descriptorCount = static_cast<uint32_t>(swapChainImages.size());
+
+	// G-buffer and depth inputs of the deferred lighting subpass
+	VkDescriptorPoolSize gBufferInputPoolSize = {};
+	gBufferInputPoolSize.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+	gBufferInputPoolSize.descriptorCount = static_cast<uint32_t>(swapChainImages.size() * (GBUFFER_ATTACHMENT_COUNT + 1));
 
 	std::vector<VkDescriptorPoolSize> inputPoolSizes = { colorInputPoolSize, depthInputPoolSize, 
-		resolvedColorInputPoolSize, resolvedDepthInputPoolSize };
+		velocityInputPoolSize, postSamplerPoolSize, postParamsPoolSize, gBufferInputPoolSize };
 	
 	// Create input attachment pool
 	VkDescriptorPoolCreateInfo inputPoolCreateInfo = {};
 	inputPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	inputPoolCreateInfo.maxSets = swapChainImages.size();
+	inputPoolCreateInfo.maxSets = static_cast<uint32_t>(swapChainImages.size() * 2);
 	inputPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(inputPoolSizes.size());
 	inputPoolCreateInfo.pPoolSizes = inputPoolSizes.data();
 
@@ -1681,6 +3493,27 @@ void VulkanRenderer::createDescriptorPool()
 		throw std::runtime_error("Failed to create a descriptor pool");
 	}
 
+	// Create Hi-Z Descriptor Pool, one set per pyramid level per image
+	uint32_t hizSetCount = static_cast<uint32_t>(swapChainImages.size()) * depthPyramidLevels;
+
+	std::array<VkDescriptorPoolSize, 2> hizPoolSizes = {};
+	hizPoolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	hizPoolSizes[0].descriptorCount = hizSetCount;
+	hizPoolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	hizPoolSizes[1].descriptorCount = hizSetCount;
+
+	VkDescriptorPoolCreateInfo hizPoolCreateInfo = {};
+	hizPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	hizPoolCreateInfo.maxSets = hizSetCount;
+	hizPoolCreateInfo.poolSizeCount = static_cast<uint32_t>(hizPoolSizes.size());
+	hizPoolCreateInfo.pPoolSizes = hizPoolSizes.data();
+
+	result = vkCreateDescriptorPool(mainDevice.logicalDevice, &hizPoolCreateInfo, nullptr, &hizDescriptorPool);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to create a descriptor pool");
+	}
+
 
 }
 
@@ -1711,8 +3544,8 @@ void VulkanRenderer::createDescriptorSets()
 		// View Projection Descriptor
 		// Describe buffer info and offset
 		VkDescriptorBufferInfo vpBufferInfo = {};
-		vpBufferInfo.buffer = vpUniformBuffer[i];
-		vpBufferInfo.offset = 0;
+		vpBufferInfo.buffer = frameDataBuffer[i];
+		vpBufferInfo.offset = vpUniformOffset;
 		vpBufferInfo.range = sizeof(UboViewProjection);
 
 		// Data about connection between binding and buffer
@@ -1725,6 +3558,36 @@ void VulkanRenderer::createDescriptorSets()
 		vpSetWrite.descriptorCount = 1;
 		vpSetWrite.pBufferInfo = &vpBufferInfo;
 
+		// Object data Descriptor
+		VkDescriptorBufferInfo objectBufferInfo = {};
+		objectBufferInfo.buffer = frameDataBuffer[i];
+		objectBufferInfo.offset = objectDataOffset;
+		objectBufferInfo.range = sizeof(Model) * MAX_MODEL_TRANSFORMS;
+
+		VkWriteDescriptorSet objectSetWrite = {};
+		objectSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		objectSetWrite.dstSet = descriptorSets[i];
+		objectSetWrite.dstBinding = 1;
+		objectSetWrite.dstArrayElement = 0;
+		objectSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		objectSetWrite.descriptorCount = 1;
+		objectSetWrite.pBufferInfo = &objectBufferInfo;
+
+		// Draw data Descriptor
+		VkDescriptorBufferInfo drawBufferInfo = {};
+		drawBufferInfo.buffer = frameDataBuffer[i];
+		drawBufferInfo.offset = drawDataOffset;
+		drawBufferInfo.range = sizeof(DrawItem) * MAX_DRAW_ITEMS;
+
+		VkWriteDescriptorSet drawSetWrite = {};
+		drawSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		drawSetWrite.dstSet = descriptorSets[i];
+		drawSetWrite.dstBinding = 2;
+		drawSetWrite.dstArrayElement = 0;
+		drawSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		drawSetWrite.descriptorCount = 1;
+		drawSetWrite.pBufferInfo = &drawBufferInfo;
+
 		/*
 		// Model Descriptor
 		// Model Buffer binding info
@@ -1744,52 +3607,298 @@ void VulkanRenderer::createDescriptorSets()
 		modelSetWrite.pBufferInfo = &modelBufferInfo;
 		*/
 
+		// Light params, lights and this image's light grid
+		std::array<VkDescriptorBufferInfo, 3> lightBufferInfos = {};
+		lightBufferInfos[0] = { frameDataBuffer[i], lightParamsOffset, sizeof(LightParams) };
+		lightBufferInfos[1] = { frameDataBuffer[i], lightDataOffset, sizeof(PointLight) * MAX_LIGHTS };
+		lightBufferInfos[2] = { lightGridBuffer[i], 0, lightGridSize };
+
+		std::array<VkWriteDescriptorSet, 3> lightSetWrites = {};
+		for (uint32_t j = 0; j < lightSetWrites.size(); j++)
+		{
+			lightSetWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			lightSetWrites[j].dstSet = descriptorSets[i];
+			lightSetWrites[j].dstBinding = 3 + j;
+			lightSetWrites[j].dstArrayElement = 0;
+			lightSetWrites[j].descriptorType = j == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			lightSetWrites[j].descriptorCount = 1;
+			lightSetWrites[j].pBufferInfo = &lightBufferInfos[j];
+		}
+
+		// Shadow params and the cascaded shadow map, the same map for every image
+		VkDescriptorBufferInfo shadowParamsBufferInfo = { frameDataBuffer[i], shadowParamsOffset, sizeof(ShadowParams) };
+
+		VkWriteDescriptorSet shadowParamsSetWrite = {};
+		shadowParamsSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		shadowParamsSetWrite.dstSet = descriptorSets[i];
+		shadowParamsSetWrite.dstBinding = 6;
+		shadowParamsSetWrite.dstArrayElement = 0;
+		shadowParamsSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		shadowParamsSetWrite.descriptorCount = 1;
+		shadowParamsSetWrite.pBufferInfo = &shadowParamsBufferInfo;
+
+		VkDescriptorImageInfo shadowMapImageInfo = {};
+		shadowMapImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		shadowMapImageInfo.imageView = shadowMapImageView;
+		shadowMapImageInfo.sampler = shadowMapSampler;
+
+		VkWriteDescriptorSet shadowMapSetWrite = {};
+		shadowMapSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		shadowMapSetWrite.dstSet = descriptorSets[i];
+		shadowMapSetWrite.dstBinding = 7;
+		shadowMapSetWrite.dstArrayElement = 0;
+		shadowMapSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		shadowMapSetWrite.descriptorCount = 1;
+		shadowMapSetWrite.pImageInfo = &shadowMapImageInfo;
+
 		// List of descriptor sets writes
-		std::vector<VkWriteDescriptorSet> setWrites = { vpSetWrite };
+		std::vector<VkWriteDescriptorSet> setWrites = { vpSetWrite, objectSetWrite, drawSetWrite,
+			lightSetWrites[0], lightSetWrites[1], lightSetWrites[2], shadowParamsSetWrite, shadowMapSetWrite };
 
 		// Update descriptor set with buffer binding info
 		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
 	}
-}
 
-void VulkanRenderer::createInputDescriptorSets()
-{
-	// Resize our array to hold descriptor set for each swapchain Image
-	inputDescriptorSets.resize(swapChainImages.size());
+	// CULL DESCRIPTOR SETS
+	cullDescriptorSets.resize(swapChainImages.size());
 
-	// Fill array of layout ready for set creation
-	std::vector<VkDescriptorSetLayout> inputSetLayouts(swapChainImages.size(), inputSetLayout);
-	
-	// Input attachment descriptor Set allocation info
-	VkDescriptorSetAllocateInfo setAllocInfo = {};
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = inputDescriptorPool;
-	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
-	setAllocInfo.pSetLayouts = inputSetLayouts.data();
+	std::vector<VkDescriptorSetLayout> cullSetLayouts(swapChainImages.size(), cullSetLayout);
 
-	// Allocate Descriptor set
-	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, inputDescriptorSets.data());
+	VkDescriptorSetAllocateInfo cullSetAllocInfo = {};
+	cullSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	cullSetAllocInfo.descriptorPool = descriptorPool;
+	cullSetAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
+	cullSetAllocInfo.pSetLayouts = cullSetLayouts.data();
+
+	result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &cullSetAllocInfo, cullDescriptorSets.data());
 	if (result != VK_SUCCESS)
 	{
-		throw std::runtime_error("Failed to allocate input Attachment Descriptor Sets!");
+		throw std::runtime_error("Failed to allocate cull descriptor set");
 	}
 
-	// Update each descriptor set with input attachment
 	for (size_t i = 0; i < swapChainImages.size(); i++)
 	{
-		/*
-		// Color attachment Descriptor
-		VkDescriptorImageInfo colorAttachmentDescriptor = {};
-		colorAttachmentDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		colorAttachmentDescriptor.imageView = colorBufferImageView[i];
-		colorAttachmentDescriptor.sampler = VK_NULL_HANDLE;
+		// Params, object data, draw data in frame data buffer, early and late commands in cull output buffer, visibility
+		std::array<VkDescriptorBufferInfo, 6> bufferInfos = {};
+		bufferInfos[0] = { frameDataBuffer[i], cullParamsOffset, sizeof(CullParams) };
+		bufferInfos[1] = { frameDataBuffer[i], objectDataOffset, sizeof(Model) * MAX_MODEL_TRANSFORMS };
+		bufferInfos[2] = { frameDataBuffer[i], drawDataOffset, sizeof(DrawItem) * MAX_DRAW_ITEMS };
+		bufferInfos[3] = { cullOutputBuffer[i], 0, DRAW_COMMAND_REGION_SIZE };
+		bufferInfos[4] = { cullOutputBuffer[i], cullLateOutputOffset, DRAW_COMMAND_REGION_SIZE };
+		bufferInfos[5] = { drawVisibilityBuffer, 0, VK_WHOLE_SIZE };
+
+		std::array<VkWriteDescriptorSet, 10> cullSetWrites = {};
+		for (uint32_t j = 0; j < bufferInfos.size(); j++)
+		{
+			cullSetWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			cullSetWrites[j].dstSet = cullDescriptorSets[i];
+			cullSetWrites[j].dstBinding = j;
+			cullSetWrites[j].dstArrayElement = 0;
+			cullSetWrites[j].descriptorType = j == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			cullSetWrites[j].descriptorCount = 1;
+			cullSetWrites[j].pBufferInfo = &bufferInfos[j];
+		}
 
-		// Color Attachment descriptor write
-		VkWriteDescriptorSet colorWrite = {};
-		colorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		colorWrite.dstSet = inputDescriptorSets[i];
-		colorWrite.dstBinding = 0;
-		colorWrite.dstArrayElement = 0;
+		// Whole depth pyramid
+		VkDescriptorImageInfo pyramidInfo = {};
+		pyramidInfo.sampler = depthPyramidSampler;
+		pyramidInfo.imageView = depthPyramidImageView;
+		pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		cullSetWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		cullSetWrites[6].dstSet = cullDescriptorSets[i];
+		cullSetWrites[6].dstBinding = 6;
+		cullSetWrites[6].dstArrayElement = 0;
+		cullSetWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		cullSetWrites[6].descriptorCount = 1;
+		cullSetWrites[6].pImageInfo = &pyramidInfo;
+
+		// Clusters and their visibility, shared by every image
+		std::array<VkDescriptorBufferInfo, 2> clusterInfos = {};
+		clusterInfos[0] = { clusterBuffer, 0, VK_WHOLE_SIZE };
+		clusterInfos[1] = { clusterVisibilityBuffer, 0, VK_WHOLE_SIZE };
+		for (uint32_t j = 0; j < clusterInfos.size(); j++)
+		{
+			VkWriteDescriptorSet& clusterSetWrite = cullSetWrites[7 + j];
+			clusterSetWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			clusterSetWrite.dstSet = cullDescriptorSets[i];
+			clusterSetWrite.dstBinding = 7 + j;
+			clusterSetWrite.dstArrayElement = 0;
+			clusterSetWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			clusterSetWrite.descriptorCount = 1;
+			clusterSetWrite.pBufferInfo = &clusterInfos[j];
+		}
+
+		// Cluster draws, written with the draw data of this image
+		VkDescriptorBufferInfo clusterDrawInfo = { frameDataBuffer[i], clusterDrawOffset, sizeof(uint32_t) * MAX_DRAW_CLUSTERS };
+		cullSetWrites[9].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		cullSetWrites[9].dstSet = cullDescriptorSets[i];
+		cullSetWrites[9].dstBinding = 9;
+		cullSetWrites[9].dstArrayElement = 0;
+		cullSetWrites[9].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		cullSetWrites[9].descriptorCount = 1;
+		cullSetWrites[9].pBufferInfo = &clusterDrawInfo;
+
+		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(cullSetWrites.size()), cullSetWrites.data(), 0, nullptr);
+	}
+
+	// LIGHT CULL DESCRIPTOR SETS
+	lightCullDescriptorSets.resize(swapChainImages.size());
+
+	std::vector<VkDescriptorSetLayout> lightCullSetLayouts(swapChainImages.size(), lightCullSetLayout);
+
+	VkDescriptorSetAllocateInfo lightCullSetAllocInfo = {};
+	lightCullSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	lightCullSetAllocInfo.descriptorPool = descriptorPool;
+	lightCullSetAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
+	lightCullSetAllocInfo.pSetLayouts = lightCullSetLayouts.data();
+
+	result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &lightCullSetAllocInfo, lightCullDescriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate light cull descriptor set");
+	}
+
+	for (size_t i = 0; i < swapChainImages.size(); i++)
+	{
+		// Light params and lights in frame data buffer, light grid of the same image as the graphics set
+		std::array<VkDescriptorBufferInfo, 3> bufferInfos = {};
+		bufferInfos[0] = { frameDataBuffer[i], lightParamsOffset, sizeof(LightParams) };
+		bufferInfos[1] = { frameDataBuffer[i], lightDataOffset, sizeof(PointLight) * MAX_LIGHTS };
+		bufferInfos[2] = { lightGridBuffer[i], 0, lightGridSize };
+
+		std::array<VkWriteDescriptorSet, 3> lightCullSetWrites = {};
+		for (uint32_t j = 0; j < lightCullSetWrites.size(); j++)
+		{
+			lightCullSetWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			lightCullSetWrites[j].dstSet = lightCullDescriptorSets[i];
+			lightCullSetWrites[j].dstBinding = j;
+			lightCullSetWrites[j].dstArrayElement = 0;
+			lightCullSetWrites[j].descriptorType = j == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			lightCullSetWrites[j].descriptorCount = 1;
+			lightCullSetWrites[j].pBufferInfo = &bufferInfos[j];
+		}
+
+		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(lightCullSetWrites.size()), lightCullSetWrites.data(), 0, nullptr);
+	}
+
+	// HI-Z DESCRIPTOR SETS
+	hizDescriptorSets.resize(swapChainImages.size() * depthPyramidLevels);
+
+	std::vector<VkDescriptorSetLayout> hizSetLayouts(hizDescriptorSets.size(), hizSetLayout);
+
+	VkDescriptorSetAllocateInfo hizSetAllocInfo = {};
+	hizSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	hizSetAllocInfo.descriptorPool = hizDescriptorPool;
+	hizSetAllocInfo.descriptorSetCount = static_cast<uint32_t>(hizDescriptorSets.size());
+	hizSetAllocInfo.pSetLayouts = hizSetLayouts.data();
+
+	result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &hizSetAllocInfo, hizDescriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate Hi-Z descriptor set");
+	}
+
+	writeHizDescriptorSets();
+}
+
+void VulkanRenderer::writeHizDescriptorSets()
+{
+	bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
+	for (size_t i = 0; i < swapChainImages.size(); i++)
+	{
+		for (uint32_t level = 0; level < depthPyramidLevels; level++)
+		{
+			// Level 0 reduces this image's resolved depth (the depth itself without MSAA), every other level the one above it
+			VkDescriptorImageInfo srcInfo = {};
+			srcInfo.sampler = depthPyramidSampler;
+			srcInfo.imageView = level == 0 ? (resolve ? resolvedDepthBufferImageView[i] : depthBufferImageView)
+				: depthPyramidMipViews[level - 1];
+			srcInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+			VkDescriptorImageInfo dstInfo = {};
+			dstInfo.imageView = depthPyramidMipViews[level];
+			dstInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+			VkDescriptorSet hizSet = hizDescriptorSets[i * depthPyramidLevels + level];
+
+			std::array<VkWriteDescriptorSet, 2> hizSetWrites = {};
+			hizSetWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			hizSetWrites[0].dstSet = hizSet;
+			hizSetWrites[0].dstBinding = 0;
+			hizSetWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			hizSetWrites[0].descriptorCount = 1;
+			hizSetWrites[0].pImageInfo = &srcInfo;
+			hizSetWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			hizSetWrites[1].dstSet = hizSet;
+			hizSetWrites[1].dstBinding = 1;
+			hizSetWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			hizSetWrites[1].descriptorCount = 1;
+			hizSetWrites[1].pImageInfo = &dstInfo;
+
+			vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(hizSetWrites.size()), hizSetWrites.data(), 0, nullptr);
+		}
+	}
+}
+
+void VulkanRenderer::createInputDescriptorSets()
+{
+	// Resize our array to hold descriptor set for each swapchain Image
+	inputDescriptorSets.resize(swapChainImages.size());
+
+	// Fill array of layout ready for set creation
+	std::vector<VkDescriptorSetLayout> inputSetLayouts(swapChainImages.size(), inputSetLayout);
+	
+	// Input attachment descriptor Set allocation info
+	VkDescriptorSetAllocateInfo setAllocInfo = {};
+	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setAllocInfo.descriptorPool = inputDescriptorPool;
+	setAllocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
+	setAllocInfo.pSetLayouts = inputSetLayouts.data();
+
+	// Allocate Descriptor set
+	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, inputDescriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate input Attachment Descriptor Sets!");
+	}
+
+	// G-buffer input sets of the deferred lighting subpass
+	gBufferInputDescriptorSets.resize(swapChainImages.size());
+	std::vector<VkDescriptorSetLayout> gBufferInputSetLayouts(swapChainImages.size(), gBufferInputSetLayout);
+	setAllocInfo.pSetLayouts = gBufferInputSetLayouts.data();
+
+	result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, gBufferInputDescriptorSets.data());
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to allocate G-buffer input Attachment Descriptor Sets!");
+	}
+
+	writeInputDescriptorSets();
+}
+
+void VulkanRenderer::writeInputDescriptorSets()
+{
+	// Without MSAA the second pass reads the color and depth attachments, nothing is resolved
+	bool resolve = msaaSamples != VK_SAMPLE_COUNT_1_BIT;
+
+	// Update each descriptor set with input attachment
+	for (size_t i = 0; i < swapChainImages.size(); i++)
+	{
+		/*
+		// Color attachment Descriptor
+		VkDescriptorImageInfo colorAttachmentDescriptor = {};
+		colorAttachmentDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		colorAttachmentDescriptor.imageView = colorBufferImageView;
+		colorAttachmentDescriptor.sampler = VK_NULL_HANDLE;
+
+		// Color Attachment descriptor write
+		VkWriteDescriptorSet colorWrite = {};
+		colorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		colorWrite.dstSet = inputDescriptorSets[i];
+		colorWrite.dstBinding = 0;
+		colorWrite.dstArrayElement = 0;
 		colorWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
 		colorWrite.descriptorCount = 1;
 		colorWrite.pImageInfo = &colorAttachmentDescriptor;
@@ -1797,7 +3906,7 @@ void VulkanRenderer::createInputDescriptorSets()
 		// Depth attachment Descriptor
 		VkDescriptorImageInfo depthAttachmentDescriptor = {};
 		depthAttachmentDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		depthAttachmentDescriptor.imageView = depthBufferImageView[i];
+		depthAttachmentDescriptor.imageView = depthBufferImageView;
 		depthAttachmentDescriptor.sampler = VK_NULL_HANDLE;
 
 		// Depth Attachment descriptor write
@@ -1811,173 +3920,1157 @@ void VulkanRenderer::createInputDescriptorSets()
 		depthWrite.pImageInfo = &depthAttachmentDescriptor;
 		*/
 
-		// Resolved Color attachment Descriptor
-		VkDescriptorImageInfo resolvedColorAttachmentDescriptor = {};
-		resolvedColorAttachmentDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		resolvedColorAttachmentDescriptor.imageView = resolvedColorBufferImageView[i];
-		resolvedColorAttachmentDescriptor.sampler = VK_NULL_HANDLE;
+		// Resolved Color attachment Descriptor
+		VkDescriptorImageInfo resolvedColorAttachmentDescriptor = {};
+		resolvedColorAttachmentDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		resolvedColorAttachmentDescriptor.imageView = resolve ? resolvedColorBufferImageView[i] : colorBufferImageView;
+		resolvedColorAttachmentDescriptor.sampler = VK_NULL_HANDLE;
+
+		// Resolved Color Attachment descriptor write
+		VkWriteDescriptorSet resolvedColorWrite = {};
+		resolvedColorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		resolvedColorWrite.dstSet = inputDescriptorSets[i];
+		resolvedColorWrite.dstBinding = 0;
+		resolvedColorWrite.dstArrayElement = 0;
+		resolvedColorWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+		resolvedColorWrite.descriptorCount = 1;
+		resolvedColorWrite.pImageInfo = &resolvedColorAttachmentDescriptor;
+
+		// Resolved Color attachment Descriptor
+		VkDescriptorImageInfo resolvedDepthAttachmentDescriptor = {};
+		resolvedDepthAttachmentDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		resolvedDepthAttachmentDescriptor.imageView = resolve ? resolvedDepthBufferImageView[i] : depthBufferImageView;
+		resolvedDepthAttachmentDescriptor.sampler = VK_NULL_HANDLE;
+
+		// Resolved Color Attachment descriptor write
+		VkWriteDescriptorSet resolvedDepthWrite = {};
+		resolvedDepthWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		resolvedDepthWrite.dstSet = inputDescriptorSets[i];
+		resolvedDepthWrite.dstBinding = 1;
+		resolvedDepthWrite.dstArrayElement = 0;
+		resolvedDepthWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+		resolvedDepthWrite.descriptorCount = 1;
+		resolvedDepthWrite.pImageInfo = &resolvedDepthAttachmentDescriptor;
+
+
+
+		// List of input descriptor sets
+		std::vector<VkWriteDescriptorSet> setWrites = { resolvedColorWrite, resolvedDepthWrite };
+
+		// Second pass reads besides the inputs: the color again, around the pixel for the temporal resolve or scaled
+		// with the depth for dynamic resolution, then the velocity in place and last frame for the resolve
+		VkDescriptorImageInfo currentColorDescriptor = {};
+		currentColorDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		currentColorDescriptor.imageView = resolvedColorAttachmentDescriptor.imageView;
+		currentColorDescriptor.sampler = postSampler;
+
+		VkDescriptorImageInfo sceneDepthDescriptor = {};
+		sceneDepthDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		sceneDepthDescriptor.imageView = resolvedDepthAttachmentDescriptor.imageView;
+		sceneDepthDescriptor.sampler = postSampler;
+
+		VkDescriptorImageInfo velocityAttachmentDescriptor = {};
+		velocityAttachmentDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		velocityAttachmentDescriptor.imageView = velocityImageView;
+		velocityAttachmentDescriptor.sampler = VK_NULL_HANDLE;
+
+		VkDescriptorImageInfo historyDescriptor = {};
+		historyDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		historyDescriptor.imageView = historyImageView;
+		historyDescriptor.sampler = postSampler;
+
+		VkDescriptorBufferInfo postParamsBufferInfo = {};
+		postParamsBufferInfo.buffer = frameDataBuffer[i];
+		postParamsBufferInfo.offset = postParamsOffset;
+		postParamsBufferInfo.range = sizeof(PostParams);
+
+		VkWriteDescriptorSet postWrite = {};
+		postWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		postWrite.dstSet = inputDescriptorSets[i];
+		postWrite.dstArrayElement = 0;
+		postWrite.descriptorCount = 1;
+
+		if (temporalAATargets || dynamicResolutionTargets)
+		{
+			postWrite.dstBinding = 3;
+			postWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			postWrite.pImageInfo = &currentColorDescriptor;
+			setWrites.push_back(postWrite);
+
+			postWrite.dstBinding = 5;
+			postWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+			postWrite.pImageInfo = nullptr;
+			postWrite.pBufferInfo = &postParamsBufferInfo;
+			setWrites.push_back(postWrite);
+			postWrite.pBufferInfo = nullptr;
+		}
+
+		if (temporalAATargets)
+		{
+			postWrite.dstBinding = 2;
+			postWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			postWrite.pImageInfo = &velocityAttachmentDescriptor;
+			setWrites.push_back(postWrite);
+
+			postWrite.dstBinding = 4;
+			postWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			postWrite.pImageInfo = &historyDescriptor;
+			setWrites.push_back(postWrite);
+		}
+
+		if (dynamicResolutionTargets)
+		{
+			postWrite.dstBinding = 6;
+			postWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			postWrite.pImageInfo = &sceneDepthDescriptor;
+			setWrites.push_back(postWrite);
+		}
+		
+		// Update Descriptor sets
+		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+
+	}
+
+	for (size_t i = 0; i < swapChainImages.size(); i++)
+	{
+		std::array<VkDescriptorImageInfo, GBUFFER_ATTACHMENT_COUNT + 1> gBufferAttachmentDescriptors = {};
+		for (size_t j = 0; j < GBUFFER_ATTACHMENT_COUNT; j++)
+		{
+			gBufferAttachmentDescriptors[j].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			gBufferAttachmentDescriptors[j].imageView = gBufferImageView[j];
+			gBufferAttachmentDescriptors[j].sampler = VK_NULL_HANDLE;
+		}
+
+		// Multisampled depth, still bound read only as the depth attachment of the subpass
+		gBufferAttachmentDescriptors[GBUFFER_ATTACHMENT_COUNT].imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		gBufferAttachmentDescriptors[GBUFFER_ATTACHMENT_COUNT].imageView = depthBufferImageView;
+		gBufferAttachmentDescriptors[GBUFFER_ATTACHMENT_COUNT].sampler = VK_NULL_HANDLE;
+
+		std::array<VkWriteDescriptorSet, GBUFFER_ATTACHMENT_COUNT + 1> gBufferWrites = {};
+		for (size_t j = 0; j < gBufferWrites.size(); j++)
+		{
+			gBufferWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			gBufferWrites[j].dstSet = gBufferInputDescriptorSets[i];
+			gBufferWrites[j].dstBinding = static_cast<uint32_t>(j);
+			gBufferWrites[j].dstArrayElement = 0;
+			gBufferWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+			gBufferWrites[j].descriptorCount = 1;
+			gBufferWrites[j].pImageInfo = &gBufferAttachmentDescriptors[j];
+		}
+
+		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(gBufferWrites.size()), gBufferWrites.data(), 0, nullptr);
+	}
+}
+
+void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
+{
+	// Buffer stays mapped, plain copies into the fixed regions
+	uint8_t* frameDataMapped = static_cast<uint8_t*>(frameDataAllocators[imageIndex].getMemory());
+
+	UboViewProjection frameViewProjection = uboViewProjection;
+	frameViewProjection.viewProjection = uboViewProjection.projection * uboViewProjection.view;
+	frameViewProjection.previousViewProjection = previousViewProjection;
+	previousViewProjection = frameViewProjection.viewProjection;
+
+	// Part of the attachments drawn to, matches the viewports recorded with the current scale
+	VkExtent2D renderExtent = getRenderExtent();
+	PostParams postParams = {};
+	postParams.renderScale = glm::vec2(static_cast<float>(renderExtent.width) / static_cast<float>(swapChainExtent.width),
+		static_cast<float>(renderExtent.height) / static_cast<float>(swapChainExtent.height));
+
+	// Sub-pixel offset of this frame in the drawn projection only: the motion vectors and culling stay unjittered
+	if (temporalAATargets)
+	{
+		uint32_t jitterIndex = static_cast<uint32_t>(frameNumber % TAA_JITTER_COUNT) + 1;
+		float jitterX = halton(jitterIndex, 2) - 0.5f;
+		float jitterY = halton(jitterIndex, 3) - 0.5f;
+		frameViewProjection.projection[2][0] += jitterX * 2.0f / static_cast<float>(swapChainExtent.width);
+		frameViewProjection.projection[2][1] += jitterY * 2.0f / static_cast<float>(swapChainExtent.height);
+
+		postParams.historyWeight = taaHistoryValid ? TAA_HISTORY_WEIGHT : 0.0f;
+		taaHistoryValid = true;
+	}
+	memcpy(frameDataMapped + postParamsOffset, &postParams, sizeof(PostParams));
+
+	memcpy(frameDataMapped + vpUniformOffset, &frameViewProjection, sizeof(UboViewProjection));
+	memcpy(frameDataMapped + objectDataOffset, modelTransforms.data(), sizeof(Model) * modelTransforms.size());
+
+	// Lights and the froxel parameters of this frame's view, the light cull compute reads both
+	// Froxel tiles cover the part drawn to, fragment coordinates stay inside it
+	LightParams lightParams = createLightParams(uboViewProjection.view, uboViewProjection.projection,
+		CAMERA_NEAR_PLANE, CAMERA_FAR_PLANE, renderExtent, static_cast<uint32_t>(lights.size()));
+	memcpy(frameDataMapped + lightParamsOffset, &lightParams, sizeof(LightParams));
+	memcpy(frameDataMapped + lightDataOffset, lights.data(), sizeof(PointLight) * lights.size());
+
+	// Copy Model data uncomment when new Dynamic ubo required
+	/*for (size_t i = 0; i < meshList.size(); i++)
+	{
+		// Returns the mem address of the model and update
+		UboModel* thisModel = (UboModel*)((uint64_t)modelTransferSpace + (i * modelUniformAligment));
+		*thisModel = meshList[i].getModel();
+	}
+	vkMapMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[imageIndex], 0, modelUniformAligment * meshList.size(), 0, &data);
+	memcpy(data, modelTransferSpace, modelUniformAligment * meshList.size());
+	vkUnmapMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[imageIndex]);*/
+	
+}
+
+void VulkanRenderer::updateModelTransforms()
+{
+	// Last frame's world matrices, the motion vectors of temporal anti-aliasing reproject with them
+	if (temporalAATargets)
+	{
+		for (Model& object : modelTransforms)
+		{
+			object.previousModel = object.model;
+		}
+	}
+
+	// World matrices of the moved nodes and their subtrees first
+	transformHierarchy.update(modelTransforms.data());
+
+	// Normal matrices and camera position for every object in one batch, instead of per vertex inverse() in shader
+	computeNormalMatrices(modelTransforms.data(), modelTransforms.size(), camera.Position);
+}
+
+void VulkanRenderer::cullDraws(uint32_t imageIndex)
+{
+	uint8_t* frameDataMapped = static_cast<uint8_t*>(frameDataAllocators[imageIndex].getMemory());
+
+	glm::vec4 planes[6];
+	extractFrustumPlanes(uboViewProjection.projection * uboViewProjection.view, planes);
+
+	size_t drawCount = sceneStore.getRenderableCount();
+	frameStats.drawCount = static_cast<uint32_t>(drawCount);
+
+	// LOD errors are in model units, this turns error / distance into pixels as drawn (fewer with dynamic resolution)
+	float lodScale = std::abs(uboViewProjection.projection[1][1]) * 0.5f * static_cast<float>(getRenderExtent().height) / LOD_ERROR_PIXELS;
+
+	// Whichever path culls the opaque draws, transparent ones are ordered here
+	uint32_t transparentCount = sortTransparentDraws(frameDataMapped, planes, lodScale);
+
+	if (gpuCulling)
+	{
+		// The compute passes recorded in the command buffer do the work, they only need this frame's camera
+		const glm::mat4& projection = uboViewProjection.projection;
+		CullParams* cullParams = reinterpret_cast<CullParams*>(frameDataMapped + cullParamsOffset);
+		memcpy(cullParams->planes, planes, sizeof(planes));
+		cullParams->view = uboViewProjection.view;
+		cullParams->projection = glm::vec4(projection[0][0], projection[1][1], projection[2][2], projection[3][2]);
+		cullParams->cameraPosition = glm::vec4(camera.Position, lodScale);
+		cullParams->pyramidSize = glm::vec2(static_cast<float>(depthPyramidWidth), static_cast<float>(depthPyramidHeight));
+		cullParams->drawCount = static_cast<uint32_t>(drawCount);
+		cullParams->clusterCount = static_cast<uint32_t>(clusterList.size());
+
+		// Early and late counts of both lists written by the previous frame on this image, whose fence has been waited on
+		const uint32_t* cullStats = reinterpret_cast<const uint32_t*>(frameDataMapped + cullStatsOffset);
+		frameStats.visibleDraws = cullStats[0] + cullStats[1] + cullStats[2] + cullStats[3] + transparentCount;
+		return;
+	}
+
+	// World bounding spheres as SoA in the frame arena, padded for the 4 wide test
+	size_t paddedCount = (drawCount + 3) & ~static_cast<size_t>(3);
+	LinearAllocator& frameArena = frameArenas[currentFrame];
+	cullJobData.centerX = static_cast<float*>(frameArena.allocate(sizeof(float) * paddedCount, 16));
+	cullJobData.centerY = static_cast<float*>(frameArena.allocate(sizeof(float) * paddedCount, 16));
+	cullJobData.centerZ = static_cast<float*>(frameArena.allocate(sizeof(float) * paddedCount, 16));
+	cullJobData.radius = static_cast<float*>(frameArena.allocate(sizeof(float) * paddedCount, 16));
+	cullJobData.visible = frameArena.allocateArray<uint8_t>(paddedCount);
+	memcpy(cullJobData.planes, planes, sizeof(planes));
+
+	// Large scenes are split across the worker threads, small ones stay on this thread
+	cullJobData.sliceCount = static_cast<uint32_t>(std::min(static_cast<size_t>(cullThreadPool.getThreadCount()),
+		std::max(static_cast<size_t>(1), drawCount / MIN_DRAWS_PER_CULL_JOB)));
+	if (cullJobData.sliceCount == 1)
+	{
+		cullJob(this, 0);
+	}
+	else
+	{
+		cullThreadPool.dispatch(cullJobData.sliceCount, cullJob, this);
+	}
+
+	// Survivors go to the frame arena first, keyed on pipeline, texture and view depth
+	size_t maxCommandCount = drawCount + clusterList.size();
+	VkDrawIndexedIndirectCommand* commands = frameArena.allocateArray<VkDrawIndexedIndirectCommand>(maxCommandCount);
+	uint8_t* commandLists = frameArena.allocateArray<uint8_t>(maxCommandCount);
+	uint32_t commandCount = 0;
+	renderQueue.begin(&frameArena, maxCommandCount);
+
+	const glm::mat4& view = uboViewProjection.view;
+	const glm::vec4* boundingSpheres = sceneStore.getBoundingSpheres();
+	const uint32_t* transformIds = sceneStore.getTransformIds();
+	const uint32_t* materialIds = sceneStore.getMaterialIds();
+	const DrawMesh* meshes = sceneStore.getMeshes();
+	for (size_t i = 0; i < drawCount; i++)
+	{
+		if (!cullJobData.visible[i]) continue;
+
+		// Drawn by the transparent pass
+		const DrawMesh& draw = meshes[i];
+		if (draw.opacity < 1.0f) continue;
+
+		glm::vec3 center(cullJobData.centerX[i], cullJobData.centerY[i], cullJobData.centerZ[i]);
+		uint32_t lodIndex = selectLod(draw, boundingSpheres[i].w, center, cullJobData.radius[i], camera.Position, lodScale);
+
+		// Nearest point of the sphere along the view axis (camera looks down -z), its clusters share it
+		float depth = -(view[0][2] * center.x + view[1][2] * center.y + view[2][2] * center.z + view[3][2]) - cullJobData.radius[i];
+		uint64_t key = RenderQueue::makeKey(RENDER_BUCKET_OPAQUE, materialIds[i], depth);
+
+		// Full detail of a clustered mesh: one command per cluster that survives
+		if (lodIndex == 0 && draw.clusterCount > 0)
+		{
+			const Model& object = modelTransforms[transformIds[i]];
+			for (uint32_t c = draw.firstCluster; c < draw.firstCluster + draw.clusterCount; c++)
+			{
+				const MeshCluster& cluster = clusterList[c];
+				if (!isClusterVisible(cluster, object, planes, camera.Position)) continue;
+
+				VkDrawIndexedIndirectCommand& command = commands[commandCount];
+				command.indexCount = cluster.indexCount;
+				command.instanceCount = 1;
+				command.firstIndex = cluster.firstIndex;
+				command.vertexOffset = draw.vertexOffset;
+				command.firstInstance = static_cast<uint32_t>(i);
+				commandLists[commandCount] = static_cast<uint8_t>(draw.shortIndices);
+				renderQueue.push(key, commandCount++);
+			}
+			continue;
+		}
+
+		const MeshLod& lod = draw.lods[lodIndex];
+		VkDrawIndexedIndirectCommand& command = commands[commandCount];
+		command.indexCount = lod.indexCount;
+		command.instanceCount = 1;
+		command.firstIndex = lod.firstIndex;
+		command.vertexOffset = draw.vertexOffset;
+		command.firstInstance = static_cast<uint32_t>(i);
+		commandLists[commandCount] = static_cast<uint8_t>(draw.shortIndices);
+		renderQueue.push(key, commandCount++);
+	}
+
+	// Front to back for early depth rejection, draws of a texture next to each other
+	renderQueue.sort();
+
+	// Compact in key order into the same layout the compute pass writes: counts, then one command list per index type
+	uint32_t* drawCounts = reinterpret_cast<uint32_t*>(frameDataMapped + drawCommandOffset);
+	uint8_t* drawCommandLists = frameDataMapped + drawCommandOffset + DRAW_COUNT_SIZE;
+	memset(drawCounts, 0, sizeof(uint32_t) * DRAW_COMMAND_LIST_COUNT);
+
+	const uint32_t* sortedCommands = renderQueue.getItems();
+	for (size_t i = 0; i < renderQueue.size(); i++)
+	{
+		uint32_t commandIndex = sortedCommands[i];
+		uint32_t list = commandLists[commandIndex];
+		VkDrawIndexedIndirectCommand* drawCommands = reinterpret_cast<VkDrawIndexedIndirectCommand*>(
+			drawCommandLists + DRAW_COMMAND_LIST_SIZE * list);
+		drawCommands[drawCounts[list]++] = commands[commandIndex];
+	}
+
+	frameStats.visibleDraws = drawCounts[0] + drawCounts[1] + transparentCount;
+}
+
+void VulkanRenderer::updateShadows(uint32_t imageIndex)
+{
+	uint8_t* frameDataMapped = static_cast<uint8_t*>(frameDataAllocators[imageIndex].getMemory());
+
+	// World bounding spheres as SoA in the frame arena, the cascades track which ones moved
+	size_t drawCount = sceneStore.getRenderableCount();
+	size_t paddedCount = (drawCount + 3) & ~static_cast<size_t>(3);
+	LinearAllocator& frameArena = frameArenas[currentFrame];
+	float* centerX = static_cast<float*>(frameArena.allocate(sizeof(float) * paddedCount, 16));
+	float* centerY = static_cast<float*>(frameArena.allocate(sizeof(float) * paddedCount, 16));
+	float* centerZ = static_cast<float*>(frameArena.allocate(sizeof(float) * paddedCount, 16));
+	float* radius = static_cast<float*>(frameArena.allocate(sizeof(float) * paddedCount, 16));
+	uint8_t* visible = frameArena.allocateArray<uint8_t>(paddedCount);
+	computeWorldSpheres(sceneStore.getBoundingSpheres(), sceneStore.getTransformIds(), drawCount, modelTransforms.data(),
+		centerX, centerY, centerZ, radius);
+
+	float aspect = static_cast<float>(swapChainExtent.width) / static_cast<float>(swapChainExtent.height);
+	shadowCascades.update(camera, CAMERA_FOV_Y, aspect, centerX, centerY, centerZ, radius, drawCount);
+	frameStats.shadowCascades = shadowCascades.getRenderedCount();
+
+	const glm::vec4* boundingSpheres = sceneStore.getBoundingSpheres();
+	const DrawMesh* meshes = sceneStore.getMeshes();
+	VkDrawIndirectCommand* clearCommands = reinterpret_cast<VkDrawIndirectCommand*>(frameDataMapped + shadowClearOffset);
+	for (uint32_t cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		uint8_t* region = frameDataMapped + shadowCommandOffset + SHADOW_COMMAND_REGION_SIZE * cascade;
+		uint32_t* drawCounts = reinterpret_cast<uint32_t*>(region);
+		memset(drawCounts, 0, sizeof(uint32_t) * DRAW_COMMAND_LIST_COUNT);
+
+		// A cascade not rendered draws nothing and keeps what its layer holds
+		bool rendered = shadowCascades.isRendered(cascade);
+		clearCommands[cascade] = { 3, rendered ? 1u : 0u, 0, 0 };
+		if (!rendered) continue;
+
+		// Opaque casters in the cascade box or between it and the light, whole draws at the coarsest LOD
+		// whose error stays under a shadow texel (no clusters, the light sees them from any side)
+		cullSpheres(centerX, centerY, centerZ, radius, paddedCount, shadowCascades.getCasterPlanes(cascade), visible);
+		float texelSize = shadowCascades.getTexelSize(cascade);
+		for (size_t i = 0; i < drawCount; i++)
+		{
+			const DrawMesh& draw = meshes[i];
+			if (!visible[i] || draw.opacity < 1.0f) continue;
+
+			float scale = boundingSpheres[i].w > 0.0f ? radius[i] / boundingSpheres[i].w : 1.0f;
+			uint32_t lodIndex = 0;
+			while (lodIndex + 1 < draw.lodCount && draw.lods[lodIndex + 1].error * scale <= texelSize)
+			{
+				lodIndex++;
+			}
+
+			uint32_t list = draw.shortIndices;
+			VkDrawIndexedIndirectCommand* drawCommands = reinterpret_cast<VkDrawIndexedIndirectCommand*>(
+				region + DRAW_COUNT_SIZE + SHADOW_COMMAND_LIST_SIZE * list);
+			VkDrawIndexedIndirectCommand& command = drawCommands[drawCounts[list]++];
+			command.indexCount = draw.lods[lodIndex].indexCount;
+			command.instanceCount = 1;
+			command.firstIndex = draw.lods[lodIndex].firstIndex;
+			command.vertexOffset = draw.vertexOffset;
+			command.firstInstance = static_cast<uint32_t>(i);
+		}
+	}
+
+	memcpy(frameDataMapped + shadowParamsOffset, &shadowCascades.getParams(), sizeof(ShadowParams));
+}
+
+bool VulkanRenderer::readGpuFrameTime(uint32_t imageIndex)
+{
+	if (timestampPeriod == 0.0f || !timestampsSubmitted[imageIndex]) return false;
+
+	// The fence wait above means the results are there, no need to wait on them
+	std::array<uint64_t, 2> timestamps = {};
+	VkResult result = vkGetQueryPoolResults(mainDevice.logicalDevice, timestampQueryPool, imageIndex * 2, 2,
+		sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (result != VK_SUCCESS) return false;
+
+	frameStats.gpuFrameTime = static_cast<float>((timestamps[1] - timestamps[0]) & timestampMask) * timestampPeriod / 1000000.0f;
+	msaaFrameTimeSum += frameStats.gpuFrameTime;
+	msaaFrameCount++;
+	return true;
+}
+
+void VulkanRenderer::updateMsaaSamples()
+{
+	VkSampleCountFlagBits samples = chooseMsaaSamples();
+	bool dynamicResolutionChanged = (dynamicResolution && !temporalAA) != dynamicResolutionTargets;
+	if (samples != msaaSamples || temporalAA != temporalAATargets || dynamicResolutionChanged)
+	{
+		recreateMultisampleTargets(samples);
+	}
+	frameStats.msaaSamples = static_cast<uint32_t>(msaaSamples);
+}
+
+void VulkanRenderer::updateRenderScale()
+{
+	if (!dynamicResolutionTargets) return;
+
+	// Frames recorded before the last change still measure the old scale
+	if (renderScaleSettleFrames > 0)
+	{
+		renderScaleSettleFrames--;
+		return;
+	}
+
+	float frameTime = frameStats.gpuFrameTime;
+	float newScale = renderScale;
+	if (frameTime > DYNAMIC_RESOLUTION_TARGET_FRAME_TIME)
+	{
+		// Down at once so a spike costs a frame or two, to the step under the scale whose pixel count fits the budget
+		float fittingScale = renderScale * std::sqrt(DYNAMIC_RESOLUTION_TARGET_FRAME_TIME / frameTime);
+		newScale = std::floor(fittingScale / DYNAMIC_RESOLUTION_STEP) * DYNAMIC_RESOLUTION_STEP;
+		renderScaleUpgradeFrames = 0;
+	}
+	else if (frameTime < DYNAMIC_RESOLUTION_TARGET_FRAME_TIME * DYNAMIC_RESOLUTION_UPGRADE_RATIO)
+	{
+		// Up one step only after a steady run under the budget, the band in between holds the scale
+		if (++renderScaleUpgradeFrames >= DYNAMIC_RESOLUTION_UPGRADE_FRAMES)
+		{
+			newScale = renderScale + DYNAMIC_RESOLUTION_STEP;
+			renderScaleUpgradeFrames = 0;
+		}
+	}
+	else
+	{
+		renderScaleUpgradeFrames = 0;
+	}
+
+	newScale = std::clamp(newScale, DYNAMIC_RESOLUTION_MIN_SCALE, 1.0f);
+	if (std::abs(newScale - renderScale) < DYNAMIC_RESOLUTION_STEP * 0.5f) return;
+
+	// Viewports and the pyramid source size are recorded, every image records again
+	renderScale = newScale;
+	renderScaleSettleFrames = static_cast<uint32_t>(swapChainImages.size());
+	markSceneDirty();
+}
+
+VkExtent2D VulkanRenderer::getRenderExtent()
+{
+	VkExtent2D extent = {};
+	extent.width = std::max(1u, static_cast<uint32_t>(static_cast<float>(swapChainExtent.width) * renderScale + 0.5f));
+	extent.height = std::max(1u, static_cast<uint32_t>(static_cast<float>(swapChainExtent.height) * renderScale + 0.5f));
+	return extent;
+}
+
+uint32_t VulkanRenderer::sortTransparentDraws(uint8_t* frameDataMapped, const glm::vec4 planes[6], float lodScale)
+{
+	uint32_t* drawCount = reinterpret_cast<uint32_t*>(frameDataMapped + transparentCommandOffset);
+	VkDrawIndexedIndirectCommand* drawCommands = reinterpret_cast<VkDrawIndexedIndirectCommand*>(
+		frameDataMapped + transparentCommandOffset + DRAW_COUNT_SIZE);
+	*drawCount = 0;
+	if (transparentRows.empty()) return 0;
+
+	const glm::mat4& view = uboViewProjection.view;
+	const glm::vec4* boundingSpheres = sceneStore.getBoundingSpheres();
+	const uint32_t* transformIds = sceneStore.getTransformIds();
+	const DrawMesh* meshes = sceneStore.getMeshes();
+
+	// Few rows, world spheres computed one by one, commands wait in the frame arena until sorted
+	LinearAllocator& frameArena = frameArenas[currentFrame];
+	VkDrawIndexedIndirectCommand* commands = frameArena.allocateArray<VkDrawIndexedIndirectCommand>(transparentRows.size());
+	uint32_t commandCount = 0;
+	renderQueue.begin(&frameArena, transparentRows.size());
+	for (uint32_t row : transparentRows)
+	{
+		const glm::mat4& model = modelTransforms[transformIds[row]].model;
+		glm::vec3 center = glm::vec3(model * glm::vec4(glm::vec3(boundingSpheres[row]), 1.0f));
+		float scale = std::sqrt(std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+			std::max(glm::dot(glm::vec3(model[1]), glm::vec3(model[1])), glm::dot(glm::vec3(model[2]), glm::vec3(model[2])))));
+		float radius = boundingSpheres[row].w * scale;
+
+		bool visible = true;
+		for (int i = 0; i < 6; i++)
+		{
+			visible = visible && glm::dot(glm::vec3(planes[i]), center) + planes[i].w >= -radius;
+		}
+		if (!visible) continue;
+
+		// One command per draw (no clusters), the LOD chosen like the opaque draws
+		const DrawMesh& draw = meshes[row];
+		const MeshLod& lod = draw.lods[selectLod(draw, boundingSpheres[row].w, center, radius, camera.Position, lodScale)];
+		VkDrawIndexedIndirectCommand& command = commands[commandCount];
+		command.indexCount = lod.indexCount;
+		command.instanceCount = 1;
+		command.firstIndex = lod.firstIndex;
+		command.vertexOffset = draw.vertexOffset;
+		command.firstInstance = row;
+
+		// Centre depth along the view axis, furthest first so each draw blends over what is behind it
+		float depth = -(view[0][2] * center.x + view[1][2] * center.y + view[2][2] * center.z + view[3][2]);
+		renderQueue.push(RenderQueue::makeBackToFrontKey(RENDER_BUCKET_TRANSPARENT, depth), commandCount++);
+	}
+	renderQueue.sort();
+
+	const uint32_t* sortedCommands = renderQueue.getItems();
+	for (size_t i = 0; i < renderQueue.size(); i++)
+	{
+		drawCommands[i] = commands[sortedCommands[i]];
+	}
+	*drawCount = static_cast<uint32_t>(renderQueue.size());
+
+	return *drawCount;
+}
+
+void VulkanRenderer::updateDrawData(uint32_t imageIndex)
+{
+	// Only changes with the scene structure, written when this image's command buffer is re-recorded
+	uint8_t* frameDataMapped = static_cast<uint8_t*>(frameDataAllocators[imageIndex].getMemory());
+	sceneStore.writeDrawItems(reinterpret_cast<DrawItem*>(frameDataMapped + drawDataOffset));
+	sceneStore.writeClusterDraws(reinterpret_cast<uint32_t*>(frameDataMapped + clusterDrawOffset), clusterList.size());
+
+	// Same rows for every image until the scene changes again
+	transparentRows.clear();
+	const DrawMesh* meshes = sceneStore.getMeshes();
+	for (size_t i = 0; i < sceneStore.getRenderableCount(); i++)
+	{
+		if (meshes[i].opacity < 1.0f)
+		{
+			transparentRows.push_back(static_cast<uint32_t>(i));
+		}
+	}
+}
+
+void VulkanRenderer::setGpuCulling(bool enabled)
+{
+	if (gpuCulling == enabled) return;
+
+	// Draw commands come from a different buffer, every command buffer needs recording again
+	gpuCulling = enabled;
+	markSceneDirty();
+}
+
+void VulkanRenderer::setDeferredShading(bool enabled)
+{
+	if (deferredShading == enabled) return;
+
+	// Other render pass and pipelines, every command buffer needs recording again
+	deferredShading = enabled;
+	markSceneDirty();
+}
+
+void VulkanRenderer::setMsaaMode(MsaaMode mode)
+{
+	// MSAA_AUTO measures again from the current count
+	msaaMode = mode;
+	msaaFrameTimeSum = 0.0f;
+	msaaFrameCount = 0;
+}
+
+void VulkanRenderer::setTemporalAntiAliasing(bool enabled)
+{
+	// MSAA_AUTO measures again once it is back in charge
+	temporalAA = enabled;
+	msaaFrameTimeSum = 0.0f;
+	msaaFrameCount = 0;
+}
+
+void VulkanRenderer::setDynamicResolution(bool enabled)
+{
+	dynamicResolution = enabled;
+}
+
+void VulkanRenderer::markSceneDirty()
+{
+	std::fill(commandBufferDirty.begin(), commandBufferDirty.end(), true);
+}
+
+void VulkanRenderer::recordCommands(uint32_t currentImage)
+{
+	// Information about how to begin each command buffer
+	VkCommandBufferBeginInfo bufferBeginInfo = {};
+	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	// Information about how to begin a renderpass
+	VkRenderPassBeginInfo renderPassBeginInfo = {};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = renderPass;
+	// Start point in pixels
+	renderPassBeginInfo.renderArea.offset = { 0,0 };
+	renderPassBeginInfo.renderArea.extent = swapChainExtent;
+
+	// Set up the flags for the render pass
+	VkSubpassBeginInfo subpassBeginInfo = {};
+	subpassBeginInfo.sType = VK_STRUCTURE_TYPE_SUBPASS_BEGIN_INFO;
+	subpassBeginInfo.contents = VK_SUBPASS_CONTENTS_INLINE;
+
+	VkSubpassEndInfo subpassEndInfo = {};
+	subpassEndInfo.sType = VK_STRUCTURE_TYPE_SUBPASS_END_INFO;
+	subpassEndInfo.pNext = NULL;
+
+	std::array<VkClearValue, 5 + GBUFFER_ATTACHMENT_COUNT + 2> clearValues = {};
+	clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };		//swapChain Image
+	clearValues[1].color = { 0.1f, 0.1f, 0.1f, 1.0f };		// Color buffer 
+	clearValues[2].depthStencil.depth = 1.0f;				// Depth Stencil
+	clearValues[3].color = { 0.0f, 0.0f, 0.0f, 1.0f };		// Resolved Color
+	clearValues[4].depthStencil.depth = 1.0f;				// Resolved Depth Stencil
+	for (uint32_t i = 5; i < clearValues.size(); i++)
+	{
+		clearValues[i].color = { 0.0f, 0.0f, 0.0f, 0.0f };	// G-buffer (deferred pass only), then velocity and temporal resolve
+	}
+
+	// The forward pass has no G-buffer attachments, the temporal ones directly follow the resolved depth there
+	renderPassBeginInfo.pClearValues = clearValues.data();
+	renderPassBeginInfo.clearValueCount = (deferredShading ? 5 + GBUFFER_ATTACHMENT_COUNT : 5) + (temporalAATargets ? 2 : 0);
+
+	if (deferredShading)
+	{
+		renderPassBeginInfo.renderPass = deferredRenderPass;
+		renderPassBeginInfo.framebuffer = deferredFramebuffers[currentImage];
+	}
+	else
+	{
+		renderPassBeginInfo.framebuffer = swapChainFramebuffers[currentImage];
+	}
+
+	// Start recording commands to command buffer
+	VkResult result = vkBeginCommandBuffer(commandBuffers[currentImage], &bufferBeginInfo);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to start recording a Command Buffer");
+	}
+
+	// GPU frame time: whole command buffer, read back once this image's fence has signalled
+	if (timestampQueryPool != VK_NULL_HANDLE)
+	{
+		vkCmdResetQueryPool(commandBuffers[currentImage], timestampQueryPool, currentImage * 2, 2);
+		vkCmdWriteTimestamp(commandBuffers[currentImage], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, currentImage * 2);
+	}
+
+	// Scene draws of both passes go to the dynamic resolution part of the attachments, the second pass to all of it
+	VkExtent2D renderExtent = getRenderExtent();
+
+	// Early render pass: draws visible last frame (GPU) or every CPU culled draw, both clear color and depth
+	VkRenderPassBeginInfo earlyRenderPassBeginInfo = {};
+	earlyRenderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	earlyRenderPassBeginInfo.renderPass = earlyRenderPass;
+	earlyRenderPassBeginInfo.renderArea.offset = { 0,0 };
+	earlyRenderPassBeginInfo.renderArea.extent = renderExtent;
+	earlyRenderPassBeginInfo.framebuffer = earlyFramebuffers[currentImage];
+
+	std::array<VkClearValue, 4> earlyClearValues = {};
+	earlyClearValues[0].color = clearValues[1].color;
+	earlyClearValues[1].depthStencil.depth = 1.0f;
+	earlyClearValues[2].depthStencil.depth = 1.0f;
+	earlyClearValues[3].color = { 0.0f, 0.0f, 0.0f, 0.0f };	// No motion where nothing is drawn
+	earlyRenderPassBeginInfo.pClearValues = earlyClearValues.data();
+	earlyRenderPassBeginInfo.clearValueCount = static_cast<uint32_t>(earlyClearValues.size()) - (temporalAATargets ? 0 : 1);
+
+	// Light lists of every froxel, read by the fragment shader of both passes
+	recordLightCull(commandBuffers[currentImage], currentImage);
+
+	// Sun shadow cascades, read by the lighting of both passes
+	recordShadowPasses(commandBuffers[currentImage], currentImage);
+
+	if (gpuCulling)
+	{
+		recordCullCommands(commandBuffers[currentImage], currentImage, CULL_PHASE_EARLY);
+	}
+
+	SceneBindState bindState = { VK_NULL_HANDLE, false, false, -1 };
+
+	// Deferred shading only needs the depth of the early pass, for the pyramid and to reject hidden G-buffer writes
+	VkPipeline earlyPipeline = deferredShading ? earlyDepthPipeline : earlyGraphicsPipeline;
+
+	// Where the draws of the early pass are, the deferred G-buffer subpass draws them again
+	VkBuffer earlyCommandBuffer = gpuCulling ? cullOutputBuffer[currentImage] : frameDataBuffer[currentImage];
+	VkDeviceSize earlyCommandBase = gpuCulling ? 0 : drawCommandOffset;
+
+	vkCmdBeginRenderPass2(commandBuffers[currentImage], &earlyRenderPassBeginInfo, &subpassBeginInfo);
+
+		recordViewport(commandBuffers[currentImage], renderExtent);
+		recordSceneDraws(commandBuffers[currentImage], currentImage, earlyPipeline, earlyCommandBuffer, earlyCommandBase, &bindState);
+
+	vkCmdEndRenderPass2(commandBuffers[currentImage], &subpassEndInfo);
+
+	// Pyramid from what the early pass drew, everything else is tested against it
+	if (gpuCulling)
+	{
+		recordDepthPyramid(commandBuffers[currentImage], currentImage);
+		recordCullCommands(commandBuffers[currentImage], currentImage, CULL_PHASE_LATE);
+	}
+	
+	// Format the render pass as a loop for clarity 
+	vkCmdBeginRenderPass2(commandBuffers[currentImage], &renderPassBeginInfo, &subpassBeginInfo);
+
+		recordViewport(commandBuffers[currentImage], renderExtent);
+
+		if (deferredShading)
+		{
+			// G-buffer of the early draws over their own depth, then the late ones
+			recordSceneDraws(commandBuffers[currentImage], currentImage, gBufferPipeline, earlyCommandBuffer, earlyCommandBase, &bindState);
+			if (gpuCulling)
+			{
+				recordSceneDraws(commandBuffers[currentImage], currentImage, gBufferPipeline, cullOutputBuffer[currentImage], cullLateOutputOffset, &bindState);
+			}
+
+			// Lighting subpass: once per pixel (per sample with MSAA) from the G-buffer and the froxel light lists
+			vkCmdNextSubpass2(commandBuffers[currentImage], &subpassBeginInfo, &subpassEndInfo);
+
+			std::array<VkDescriptorSet, 2> lightingSets = { descriptorSets[currentImage], gBufferInputDescriptorSets[currentImage] };
+			vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, lightingPipeline);
+			vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, lightingPipelineLayout,
+				0, static_cast<uint32_t>(lightingSets.size()), lightingSets.data(), 0, nullptr);
+			vkCmdDraw(commandBuffers[currentImage], 3, 1, 0, 0);
+			bindState.pipeline = lightingPipeline;
+			bindState.sceneSetsBound = false;
+
+			// Transparent subpass, forward shaded over the lit color then resolved
+			vkCmdNextSubpass2(commandBuffers[currentImage], &subpassBeginInfo, &subpassEndInfo);
+
+			recordTransparentDraws(commandBuffers[currentImage], currentImage, deferredTransparentPipeline, &bindState);
+		}
+		else
+		{
+			// Late draws: visible now but not last frame
+			if (gpuCulling)
+			{
+				recordSceneDraws(commandBuffers[currentImage], currentImage, graphicsPipeline, cullOutputBuffer[currentImage], cullLateOutputOffset, &bindState);
+			}
+
+			// Blended over every opaque draw, back to front
+			recordTransparentDraws(commandBuffers[currentImage], currentImage, transparentPipeline, &bindState);
+		}
+
+		// Start second subpass, upscaling to the whole swapchain image with dynamic resolution
+		vkCmdNextSubpass2(commandBuffers[currentImage], &subpassBeginInfo, &subpassEndInfo);
+
+		recordViewport(commandBuffers[currentImage], swapChainExtent);
+
+		VkPipeline postPipeline = deferredShading ? deferredSecondPipeline : secondPipeline;
+		vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, postPipeline);
+		vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipelineLayout,
+			0, 1, &inputDescriptorSets[currentImage], 0, nullptr);
+		vkCmdDraw(commandBuffers[currentImage], 3, 1, 0, 0);
+		bindState.pipeline = postPipeline;
+		bindState.sceneSetsBound = false;
+
+
+	vkCmdEndRenderPass2(commandBuffers[currentImage], &subpassEndInfo);
+
+	if (temporalAATargets)
+	{
+		recordHistoryCopy(commandBuffers[currentImage]);
+	}
+
+	if (gpuCulling)
+	{
+		// Early and late counts back to the frame data buffer, read on the CPU next time this image is used
+		std::array<VkBufferCopy, 2> countCopies = {};
+		countCopies[0].srcOffset = 0;
+		countCopies[0].dstOffset = cullStatsOffset;
+		countCopies[0].size = sizeof(uint32_t) * DRAW_COMMAND_LIST_COUNT;
+		countCopies[1].srcOffset = cullLateOutputOffset;
+		countCopies[1].dstOffset = cullStatsOffset + sizeof(uint32_t) * DRAW_COMMAND_LIST_COUNT;
+		countCopies[1].size = sizeof(uint32_t) * DRAW_COMMAND_LIST_COUNT;
+		vkCmdCopyBuffer(commandBuffers[currentImage], cullOutputBuffer[currentImage], frameDataBuffer[currentImage],
+			static_cast<uint32_t>(countCopies.size()), countCopies.data());
+
+		VkMemoryBarrier readbackBarrier = {};
+		readbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(commandBuffers[currentImage], VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+			0, 1, &readbackBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	if (timestampQueryPool != VK_NULL_HANDLE)
+	{
+		vkCmdWriteTimestamp(commandBuffers[currentImage], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, currentImage * 2 + 1);
+	}
+
+	// Stop recording
+	result = vkEndCommandBuffer(commandBuffers[currentImage]);
+	if (result != VK_SUCCESS)
+	{
+		throw std::runtime_error("Failed to stop recording a Command Buffer");
+	}
+}
+
+void VulkanRenderer::recordSceneDraws(VkCommandBuffer commandBuffer, uint32_t currentImage, VkPipeline pipeline,
+	VkBuffer drawCommandBuffer, VkDeviceSize drawCommandBase, SceneBindState* bindState)
+{
+	if (sceneStore.getRenderableCount() == 0) return;
 
-		// Resolved Color Attachment descriptor write
-		VkWriteDescriptorSet resolvedColorWrite = {};
-		resolvedColorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		resolvedColorWrite.dstSet = inputDescriptorSets[i];
-		resolvedColorWrite.dstBinding = 0;
-		resolvedColorWrite.dstArrayElement = 0;
-		resolvedColorWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-		resolvedColorWrite.descriptorCount = 1;
-		resolvedColorWrite.pImageInfo = &resolvedColorAttachmentDescriptor;
+	bindSceneState(commandBuffer, currentImage, pipeline, bindState);
 
-		// Resolved Color attachment Descriptor
-		VkDescriptorImageInfo resolvedDepthAttachmentDescriptor = {};
-		resolvedDepthAttachmentDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		resolvedDepthAttachmentDescriptor.imageView = resolvedDepthBufferImageView[i];
-		resolvedDepthAttachmentDescriptor.sampler = VK_NULL_HANDLE;
+	// One call per index type, each list's draw count is read from the start of the command region
+	// Starts with the list whose index buffer is still bound from the previous call
+	std::array<VkIndexType, DRAW_COMMAND_LIST_COUNT> listIndexTypes = { VK_INDEX_TYPE_UINT32, VK_INDEX_TYPE_UINT16 };
+	uint32_t firstList = bindState->indexList >= 0 ? static_cast<uint32_t>(bindState->indexList) : 0;
+	for (uint32_t i = 0; i < DRAW_COMMAND_LIST_COUNT; i++)
+	{
+		uint32_t list = (firstList + i) % DRAW_COMMAND_LIST_COUNT;
+		if (bindState->indexList != static_cast<int32_t>(list))
+		{
+			vkCmdBindIndexBuffer(commandBuffer, geometryPool.getIndexBuffer(listIndexTypes[list]), 0, listIndexTypes[list]);
+			bindState->indexList = static_cast<int32_t>(list);
+		}
+		vkCmdDrawIndexedIndirectCount(commandBuffer,
+			drawCommandBuffer, drawCommandBase + DRAW_COUNT_SIZE + DRAW_COMMAND_LIST_SIZE * list,
+			drawCommandBuffer, drawCommandBase + sizeof(uint32_t) * list,
+			static_cast<uint32_t>(sceneStore.getRenderableCount() + clusterList.size()), sizeof(VkDrawIndexedIndirectCommand));
+	}
+}
 
-		// Resolved Color Attachment descriptor write
-		VkWriteDescriptorSet resolvedDepthWrite = {};
-		resolvedDepthWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		resolvedDepthWrite.dstSet = inputDescriptorSets[i];
-		resolvedDepthWrite.dstBinding = 1;
-		resolvedDepthWrite.dstArrayElement = 0;
-		resolvedDepthWrite.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-		resolvedDepthWrite.descriptorCount = 1;
-		resolvedDepthWrite.pImageInfo = &resolvedDepthAttachmentDescriptor;
+void VulkanRenderer::recordTransparentDraws(VkCommandBuffer commandBuffer, uint32_t currentImage, VkPipeline pipeline,
+	SceneBindState* bindState)
+{
+	if (transparentRows.empty()) return;
 
+	bindSceneState(commandBuffer, currentImage, pipeline, bindState);
 
+	// Single list so the sorted order holds across every draw, transparent meshes always have 32 bit indices
+	if (bindState->indexList != 0)
+	{
+		vkCmdBindIndexBuffer(commandBuffer, geometryPool.getIndexBuffer(VK_INDEX_TYPE_UINT32), 0, VK_INDEX_TYPE_UINT32);
+		bindState->indexList = 0;
+	}
+	vkCmdDrawIndexedIndirectCount(commandBuffer,
+		frameDataBuffer[currentImage], transparentCommandOffset + DRAW_COUNT_SIZE,
+		frameDataBuffer[currentImage], transparentCommandOffset,
+		static_cast<uint32_t>(transparentRows.size()), sizeof(VkDrawIndexedIndirectCommand));
+}
 
-		// List of input descriptor sets
-		std::vector<VkWriteDescriptorSet> setWrites = { resolvedColorWrite, resolvedDepthWrite };
-		
-		// Update Descriptor sets
-		vkUpdateDescriptorSets(mainDevice.logicalDevice, static_cast<uint32_t>(setWrites.size()), setWrites.data(), 0, nullptr);
+void VulkanRenderer::bindSceneState(VkCommandBuffer commandBuffer, uint32_t currentImage, VkPipeline pipeline, SceneBindState* bindState)
+{
+	// Binds pipeline to be used in RenderPAss
+	if (bindState->pipeline != pipeline)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		bindState->pipeline = pipeline;
+	}
+
+	// Frame data and the texture array are shared by every draw
+	if (!bindState->sceneSetsBound)
+	{
+		std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], textureDescriptorSet };
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
+			0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+		bindState->sceneSetsBound = true;
+	}
 
+	// Every mesh lives in the geometry pool, bind it once
+	if (!bindState->vertexBufferBound)
+	{
+		VkBuffer vertexBuffers[] = { geometryPool.getVertexBuffer() };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		bindState->vertexBufferBound = true;
 	}
 }
 
-void VulkanRenderer::updateUniformBuffers(uint32_t imageIndex)
+void VulkanRenderer::recordCullCommands(VkCommandBuffer commandBuffer, uint32_t currentImage, CullPhase phase)
 {
-	// Copy VP data
-	void* data;
-	vkMapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex], 0, sizeof(UboViewProjection), 0, &data);
-	memcpy(data, &uboViewProjection, sizeof(UboViewProjection));
-	vkUnmapMemory(mainDevice.logicalDevice, vpUniformBufferMemory[imageIndex]);
+	if (phase == CULL_PHASE_EARLY)
+	{
+		// Reset the early and late draw counts, commands past them are never read
+		vkCmdFillBuffer(commandBuffer, cullOutputBuffer[currentImage], 0, sizeof(uint32_t) * DRAW_COMMAND_LIST_COUNT, 0);
+		vkCmdFillBuffer(commandBuffer, cullOutputBuffer[currentImage], cullLateOutputOffset, sizeof(uint32_t) * DRAW_COMMAND_LIST_COUNT, 0);
+
+		// Also orders against the previous frame's visibility and pyramid writes, earlier in the queue
+		VkMemoryBarrier resetBarrier = {};
+		resetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &resetBarrier, 0, nullptr, 0, nullptr);
+	}
 
-	// Copy Model data uncomment when new Dynamic ubo required
-	/*for (size_t i = 0; i < meshList.size(); i++)
+	// One invocation per draw then one per cluster, survivors are appended to the phase's command list
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout,
+		0, 1, &cullDescriptorSets[currentImage], 0, nullptr);
+	uint32_t phaseValue = phase;
+	vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &phaseValue);
+
+	uint32_t invocationCount = static_cast<uint32_t>(sceneStore.getRenderableCount() + clusterList.size());
+	uint32_t groupCount = (invocationCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+	if (groupCount > 0)
 	{
-		// Returns the mem address of the model and update
-		UboModel* thisModel = (UboModel*)((uint64_t)modelTransferSpace + (i * modelUniformAligment));
-		*thisModel = meshList[i].getModel();
+		vkCmdDispatch(commandBuffer, groupCount, 1, 1);
 	}
-	vkMapMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[imageIndex], 0, modelUniformAligment * meshList.size(), 0, &data);
-	memcpy(data, modelTransferSpace, modelUniformAligment * meshList.size());
-	vkUnmapMemory(mainDevice.logicalDevice, modelDynUniformBufferMemory[imageIndex]);*/
-	
+
+	// Commands and count are read by the indirect draw and the count readback
+	VkMemoryBarrier cullBarrier = {};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
 }
 
-void VulkanRenderer::recordCommands(uint32_t currentImage)
+void VulkanRenderer::recordDepthPyramid(VkCommandBuffer commandBuffer, uint32_t currentImage)
 {
-	// Information about how to begin each command buffer
-	VkCommandBufferBeginInfo bufferBeginInfo = {};
-	bufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hizPipeline);
 
-	// Information about how to begin a renderpass
-	VkRenderPassBeginInfo renderPassBeginInfo = {};
-	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassBeginInfo.renderPass = renderPass;
-	// Start point in pixels
-	renderPassBeginInfo.renderArea.offset = { 0,0 };
-	renderPassBeginInfo.renderArea.extent = swapChainExtent;
+	// Each level is written after the one above it is complete
+	VkMemoryBarrier levelBarrier = {};
+	levelBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	// Level 0 covers the part of the depth drawn to, so the pyramid maps the screen the way the full depth would
+	VkExtent2D renderExtent = getRenderExtent();
+	std::array<int32_t, 2> srcSize = { static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height) };
+
+	for (uint32_t level = 0; level < depthPyramidLevels; level++)
+	{
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hizPipelineLayout,
+			0, 1, &hizDescriptorSets[currentImage * depthPyramidLevels + level], 0, nullptr);
+
+		uint32_t levelWidth = std::max(1u, depthPyramidWidth >> level);
+		uint32_t levelHeight = std::max(1u, depthPyramidHeight >> level);
+		vkCmdPushConstants(commandBuffer, hizPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(srcSize), srcSize.data());
+		srcSize = { static_cast<int32_t>(levelWidth), static_cast<int32_t>(levelHeight) };
+		vkCmdDispatch(commandBuffer, (levelWidth + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (levelHeight + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &levelBarrier, 0, nullptr, 0, nullptr);
+	}
+}
+
+void VulkanRenderer::recordShadowPasses(VkCommandBuffer commandBuffer, uint32_t currentImage)
+{
+	VkRenderPassBeginInfo shadowRenderPassBeginInfo = {};
+	shadowRenderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	shadowRenderPassBeginInfo.renderPass = shadowRenderPass;
+	shadowRenderPassBeginInfo.renderArea.offset = { 0, 0 };
+	shadowRenderPassBeginInfo.renderArea.extent = { SHADOW_MAP_SIZE, SHADOW_MAP_SIZE };
 
-	// Set up the flags for the render pass
 	VkSubpassBeginInfo subpassBeginInfo = {};
 	subpassBeginInfo.sType = VK_STRUCTURE_TYPE_SUBPASS_BEGIN_INFO;
 	subpassBeginInfo.contents = VK_SUBPASS_CONTENTS_INLINE;
 
 	VkSubpassEndInfo subpassEndInfo = {};
 	subpassEndInfo.sType = VK_STRUCTURE_TYPE_SUBPASS_END_INFO;
-	subpassEndInfo.pNext = NULL;
 
-	std::array<VkClearValue, 5> clearValues = {};
-	clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };		//swapChain Image
-	clearValues[1].color = { 0.1f, 0.1f, 0.1f, 1.0f };		// Color buffer 
-	clearValues[2].depthStencil.depth = 1.0f;				// Depth Stencil
-	clearValues[3].color = { 0.0f, 0.0f, 0.0f, 1.0f };		// Resolved Color
-	clearValues[4].depthStencil.depth = 1.0f;				// Resolved Depth Stencil
+	std::array<VkIndexType, DRAW_COMMAND_LIST_COUNT> listIndexTypes = { VK_INDEX_TYPE_UINT32, VK_INDEX_TYPE_UINT16 };
+	VkBuffer vertexBuffers[] = { geometryPool.getVertexBuffer() };
+	VkDeviceSize offsets[] = { 0 };
 
+	// Every cascade every frame: updateShadows zeroes the clear and the draw counts of a cascade kept from cache
+	for (uint32_t cascade = 0; cascade < SHADOW_CASCADE_COUNT; cascade++)
+	{
+		VkDeviceSize commandBase = shadowCommandOffset + SHADOW_COMMAND_REGION_SIZE * cascade;
+		shadowRenderPassBeginInfo.framebuffer = shadowFramebuffers[cascade];
 
-	renderPassBeginInfo.pClearValues = clearValues.data();
-	renderPassBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+		vkCmdBeginRenderPass2(commandBuffer, &shadowRenderPassBeginInfo, &subpassBeginInfo);
 
-	renderPassBeginInfo.framebuffer = swapChainFramebuffers[currentImage];
-	// Start recording commands to command buffer
-	VkResult result = vkBeginCommandBuffer(commandBuffers[currentImage], &bufferBeginInfo);
-	if (result != VK_SUCCESS)
-	{
-		throw std::runtime_error("Failed to start recording a Command Buffer");
-	}
-	
-	// Format the render pass as a loop for clarity 
-	vkCmdBeginRenderPass2(commandBuffers[currentImage], &renderPassBeginInfo, &subpassBeginInfo);
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowClearPipeline);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipelineLayout,
+				0, 1, &descriptorSets[currentImage], 0, nullptr);
+			vkCmdPushConstants(commandBuffer, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &cascade);
+			vkCmdDrawIndirect(commandBuffer, frameDataBuffer[currentImage], shadowClearOffset + sizeof(VkDrawIndirectCommand) * cascade,
+				1, sizeof(VkDrawIndirectCommand));
 
-		// Binds pipeline to be used in RenderPAss
-		vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-	
-		for (size_t j = 0; j < modelList.size(); j++)
-		{
-			MeshModel thisModel = modelList[j];
-			glm::mat4 modelModel = thisModel.getModel();
-
-			vkCmdPushConstants(
-				commandBuffers[currentImage],
-				pipelineLayout,
-				VK_SHADER_STAGE_VERTEX_BIT,		// Stage to push constants to
-				0,								// Offset of push constants to update
-				sizeof(Model),					// Size of data being pushed
-				&modelModel);			// Actual data being pushed (can be array)
-
-			for (size_t k = 0; k < thisModel.getMeshCount(); k++)
+			if (sceneStore.getRenderableCount() > 0)
 			{
+				vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipeline);
+				vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+				for (uint32_t list = 0; list < DRAW_COMMAND_LIST_COUNT; list++)
+				{
+					vkCmdBindIndexBuffer(commandBuffer, geometryPool.getIndexBuffer(listIndexTypes[list]), 0, listIndexTypes[list]);
+					vkCmdDrawIndexedIndirectCount(commandBuffer,
+						frameDataBuffer[currentImage], commandBase + DRAW_COUNT_SIZE + SHADOW_COMMAND_LIST_SIZE * list,
+						frameDataBuffer[currentImage], commandBase + sizeof(uint32_t) * list,
+						static_cast<uint32_t>(sceneStore.getRenderableCount()), sizeof(VkDrawIndexedIndirectCommand));
+				}
+			}
 
-				// Buffers to bind
-				VkBuffer vertexBuffers[] = { thisModel.getMesh(k)->getVertexBuffer() };
-				VkDeviceSize offsets[] = { 0 };
-				vkCmdBindVertexBuffers(commandBuffers[currentImage], 0, 1, vertexBuffers, offsets);
+		vkCmdEndRenderPass2(commandBuffer, &subpassEndInfo);
+	}
+}
 
-				// Binds mesh index buffer with 0 offset
-				vkCmdBindIndexBuffer(commandBuffers[currentImage], thisModel.getMesh(k)->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-			
-				// Dynamic Offset Amount
-				//uint32_t dynamicOffset = static_cast<uint32_t>(modelUniformAligment) * j;
-	
-				std::array<VkDescriptorSet, 2> descriptorSetGroup = { descriptorSets[currentImage], samplerDescriptorSets[thisModel.getMesh(k)->getTexId()] };
-		
-				// Bind descriptor Sets
-				vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout,
-					0, static_cast<uint32_t>(descriptorSetGroup.size()), descriptorSetGroup.data(), 0, nullptr);
+void VulkanRenderer::recordLightCull(VkCommandBuffer commandBuffer, uint32_t currentImage)
+{
+	// One invocation per froxel, the light count comes from the light params so new lights need no re-record
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, lightCullPipelineLayout,
+		0, 1, &lightCullDescriptorSets[currentImage], 0, nullptr);
+	vkCmdDispatch(commandBuffer, (LIGHT_CLUSTER_COUNT + LIGHT_CULL_GROUP_SIZE - 1) / LIGHT_CULL_GROUP_SIZE, 1, 1);
+
+	VkMemoryBarrier lightGridBarrier = {};
+	lightGridBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	lightGridBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	lightGridBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 1, &lightGridBarrier, 0, nullptr, 0, nullptr);
+}
 
-				// Executes the pipeline
-				vkCmdDrawIndexed(commandBuffers[currentImage], thisModel.getMesh(k)->getIndexCount(), 1, 0, 0, 0);
-			}
-		}
+void VulkanRenderer::recordHistoryCopy(VkCommandBuffer commandBuffer)
+{
+	// History out of the layout the post subpass sampled it in, once that read is done
+	VkImageMemoryBarrier historyBarrier = {};
+	historyBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	historyBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	historyBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	historyBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	historyBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	historyBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	historyBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	historyBarrier.image = historyImage;
+	historyBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	historyBarrier.subresourceRange.baseMipLevel = 0;
+	historyBarrier.subresourceRange.levelCount = 1;
+	historyBarrier.subresourceRange.baseArrayLayer = 0;
+	historyBarrier.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &historyBarrier);
+
+	// The render pass left the resolve in transfer source, its dependency covers the writes
+	VkImageCopy historyCopy = {};
+	historyCopy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	historyCopy.srcSubresource.mipLevel = 0;
+	historyCopy.srcSubresource.baseArrayLayer = 0;
+	historyCopy.srcSubresource.layerCount = 1;
+	historyCopy.dstSubresource = historyCopy.srcSubresource;
+	historyCopy.extent = { swapChainExtent.width, swapChainExtent.height, 1 };
+	vkCmdCopyImage(commandBuffer, taaResolveImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		historyImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &historyCopy);
+
+	// Back for the next frame's post subpass
+	historyBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	historyBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	historyBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	historyBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0, 0, nullptr, 0, nullptr, 1, &historyBarrier);
+}
 
-		// Start second subpass
-		vkCmdNextSubpass2(commandBuffers[currentImage], &subpassBeginInfo, &subpassEndInfo);
+void VulkanRenderer::recordViewport(VkCommandBuffer commandBuffer, VkExtent2D extent)
+{
+	// Top left of the attachments, same depth range as the pipelines were created with
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(extent.width);
+	viewport.height = static_cast<float>(extent.height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-		vkCmdBindPipeline(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipeline);
-		vkCmdBindDescriptorSets(commandBuffers[currentImage], VK_PIPELINE_BIND_POINT_GRAPHICS, secondPipelineLayout,
-			0, 1, &inputDescriptorSets[currentImage], 0, nullptr);
-		vkCmdDraw(commandBuffers[currentImage], 3, 1, 0, 0);
+	VkRect2D scissor = {};
+	scissor.offset = { 0, 0 };
+	scissor.extent = extent;
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+}
 
+void VulkanRenderer::cullJob(void* context, uint32_t slice)
+{
+	VulkanRenderer* renderer = static_cast<VulkanRenderer*>(context);
+	CullJobData& job = renderer->cullJobData;
+
+	// Slices start on a multiple of 4 so every SSE load stays aligned
+	SceneStore& scene = renderer->sceneStore;
+	size_t groupCount = (scene.getRenderableCount() + 3) / 4;
+	size_t firstDraw = groupCount * slice / job.sliceCount * 4;
+	size_t lastDraw = std::min(groupCount * (slice + 1) / job.sliceCount * 4, scene.getRenderableCount());
+	if (firstDraw >= lastDraw) return;
+
+	computeWorldSpheres(scene.getBoundingSpheres() + firstDraw, scene.getTransformIds() + firstDraw, lastDraw - firstDraw,
+		renderer->modelTransforms.data(),
+		job.centerX + firstDraw, job.centerY + firstDraw, job.centerZ + firstDraw, job.radius + firstDraw);
+	cullSpheres(job.centerX + firstDraw, job.centerY + firstDraw, job.centerZ + firstDraw, job.radius + firstDraw,
+		lastDraw - firstDraw, job.planes, job.visible + firstDraw);
+}
 
-	vkCmdEndRenderPass2(commandBuffers[currentImage], &subpassEndInfo);
+uint32_t VulkanRenderer::selectLod(const DrawMesh& draw, float localRadius, glm::vec3 center, float radius, glm::vec3 cameraPosition, float lodScale)
+{
+	// Errors were measured on the local mesh, scale them like the bounding sphere
+	float scale = localRadius > 0.0f ? radius / localRadius : 1.0f;
+	float distance = std::max(glm::length(center - cameraPosition) - radius, 0.001f);
 
-	// Stop recording
-	result = vkEndCommandBuffer(commandBuffers[currentImage]);
-	if (result != VK_SUCCESS)
+	// Coarsest LOD whose error stays under LOD_ERROR_PIXELS on screen, errors only grow with the level
+	uint32_t lod = 0;
+	while (lod + 1 < draw.lodCount && draw.lods[lod + 1].error * scale / distance * lodScale <= 1.0f)
 	{
-		throw std::runtime_error("Failed to stop recording a Command Buffer");
+		lod++;
 	}
+	return lod;
+}
+
+bool VulkanRenderer::isClusterVisible(const MeshCluster& cluster, const Model& object, const glm::vec4 planes[6], glm::vec3 cameraPosition)
+{
+	const glm::mat4& model = object.model;
+	glm::vec3 center = glm::vec3(model * glm::vec4(glm::vec3(cluster.boundingSphere), 1.0f));
+	float scale = std::sqrt(std::max(std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+		glm::dot(glm::vec3(model[1]), glm::vec3(model[1]))), glm::dot(glm::vec3(model[2]), glm::vec3(model[2]))));
+	float radius = cluster.boundingSphere.w * scale;
+
+	for (int i = 0; i < 6; i++)
+	{
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius) return false;
+	}
+
+	// Backfacing when the whole sphere sees the back of the normal cone, normals go through the normal matrix
+	glm::vec3 axis = glm::vec3(object.normal * glm::vec4(glm::vec3(cluster.cone), 0.0f));
+	float axisLength = std::sqrt(glm::dot(axis, axis));
+	if (axisLength == 0.0f) return true;
+
+	glm::vec3 view = center - cameraPosition;
+	return glm::dot(view, axis) / axisLength <= cluster.cone.w * std::sqrt(glm::dot(view, view)) + radius;
 }
 
 QueueFamilyIndices VulkanRenderer::getQueueFamilies(VkPhysicalDevice device)
@@ -2050,21 +5143,72 @@ SwapChainDetails VulkanRenderer::getSwapChainDetails(VkPhysicalDevice device)
 	return swapChainDetails;
 }
 
-VkSampleCountFlagBits VulkanRenderer::getMaxUsableSampleCount()
+VkSampleCountFlags VulkanRenderer::getSupportedSampleCounts()
 {	
 	
 	VkPhysicalDeviceProperties physicalDeviceProperties;
     vkGetPhysicalDeviceProperties(mainDevice.physicalDevice, &physicalDeviceProperties);
 
-    VkSampleCountFlags counts = physicalDeviceProperties.limits.framebufferColorSampleCounts & physicalDeviceProperties.limits.framebufferDepthSampleCounts;
-    if (counts & VK_SAMPLE_COUNT_64_BIT) { return VK_SAMPLE_COUNT_64_BIT; }
-    if (counts & VK_SAMPLE_COUNT_32_BIT) { return VK_SAMPLE_COUNT_32_BIT; }
-    if (counts & VK_SAMPLE_COUNT_16_BIT) { return VK_SAMPLE_COUNT_16_BIT; }
-    if (counts & VK_SAMPLE_COUNT_8_BIT) { return VK_SAMPLE_COUNT_8_BIT; }
-    if (counts & VK_SAMPLE_COUNT_4_BIT) { return VK_SAMPLE_COUNT_4_BIT; }
-    if (counts & VK_SAMPLE_COUNT_2_BIT) { return VK_SAMPLE_COUNT_2_BIT; }
-	
-    return VK_SAMPLE_COUNT_1_BIT;
+	// G-buffer attachments are colour attachments too, the same limit covers them
+    return physicalDeviceProperties.limits.framebufferColorSampleCounts & physicalDeviceProperties.limits.framebufferDepthSampleCounts;
+}
+
+VkSampleCountFlagBits VulkanRenderer::chooseMsaaSamples()
+{
+	// Temporal anti-aliasing jitters a single sampled scene instead
+	if (temporalAA)
+	{
+		return VK_SAMPLE_COUNT_1_BIT;
+	}
+
+	VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+	switch (msaaMode)
+	{
+	case MSAA_OFF:
+		samples = VK_SAMPLE_COUNT_1_BIT;
+		break;
+	case MSAA_2X:
+		samples = VK_SAMPLE_COUNT_2_BIT;
+		break;
+	case MSAA_4X:
+		samples = VK_SAMPLE_COUNT_4_BIT;
+		break;
+	case MSAA_8X:
+		samples = VK_SAMPLE_COUNT_8_BIT;
+		break;
+	case MSAA_AUTO:
+		samples = msaaSamples;
+		// Only steps once a full window of frames is measured, so a single slow frame does not rebuild anything
+		if (msaaFrameCount >= MSAA_ADAPT_FRAMES)
+		{
+			// Dynamic resolution reacts first, samples only go down once the scale is at its lowest and up at full scale
+			float averageFrameTime = msaaFrameTimeSum / static_cast<float>(msaaFrameCount);
+			bool scaleAtMin = !dynamicResolutionTargets || renderScale <= DYNAMIC_RESOLUTION_MIN_SCALE;
+			bool scaleAtMax = !dynamicResolutionTargets || renderScale >= 1.0f;
+			if (averageFrameTime > MSAA_TARGET_FRAME_TIME && samples > VK_SAMPLE_COUNT_1_BIT && scaleAtMin)
+			{
+				samples = static_cast<VkSampleCountFlagBits>(samples >> 1);
+			}
+			else if (averageFrameTime < MSAA_TARGET_FRAME_TIME * MSAA_UPGRADE_RATIO && samples < MSAA_AUTO_MAX_SAMPLES && scaleAtMax)
+			{
+				// Stays at the current count when the device lacks the next one
+				if (supportedMsaaSamples & (samples << 1))
+				{
+					samples = static_cast<VkSampleCountFlagBits>(samples << 1);
+				}
+			}
+			msaaFrameTimeSum = 0.0f;
+			msaaFrameCount = 0;
+		}
+		break;
+	}
+
+	// Highest supported count under the request, every device supports 1
+	while (samples > VK_SAMPLE_COUNT_1_BIT && !(supportedMsaaSamples & samples))
+	{
+		samples = static_cast<VkSampleCountFlagBits>(samples >> 1);
+	}
+	return samples;
 }
 
 VkSurfaceFormatKHR VulkanRenderer::chooseBestSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& formats)
@@ -2180,6 +5324,24 @@ VkImage VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat fo
 	vkGetImageMemoryRequirements(mainDevice.logicalDevice, image, &memoryRequirements);
 
 	// Allocate Memory using requirements
+	// Lazily allocated memory only exists on tile based GPUs, elsewhere transient attachments take plain device memory
+	if (propFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+	{
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		vkGetPhysicalDeviceMemoryProperties(mainDevice.physicalDevice, &memoryProperties);
+
+		bool lazyMemory = false;
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+		{
+			lazyMemory |= (memoryRequirements.memoryTypeBits & (1 << i))
+				&& (memoryProperties.memoryTypes[i].propertyFlags & propFlags) == propFlags;
+		}
+		if (!lazyMemory)
+		{
+			propFlags &= ~VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+		}
+	}
+
 	VkMemoryAllocateInfo memoryAllocInfo = {};
 	memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	memoryAllocInfo.allocationSize = memoryRequirements.size;
@@ -2253,7 +5415,7 @@ VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& code)
 	return shaderModule;
 }
 
-int VulkanRenderer::createTextureImage(std::string filename)
+int VulkanRenderer::createTextureImage(std::string filename, uint32_t textureLoc)
 {
 	// load image file
 	int width, height;
@@ -2296,48 +5458,83 @@ int VulkanRenderer::createTextureImage(std::string filename)
 	//transitionImageLayout(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, texImage,
 	//	VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1);
 
-	// Add textured data to vector 
-	textureImages.push_back(texImage);
-	textureImageMemory.push_back(texImageMemory);
+	// Put textured data in its slot
+	textureImages[textureLoc] = texImage;
+	textureImageMemory[textureLoc] = texImageMemory;
 
 	// Destroy staging buffers
 	vkDestroyBuffer(mainDevice.logicalDevice, imageStagingBuffer, nullptr);
 	vkFreeMemory(mainDevice.logicalDevice, imageStagingBufferMemory, nullptr);
 	
 	// Return index of new texture image
-	return static_cast<int>(textureImages.size() - 1);
+	return static_cast<int>(textureLoc);
 }
 
 int VulkanRenderer::createTexture(std::string filename)
 {
-	// Create texture image and get its index in array
-	int textureImageLoc = createTextureImage(filename);
+	// Slot of a destroyed texture first, the arrays only grow when none is free
+	uint32_t textureLoc;
+	if (!freeTextureSlots.empty())
+	{
+		textureLoc = freeTextureSlots.back();
+		freeTextureSlots.pop_back();
+	}
+	else
+	{
+		if (textureImages.size() >= MAX_TEXTURES)
+		{
+			throw std::runtime_error("Reached maximum number of textures");
+		}
+		textureLoc = static_cast<uint32_t>(textureImages.size());
+		textureImages.push_back(VK_NULL_HANDLE);
+		textureImageMemory.push_back(VK_NULL_HANDLE);
+		textureImageViews.push_back(VK_NULL_HANDLE);
+	}
+
+	// Create texture image in its slot
+	int textureImageLoc = createTextureImage(filename, textureLoc);
 
 	VkImageView imageView = createImageView(textureImages[textureImageLoc], VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
-	textureImageViews.push_back(imageView);
+	textureImageViews[textureImageLoc] = imageView;
 
-	int descriptorLoc = createTextureDescriptor(imageView);
+	int descriptorLoc = createTextureDescriptor(imageView, textureLoc);
 
 	// Return location of set with texture
 	return descriptorLoc;
 }
 
-int VulkanRenderer::createTextureDescriptor(VkImageView textureImage)
+void VulkanRenderer::destroyTexture(uint32_t textureLoc)
 {
-	VkDescriptorSet descriptorSet;
+	// Element shows the default texture again, no pending frame reads it so it can be rewritten now
+	createTextureDescriptor(textureImageViews[0], textureLoc);
 
-	// Descriptor Set allocaiton info
-	VkDescriptorSetAllocateInfo setAllocInfo = {};
-	setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	setAllocInfo.descriptorPool = samplerDescriptorPool;
-	setAllocInfo.descriptorSetCount = 1;
-	setAllocInfo.pSetLayouts = &samplerSetLayout;
+	vkDestroyImageView(mainDevice.logicalDevice, textureImageViews[textureLoc], nullptr);
+	vkDestroyImage(mainDevice.logicalDevice, textureImages[textureLoc], nullptr);
+	vkFreeMemory(mainDevice.logicalDevice, textureImageMemory[textureLoc], nullptr);
+	textureImageViews[textureLoc] = VK_NULL_HANDLE;
+	textureImages[textureLoc] = VK_NULL_HANDLE;
+	textureImageMemory[textureLoc] = VK_NULL_HANDLE;
 
-	// Allocate Descriptor Sets
-	VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, &descriptorSet);
-	if (result != VK_SUCCESS)
+	freeTextureSlots.push_back(textureLoc);
+}
+
+int VulkanRenderer::createTextureDescriptor(VkImageView textureImage, uint32_t textureLoc)
+{
+	// Single set holding every texture, allocated with the first one
+	bool firstTexture = textureDescriptorSet == VK_NULL_HANDLE;
+	if (firstTexture)
 	{
-		throw std::runtime_error("Failed to allocate texture descriptor set");
+		VkDescriptorSetAllocateInfo setAllocInfo = {};
+		setAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+		setAllocInfo.descriptorPool = samplerDescriptorPool;
+		setAllocInfo.descriptorSetCount = 1;
+		setAllocInfo.pSetLayouts = &samplerSetLayout;
+
+		VkResult result = vkAllocateDescriptorSets(mainDevice.logicalDevice, &setAllocInfo, &textureDescriptorSet);
+		if (result != VK_SUCCESS)
+		{
+			throw std::runtime_error("Failed to allocate texture descriptor set");
+		}
 	}
 
 	// Texture image info
@@ -2346,24 +5543,24 @@ int VulkanRenderer::createTextureDescriptor(VkImageView textureImage)
 	imageInfo.imageView = textureImage;
 	imageInfo.sampler = textureSampler;
 
+	// First texture fills every element so the whole array is always valid
+	std::vector<VkDescriptorImageInfo> imageInfos(firstTexture ? MAX_TEXTURES : 1, imageInfo);
+
 	// Descriptor write info
 	VkWriteDescriptorSet descriptorWrite = {};
 	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstSet = textureDescriptorSet;
 	descriptorWrite.dstBinding = 0;
-	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.dstArrayElement = textureLoc;
 	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptorWrite.descriptorCount = 1;
-	descriptorWrite.pImageInfo = &imageInfo;
+	descriptorWrite.descriptorCount = static_cast<uint32_t>(imageInfos.size());
+	descriptorWrite.pImageInfo = imageInfos.data();
 
-	// Update new descriptor set
+	// Update after bind: recorded command buffers stay valid, frames in flight never use this element
 	vkUpdateDescriptorSets(mainDevice.logicalDevice, 1, &descriptorWrite, 0, nullptr);
 
-	// Add descriptor set to list
-	samplerDescriptorSets.push_back(descriptorSet);
-
-	// Return descriptor set location
-	return static_cast<int>(samplerDescriptorSets.size() - 1);
+	// Return texture array location
+	return static_cast<int>(textureLoc);
 }
 
 void VulkanRenderer::generateMipmaps(VkImage image, int32_t width, int32_t height, uint32_t mipLevels)
@@ -2453,7 +5650,7 @@ void VulkanRenderer::generateMipmaps(VkImage image, int32_t width, int32_t heigh
 	endAndSubmitCommandBuffer(mainDevice.logicalDevice, graphicsCommandPool, graphicsQueue, commandBuffer);
 }
 
-int VulkanRenderer::createMeshModel(std::string modelFile)
+SceneHandle VulkanRenderer::createMeshModel(std::string modelFile)
 {
 	// Import model Scene
 	Assimp::Importer importer;
@@ -2463,37 +5660,207 @@ int VulkanRenderer::createMeshModel(std::string modelFile)
 		throw std::runtime_error("Failed to load model: " + modelFile);
 	}
 
-	// 1 to 1 Id placement
-	std::vector<std::string> textureNames = MeshModel::loadMaterials(scene);
+	// Rejected before any texture or geometry is uploaded
+	if (sceneStore.getRenderableCount() + MeshModel::countMeshes(scene->mRootNode) > MAX_DRAW_ITEMS)
+	{
+		throw std::runtime_error("Reached maximum number of draws");
+	}
+
+	// Model root plus one object per node of the file, in one block of the hierarchy
+	uint32_t nodeCount = MeshModel::countNodes(scene->mRootNode) + 1;
+	uint32_t rootNode = transformHierarchy.addNodes(nodeCount);
 
-	// Conversion from materials list id to descriptor array id
-	std::vector<int> matToTex(textureNames.size());
+	// What the model holds so far, given back if anything below fails
+	std::vector<uint32_t> textures;
+	std::vector<Mesh> modelMeshes;
 
-	// Loop over texture names and create texture
-	for (size_t i = 0; i < textureNames.size(); i++)
+	try
 	{
-		// If material had no texture put a 0 in our transition array for default (0 reserved for default tex) 
-		if (textureNames[i].empty())
+		// 1 to 1 Id placement
+		std::vector<std::string> textureNames = MeshModel::loadMaterials(scene);
+
+		// Conversion from materials list id to descriptor array id
+		std::vector<int> matToTex(textureNames.size());
+
+		// Loop over texture names and create texture
+		for (size_t i = 0; i < textureNames.size(); i++)
 		{
-			matToTex[i] = 0;
+			// If material had no texture put a 0 in our transition array for default (0 reserved for default tex) 
+			if (textureNames[i].empty())
+			{
+				matToTex[i] = 0;
+			}
+			else
+			{
+				// Otherwise, create texture as normal, owned by the model
+				matToTex[i] = createTexture(textureNames[i]);
+				textures.push_back(static_cast<uint32_t>(matToTex[i]));
+			}
 		}
-		else
+
+		// Load in all our Meshes, file nodes follow the root in hierarchy order
+		uint32_t nextNode = rootNode + 1;
+		MeshModel::loadNode(&geometryPool, graphicsQueue, graphicsCommandPool,
+			&transformHierarchy, static_cast<int32_t>(rootNode), &nextNode, scene->mRootNode, scene, matToTex, &modelMeshes);
+	}
+	catch (...)
+	{
+		releaseRejectedModel(rootNode, nodeCount, textures, modelMeshes);
+		throw;
+	}
+
+	size_t newClusterCount = 0;
+	for (Mesh& mesh : modelMeshes)
+	{
+		newClusterCount += mesh.getClusters().size();
+	}
+
+	uint32_t firstNewCluster;
+	if (!clusterAllocator.allocate(static_cast<uint32_t>(newClusterCount), &firstNewCluster))
+	{
+		releaseRejectedModel(rootNode, nodeCount, textures, modelMeshes);
+		throw std::runtime_error("Reached maximum number of clusters");
+	}
+	clusterList.resize(clusterAllocator.getEnd());
+
+	// The meshes only carry the import results, the scene keeps their components
+	MeshModel meshModel = MeshModel(modelMeshes, rootNode);
+	SceneHandle model = sceneStore.addModel(rootNode, nodeCount, textures);
+
+	// New nodes are dirty, the next update fills their objects
+	modelTransforms.resize(transformHierarchy.getNodeCount());
+
+	// One renderable per mesh, appended after every existing row, clusters in the allocated range
+	uint32_t nextCluster = firstNewCluster;
+	for (size_t i = 0; i < meshModel.getMeshCount(); i++)
+	{
+		Mesh* mesh = meshModel.getMesh(i);
+
+		GeometryRange geometry = mesh->getGeometry();
+
+		DrawMesh drawMesh = {};
+		drawMesh.positionOffset = glm::vec4(geometry.positionOffset, 0.0f);
+		drawMesh.positionScale = glm::vec4(geometry.positionScale, 0.0f);
+		drawMesh.color = geometry.color;
+		drawMesh.shortIndices = mesh->getIndexType() == VK_INDEX_TYPE_UINT16 ? 1 : 0;
+		drawMesh.vertexOffset = geometry.vertexOffset;
+		drawMesh.geometry = geometry;
+		drawMesh.opacity = mesh->getOpacity();
+		drawMesh.lodCount = mesh->getLodCount();
+		for (uint32_t lod = 0; lod < drawMesh.lodCount; lod++)
+		{
+			drawMesh.lods[lod] = mesh->getLod(lod);
+		}
+
+		// Draw of each cluster is written per frame from the rows, rows move when models are removed
+		const std::vector<MeshCluster>& clusters = mesh->getClusters();
+		drawMesh.firstCluster = nextCluster;
+		drawMesh.clusterCount = static_cast<uint32_t>(clusters.size());
+		for (const MeshCluster& cluster : clusters)
 		{
-			// Otherwise, create texture as normal
-			matToTex[i] = createTexture(textureNames[i]);
+			clusterList[nextCluster++] = cluster;
 		}
+
+		sceneStore.addRenderable(model, mesh->getBounds().sphere, mesh->getTransformNode(),
+			static_cast<uint32_t>(mesh->getTexId()), drawMesh);
+	}
+
+	// Copy the new range to the device local copy, clusters of other models are not touched by the copy
+	if (newClusterCount > 0)
+	{
+		VkDeviceSize clusterDataSize = sizeof(MeshCluster) * newClusterCount;
+
+		VkBuffer stagingBuffer;
+		VkDeviceMemory stagingBufferMemory;
+		createBuffer(mainDevice.physicalDevice, mainDevice.logicalDevice, clusterDataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&stagingBuffer, &stagingBufferMemory);
+
+		void* data;
+		vkMapMemory(mainDevice.logicalDevice, stagingBufferMemory, 0, clusterDataSize, 0, &data);
+		memcpy(data, clusterList.data() + firstNewCluster, static_cast<size_t>(clusterDataSize));
+		vkUnmapMemory(mainDevice.logicalDevice, stagingBufferMemory);
+
+		copyBuffer(mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool, stagingBuffer, clusterBuffer, clusterDataSize,
+			0, sizeof(MeshCluster) * firstNewCluster);
+
+		vkDestroyBuffer(mainDevice.logicalDevice, stagingBuffer, nullptr);
+		vkFreeMemory(mainDevice.logicalDevice, stagingBufferMemory, nullptr);
+	}
+
+	// New draws, every cached command buffer is out of date
+	markSceneDirty();
+
+	return model;
+
+}
+
+void VulkanRenderer::destroyMeshModel(SceneHandle model)
+{
+	if (!sceneStore.isModelValid(model))
+	{
+		return;
+	}
+
+	// Scene rows and transform nodes are copied per image, frames in flight do not read them
+	RemovedModel removed;
+	sceneStore.removeModel(model, &removed);
+	transformHierarchy.removeNodes(removed.rootNode, removed.nodeCount);
+	modelTransforms.resize(transformHierarchy.getNodeCount());
+
+	// Geometry, clusters and textures are shared, kept until no frame recorded before now is in flight
+	pendingDeletions.push_back({ frameNumber, removed });
+
+	markSceneDirty();
+}
+
+void VulkanRenderer::releaseModelResources(const RemovedModel& removed)
+{
+	for (const DrawMesh& mesh : removed.meshes)
+	{
+		geometryPool.free(mesh.geometry);
+		clusterAllocator.free(mesh.firstCluster, mesh.clusterCount);
 	}
+	clusterList.resize(clusterAllocator.getEnd());
 
-	// Load in all our Meshes
-	std::vector<Mesh> modelMeshes = MeshModel::loadNode(mainDevice.physicalDevice, mainDevice.logicalDevice, graphicsQueue, graphicsCommandPool,
-		scene->mRootNode, scene, matToTex);
+	for (uint32_t texture : removed.textures)
+	{
+		destroyTexture(texture);
+	}
+}
 
-	// Create mesh model and add to list
-	MeshModel meshModel = MeshModel(modelMeshes);
-	modelList.push_back(meshModel);
+void VulkanRenderer::releaseRejectedModel(uint32_t rootNode, uint32_t nodeCount, const std::vector<uint32_t>& textures,
+	std::vector<Mesh>& meshes)
+{
+	// Nothing of it was drawn, so everything goes back straight away
+	RemovedModel rejected = { rootNode, nodeCount, textures, {} };
+	for (Mesh& mesh : meshes)
+	{
+		DrawMesh drawMesh = {};
+		drawMesh.geometry = mesh.getGeometry();
+		rejected.meshes.push_back(drawMesh);
+	}
 
-	return static_cast<int>(modelList.size() - 1);
+	transformHierarchy.removeNodes(rootNode, nodeCount);
+	releaseModelResources(rejected);
+}
 
+void VulkanRenderer::processPendingDeletions()
+{
+	// Called once the fence of the current frame is waited: every frame submitted
+	// MAX_FRAMES_DRAWS - 1 or more frames ago has finished on the GPU
+	for (size_t i = 0; i < pendingDeletions.size();)
+	{
+		if (pendingDeletions[i].frame + MAX_FRAMES_DRAWS - 1 <= frameNumber)
+		{
+			releaseModelResources(pendingDeletions[i].model);
+			pendingDeletions.erase(pendingDeletions.begin() + i);
+		}
+		else
+		{
+			i++;
+		}
+	}
 }
 
 stbi_uc* VulkanRenderer::loadTextureFile(std::string filename, int* width, int* height, VkDeviceSize* imageSize)
@@ -18,6 +18,7 @@
 #include <set>
 #include <algorithm>
 #include <array>
+#include <cmath>
 
 #include "stb_image.h"
 
@@ -25,6 +26,17 @@
 #include "Mesh.h"
 #include "MeshModel.h"
 #include "Camera.h"
+#include "SimdMath.h"
+#include "ThreadPool.h"
+#include "LinearAllocator.h"
+#include "MemoryStats.h"
+#include "GeometryPool.h"
+#include "TransformHierarchy.h"
+#include "SceneStore.h"
+#include "RangeAllocator.h"
+#include "RenderQueue.h"
+#include "Light.h"
+#include "Shadow.h"
 
 
 class VulkanRenderer
@@ -34,12 +46,21 @@ public:
 
 	int init(GLFWwindow* newWindow);
 
-	int createMeshModel(std::string modelFile);
-	void updateModel(int modelId, glm::mat4 newModel);
+	SceneHandle createMeshModel(std::string modelFile);
+	// The model stops drawing from the next frame, its geometry, clusters and textures are released
+	// once every frame already submitted has finished
+	void destroyMeshModel(SceneHandle model);
+	void updateModel(SceneHandle model, glm::mat4 newModel);
 	void processInput(GLFWwindow* window, float deltaTime);
 	void mouseCallback(GLFWwindow* window, double xposIn, double yposIn);
 	void updateView(); 
 
+	// Point lights, shaded through the light clusters, a light index stays valid for the renderer lifetime
+	int addLight(glm::vec3 position, glm::vec3 color, float radius);
+	void updateLight(int light, glm::vec3 position, glm::vec3 color, float radius);
+	// Directional light casting the cascaded shadows, direction is the way the light travels
+	void setSunLight(glm::vec3 direction, glm::vec3 color);
+
 	// camera
 	Camera camera;
 	float lastX = swapChainExtent.width / 2.0f;
@@ -49,6 +70,38 @@ public:
 	void draw();
 	void cleanup();
 
+	// Counters of the last drawn frame
+	struct FrameStats {
+		uint64_t heapAllocations;		// operator new calls during draw(), 0 in steady state (nothing re-recorded)
+		size_t arenaBytes;				// CPU frame arena usage
+		size_t gpuScratchBytes;			// GPU frame data scratch usage
+		uint32_t drawCount;				// Meshes in the scene
+		uint32_t visibleDraws;			// Meshes left after culling, GPU culling adds occlusion (from the last frame on this image)
+		uint32_t shadowCascades;		// Shadow cascades rendered, the others kept their cached map
+		float gpuFrameTime;				// Milliseconds between the first and last command of the last frame on this image
+		uint32_t msaaSamples;			// Samples of the scene attachments
+		float renderScale;				// Scene resolution over the swapchain resolution, on each axis
+	};
+	const FrameStats& getFrameStats();
+
+	// Cull on the GPU with a compute pass (default) or on the CPU, both feed the same indirect count draw
+	void setGpuCulling(bool enabled);
+
+	// Deferred shading: opaque draws fill a G-buffer and every pixel is lit once from its froxel lights,
+	// the early pass only writes depth. Forward shading (default) lights every fragment drawn
+	void setDeferredShading(bool enabled);
+
+	// Fixed MSAA sample count or MSAA_AUTO, applied at the start of the next frame
+	void setMsaaMode(MsaaMode mode);
+
+	// Temporal anti-aliasing: jittered single sampled scene resolved against the reprojected last frames in the second pass
+	// Takes over from the MSAA mode while on, applied at the start of the next frame
+	void setTemporalAntiAliasing(bool enabled);
+
+	// Dynamic resolution (default): scene resolution follows the GPU frame time, upscaled to the swapchain by the second pass
+	// Applied at the start of the next frame, ignored while temporal anti-aliasing is on
+	void setDynamicResolution(bool enabled);
+
 	~VulkanRenderer();
 
 private:
@@ -57,14 +110,110 @@ private:
 	// Frame
 	int currentFrame = 0;
 
-	// Scene objects
-	std::vector<MeshModel> modelList;
+	// Scene objects: models and their renderables as dense component arrays, a renderable row is its draw index
+	SceneStore sceneStore;
+	// Node transforms of every model, a root per model with the file nodes under it
+	TransformHierarchy transformHierarchy;
+	// Per object shader data, 1 to 1 with the transform hierarchy nodes
+	std::vector<Model> modelTransforms;
+
+	// Copied to the light region of the frame data every frame, the light cull compute sorts them into froxels
+	std::vector<PointLight> lights;
+
+	// Cascade fitting and caching of the sun shadows, its params are copied to the frame data every frame
+	ShadowCascades shadowCascades;
+
+	// Clusters of every clustered draw, also kept in clusterBuffer for the cull compute
+	// Each draw has a range from clusterAllocator, the list is as long as its end
+	std::vector<MeshCluster> clusterList;
+	RangeAllocator clusterAllocator;
+
+	// Resources of destroyed models, released once the frames submitted before the removal are done
+	struct PendingDeletion {
+		uint64_t frame;				// frameNumber when the model was destroyed
+		RemovedModel model;
+	};
+	std::vector<PendingDeletion> pendingDeletions;
+	uint64_t frameNumber = 0;		// Frames submitted so far
+
+	// Command buffers are only re-recorded when the scene structure changed since their last record
+	std::vector<bool> commandBufferDirty;
+
+	// Transient CPU memory for one frame in flight, reset once its fence has signalled
+	std::array<LinearAllocator, MAX_FRAMES_DRAWS> frameArenas;
+	FrameStats frameStats = {};
 
 	// Scene settings
+	// projection stays without the temporal anti-aliasing jitter, only the copy in the frame data has it
 	struct UboViewProjection {
 		glm::mat4 projection;
 		glm::mat4 view;
+		glm::mat4 viewProjection;			// Without the jitter, for the motion vectors
+		glm::mat4 previousViewProjection;
 	} uboViewProjection;
+	glm::mat4 previousViewProjection = glm::mat4(1.0f);		// Last frame's viewProjection
+
+	// Uniform of second.frag with temporal anti-aliasing or dynamic resolution
+	struct PostParams {
+		glm::vec2 renderScale;		// Part of the scene attachments drawn to
+		float historyWeight;		// 0 when the history does not hold a previous frame
+		float padding;
+	};
+
+	// Uniforms of cull.comp
+	struct CullParams {
+		glm::vec4 planes[6];
+		glm::mat4 view;
+		glm::vec4 projection;		// P00, P11, P22, P32, enough to project bounding spheres
+		glm::vec4 cameraPosition;	// xyz world position, w pixels per unit of error at distance 1 for LOD selection
+		glm::vec2 pyramidSize;
+		uint32_t drawCount;
+		uint32_t clusterCount;
+	};
+
+	// Push constant of cull.comp: early phase draws what was visible last frame, late phase tests the rest against the depth pyramid
+	enum CullPhase : uint32_t {
+		CULL_PHASE_EARLY = 0,
+		CULL_PHASE_LATE = 1
+	};
+
+	// What scene draws left bound in the command buffer being recorded, binds that would not change anything are skipped
+	// Bindings survive render pass boundaries, the pipelines of the scene passes share pipelineLayout
+	struct SceneBindState {
+		VkPipeline pipeline;
+		bool sceneSetsBound;
+		bool vertexBufferBound;
+		int32_t indexList;			// Command list whose index buffer is bound, -1 for none
+	};
+
+	// MSAA policy, msaaSamples follows it. MSAA_AUTO sums the GPU frame times since the last change
+	MsaaMode msaaMode = DEFAULT_MSAA_MODE;
+	VkSampleCountFlags supportedMsaaSamples = VK_SAMPLE_COUNT_1_BIT;	// Counts both color and depth attachments support
+	float msaaFrameTimeSum = 0.0f;
+	uint32_t msaaFrameCount = 0;
+
+	// Temporal anti-aliasing requested, and what the current targets were built for
+	bool temporalAA = DEFAULT_TEMPORAL_AA;
+	bool temporalAATargets = DEFAULT_TEMPORAL_AA;
+	bool taaHistoryValid = false;		// History holds a frame rendered with the current targets
+
+	// Dynamic resolution requested and built for, and the scale of the recorded command buffers
+	bool dynamicResolution = DEFAULT_DYNAMIC_RESOLUTION;
+	bool dynamicResolutionTargets = DEFAULT_DYNAMIC_RESOLUTION && !DEFAULT_TEMPORAL_AA;
+	float renderScale = 1.0f;
+	uint32_t renderScaleSettleFrames = 0;		// Frames left drawn before the last change, their times are not used
+	uint32_t renderScaleUpgradeFrames = 0;		// Frames in a row under the upgrade ratio
+
+	// GPU time of each image's last frame: timestamps at the start and end of its command buffer
+	VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+	float timestampPeriod = 0.0f;		// Nanoseconds per tick, 0 when the graphics queue has no timestamps
+	uint64_t timestampMask = 0;
+	std::vector<bool> timestampsSubmitted;
+
+	// Culling
+	bool gpuCulling = true;
+	bool deferredShading = false;
+	GeometryPool geometryPool;
 
 	// Main Vulkan Components
 	VkInstance instance;
@@ -85,22 +234,46 @@ private:
 	std::vector<VkFramebuffer> swapChainFramebuffers;
 	std::vector<VkCommandBuffer> commandBuffers;
 
-	std::vector<VkImage> colorBufferImage;
-	std::vector<VkDeviceMemory> colorBufferImageMemory;
-	std::vector<VkImageView> colorBufferImageView;
+	// Multisampled color and depth, one of each shared by every swapchain image
+	// Frames on the queue are ordered by the external dependencies of the render passes using them
+	VkImage colorBufferImage;
+	VkDeviceMemory colorBufferImageMemory;
+	VkImageView colorBufferImageView;
 
 	std::vector<VkImage> resolvedColorBufferImage;
 	std::vector<VkDeviceMemory> resolvedColorBufferImageMemory;
 	std::vector<VkImageView> resolvedColorBufferImageView;
 
-	std::vector<VkImage> depthBufferImage;
-	std::vector<VkDeviceMemory> depthBufferImageMemory;
-	std::vector<VkImageView> depthBufferImageView;
+	VkImage depthBufferImage;
+	VkDeviceMemory depthBufferImageMemory;
+	VkImageView depthBufferImageView;
 
 	std::vector<VkImage> resolvedDepthBufferImage;
 	std::vector<VkDeviceMemory> resolvedDepthBufferImageMemory;
 	std::vector<VkImageView> resolvedDepthBufferImageView;
 
+	// Deferred G-buffer, shared like the color buffer and multisampled like it
+	// Written and read inside the deferred render pass only: transient, lazily allocated where the device has such memory
+	// so tile based GPUs never back it at all
+	std::array<VkFormat, GBUFFER_ATTACHMENT_COUNT> gBufferFormats;
+	std::array<VkImage, GBUFFER_ATTACHMENT_COUNT> gBufferImage;
+	std::array<VkDeviceMemory, GBUFFER_ATTACHMENT_COUNT> gBufferImageMemory;
+	std::array<VkImageView, GBUFFER_ATTACHMENT_COUNT> gBufferImageView;
+
+	// Temporal anti-aliasing targets, only created while it is on, shared by every image like the color buffer
+	// Velocity is written with the scene color and read by the second pass, which also writes the resolved color
+	// to taaResolveImage. That is copied to historyImage after the pass for the next frame to sample
+	VkFormat velocityFormat;
+	VkImage velocityImage = VK_NULL_HANDLE;
+	VkDeviceMemory velocityImageMemory;
+	VkImageView velocityImageView;
+	VkImage taaResolveImage = VK_NULL_HANDLE;
+	VkDeviceMemory taaResolveImageMemory;
+	VkImageView taaResolveImageView;
+	VkImage historyImage = VK_NULL_HANDLE;
+	VkDeviceMemory historyImageMemory;
+	VkImageView historyImageView;
+	VkSampler postSampler;		// Linear, clamped: history and the scene attachments read by the second pass
 	
 	VkSampler textureSampler;
 
@@ -108,23 +281,44 @@ private:
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorSetLayout samplerSetLayout;
 	VkDescriptorSetLayout inputSetLayout;
-	VkPushConstantRange pushConstantRange;
+	VkDescriptorSetLayout gBufferInputSetLayout;
 
 	VkDescriptorPool descriptorPool;
 	VkDescriptorPool samplerDescriptorPool;
 	VkDescriptorPool inputDescriptorPool;
 
 	std::vector<VkDescriptorSet> descriptorSets;
-	std::vector<VkDescriptorSet> samplerDescriptorSets;
+	VkDescriptorSet textureDescriptorSet = VK_NULL_HANDLE;		// Every texture in one array, indexed with DrawItem::texId
+	std::vector<uint32_t> freeTextureSlots;		// Array elements of destroyed textures, they show the default texture
 	std::vector<VkDescriptorSet> inputDescriptorSets;
-
-	std::vector<VkBuffer> vpUniformBuffer;
-	std::vector<VkDeviceMemory> vpUniformBufferMemory;
+	std::vector<VkDescriptorSet> gBufferInputDescriptorSets;	// G-buffer and depth for the deferred lighting subpass
 
 	std::vector<VkBuffer> modelDynUniformBuffer;
 	std::vector<VkDeviceMemory> modelDynUniformBufferMemory;
 
-	//VkDeviceSize minUniformBufferOffset;
+	// One persistently mapped buffer per image for everything written each frame
+	// Fixed regions (view projection, object data) first, then scratch reset every frame
+	std::vector<VkBuffer> frameDataBuffer;
+	std::vector<VkDeviceMemory> frameDataBufferMemory;
+	std::vector<LinearAllocator> frameDataAllocators;
+	VkDeviceSize vpUniformOffset = 0;
+	VkDeviceSize objectDataOffset = 0;
+	VkDeviceSize drawDataOffset = 0;		// Scene store draw records, read by the vertex shader and cull.comp
+	VkDeviceSize clusterDrawOffset = 0;		// Draw of each cluster matching the draw records, ~0 for free clusters
+	VkDeviceSize drawCommandOffset = 0;		// CPU culling output: draw count then compacted VkDrawIndexedIndirectCommands
+	VkDeviceSize transparentCommandOffset = 0;	// Transparent draws back to front: draw count then one 32 bit index command list
+	VkDeviceSize cullParamsOffset = 0;
+	VkDeviceSize cullStatsOffset = 0;		// GPU culling early then late counts of each command list, copied back by the command buffer
+	VkDeviceSize lightParamsOffset = 0;
+	VkDeviceSize lightDataOffset = 0;		// MAX_LIGHTS point lights, the first LightParams::lightCount are used
+	VkDeviceSize shadowParamsOffset = 0;
+	VkDeviceSize shadowCommandOffset = 0;	// Casters of each cascade, SHADOW_COMMAND_REGION_SIZE apart, laid out as drawCommandOffset
+	VkDeviceSize shadowClearOffset = 0;		// Clear draw of each cascade, instance count 0 keeps its cached map
+	VkDeviceSize postParamsOffset = 0;
+	size_t frameDataScratchMarker = 0;
+
+	VkDeviceSize minUniformBufferOffset;
+	VkDeviceSize minStorageBufferOffset;
 	//size_t modelUniformAligment;
 	//UboModel* modelTransferSpace;
 
@@ -147,9 +341,102 @@ private:
 
 	VkRenderPass renderPass;
 
+	// Early pass: draws visible last frame, fills color and depth before the depth pyramid is built
+	VkRenderPass earlyRenderPass;
+	VkPipeline earlyGraphicsPipeline;
+	std::vector<VkFramebuffer> earlyFramebuffers;
+
+	// Blended, no depth writes, drawn after every opaque draw in the main pass
+	VkPipeline transparentPipeline;
+	std::vector<uint32_t> transparentRows;		// Scene rows with opacity under 1, rebuilt with the draw data
+
+	// Deferred render pass: G-buffer, lighting, transparent draws and the second pass shader in 4 subpasses
+	// Shares the color and depth buffers with the forward passes, the early pass then runs earlyDepthPipeline
+	VkRenderPass deferredRenderPass;
+	std::vector<VkFramebuffer> deferredFramebuffers;
+	VkPipeline earlyDepthPipeline;
+	VkPipeline gBufferPipeline;
+	VkPipeline lightingPipeline;
+	VkPipelineLayout lightingPipelineLayout;
+	VkPipeline deferredTransparentPipeline;
+	VkPipeline deferredSecondPipeline;
+
+	VkPipeline cullPipeline;
+	VkPipelineLayout cullPipelineLayout;
+	VkDescriptorSetLayout cullSetLayout;
+	std::vector<VkDescriptorSet> cullDescriptorSets;
+
+	// GPU culling output per image, device local: early then late region, each a draw count then compacted commands
+	std::vector<VkBuffer> cullOutputBuffer;
+	std::vector<VkDeviceMemory> cullOutputBufferMemory;
+	VkDeviceSize cullLateOutputOffset = 0;
+
+	// Last frame visibility of every draw, written by the late cull phase
+	VkBuffer drawVisibilityBuffer;
+	VkDeviceMemory drawVisibilityBufferMemory;
+
+	// Scene clusters, device local, appended when a model is added, and their last frame visibility
+	VkBuffer clusterBuffer;
+	VkDeviceMemory clusterBufferMemory;
+	VkBuffer clusterVisibilityBuffer;
+	VkDeviceMemory clusterVisibilityBufferMemory;
+
+	// Clustered lighting: light count of each froxel then MAX_LIGHTS_PER_CLUSTER light indices per froxel
+	// Per image, device local, rebuilt at the start of every frame before any draw reads it
+	VkPipeline lightCullPipeline;
+	VkPipelineLayout lightCullPipelineLayout;
+	VkDescriptorSetLayout lightCullSetLayout;
+	std::vector<VkDescriptorSet> lightCullDescriptorSets;
+	std::vector<VkBuffer> lightGridBuffer;
+	std::vector<VkDeviceMemory> lightGridBufferMemory;
+	VkDeviceSize lightGridSize = 0;
+
+	// Hi-Z depth pyramid: max depth per texel, power of two, built from the early pass depth
+	VkImage depthPyramidImage;
+	VkDeviceMemory depthPyramidImageMemory;
+	VkImageView depthPyramidImageView;
+	std::vector<VkImageView> depthPyramidMipViews;
+	uint32_t depthPyramidWidth = 0;
+	uint32_t depthPyramidHeight = 0;
+	uint32_t depthPyramidLevels = 0;
+	VkSampler depthPyramidSampler;
+
+	// Cascaded shadow map: a depth layer per cascade, shared by every image and kept between frames
+	// The commands of the shadow passes are the same every frame, what a cascade draws comes from the frame data
+	VkFormat shadowMapFormat;
+	VkImage shadowMapImage;
+	VkDeviceMemory shadowMapImageMemory;
+	VkImageView shadowMapImageView;
+	std::array<VkImageView, SHADOW_CASCADE_COUNT> shadowCascadeViews;
+	std::array<VkFramebuffer, SHADOW_CASCADE_COUNT> shadowFramebuffers;
+	VkSampler shadowMapSampler;
+	VkRenderPass shadowRenderPass;
+	VkPipeline shadowPipeline;
+	VkPipeline shadowClearPipeline;
+	VkPipelineLayout shadowPipelineLayout;
+
+	VkPipeline hizPipeline;
+	VkPipelineLayout hizPipelineLayout;
+	VkDescriptorSetLayout hizSetLayout;
+	VkDescriptorPool hizDescriptorPool;
+	std::vector<VkDescriptorSet> hizDescriptorSets;		// depthPyramidLevels per image, level 0 reads that image's depth
+
 	// Pools
 	VkCommandPool graphicsCommandPool;
 
+	// CPU culling, large scenes are split over worker threads
+	ThreadPool cullThreadPool;
+	struct CullJobData {
+		float* centerX;
+		float* centerY;
+		float* centerZ;
+		float* radius;
+		uint8_t* visible;
+		glm::vec4 planes[6];
+		uint32_t sliceCount;
+	} cullJobData = {};
+	RenderQueue renderQueue;		// CPU culled commands of the frame in draw order
+
 	// Utility Vulkan Components
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
@@ -158,6 +445,7 @@ private:
 	std::vector<VkSemaphore> imageAvailable;
 	std::vector<VkSemaphore> renderFinished;
 	std::vector<VkFence> drawFences;
+	std::vector<VkFence> imageFences;		// Fence of the last frame that rendered to each swapchain image
 	
 	#ifdef NDEBUG
 	const bool enableValidationLayers = false;
@@ -172,31 +460,76 @@ private:
 	void createSurface();
 	void createSwapChain();
 	void createRenderPass();
+	void createEarlyRenderPass();
+	void createDeferredRenderPass();
 	void createDescriptorSetLayout();
-	void createPushConstantRange();
 	void createGraphicsPipeline();
 	void createColorBufferImage();
 	void createResolvedColorBufferImage();
 	void createDepthBufferImage();
 	void createResolvedDepthBufferImage();
+	void createGBufferImages();
+	void createTemporalAAImages();
 	void createFramebuffer();
 	void createCommandPool();
 	void createCommandBuffers();
 	void createSynchronisation();
 	void createTextureSampler();
+	void createCullPipeline();
+	void createCullBuffers();
+	void createLightCullPipeline();
+	void createLightBuffers();
+	void createDepthPyramid();
+	void createHizPipeline();
+	void createShadowRenderPass();
+	void createShadowMap();
+	void createShadowPipeline();
+	void createTimestampQueries();
+	// Render passes, pipelines, multisampled attachments and framebuffers: everything built for msaaSamples
+	// and temporal anti-aliasing
+	void recreateMultisampleTargets(VkSampleCountFlagBits samples);
+	void destroyMultisampleTargets();
 
 	void setupDebugMessenger();
 	void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
 	void createUniformBuffers();
+	void createFrameArenas();
 
 	void createDescriptorPool();
 	void createDescriptorSets();
 	void createInputDescriptorSets();
+	void writeInputDescriptorSets();
+	void writeHizDescriptorSets();
 
 	void updateUniformBuffers(uint32_t imageIndex);
+	void updateModelTransforms();
+	void updateDrawData(uint32_t imageIndex);
+	void cullDraws(uint32_t imageIndex);
+	void updateShadows(uint32_t imageIndex);
+	// True when a new time was read into frameStats.gpuFrameTime
+	bool readGpuFrameTime(uint32_t imageIndex);
+	void updateMsaaSamples();
+	void updateRenderScale();
+	// Part of the attachments the scene is drawn to at the current scale
+	VkExtent2D getRenderExtent();
+	uint32_t sortTransparentDraws(uint8_t* frameDataMapped, const glm::vec4 planes[6], float lodScale);
+	static void cullJob(void* context, uint32_t slice);
+	static uint32_t selectLod(const DrawMesh& mesh, float localRadius, glm::vec3 center, float radius, glm::vec3 cameraPosition, float lodScale);
+	static bool isClusterVisible(const MeshCluster& cluster, const Model& object, const glm::vec4 planes[6], glm::vec3 cameraPosition);
+	void markSceneDirty();
 
 	// Record Functions
 	void recordCommands(uint32_t currentImage);
+	void recordCullCommands(VkCommandBuffer commandBuffer, uint32_t currentImage, CullPhase phase);
+	void recordDepthPyramid(VkCommandBuffer commandBuffer, uint32_t currentImage);
+	void recordLightCull(VkCommandBuffer commandBuffer, uint32_t currentImage);
+	void recordShadowPasses(VkCommandBuffer commandBuffer, uint32_t currentImage);
+	void recordHistoryCopy(VkCommandBuffer commandBuffer);
+	void recordViewport(VkCommandBuffer commandBuffer, VkExtent2D extent);
+	void bindSceneState(VkCommandBuffer commandBuffer, uint32_t currentImage, VkPipeline pipeline, SceneBindState* bindState);
+	void recordSceneDraws(VkCommandBuffer commandBuffer, uint32_t currentImage, VkPipeline pipeline,
+		VkBuffer drawCommandBuffer, VkDeviceSize drawCommandBase, SceneBindState* bindState);
+	void recordTransparentDraws(VkCommandBuffer commandBuffer, uint32_t currentImage, VkPipeline pipeline, SceneBindState* bindState);
 
 	// - Get Functions
 	void getPhysicalDevice();
@@ -216,7 +549,8 @@ private:
 	//--Getter Functions
 	QueueFamilyIndices getQueueFamilies(VkPhysicalDevice device);
 	SwapChainDetails getSwapChainDetails(VkPhysicalDevice device);
-	VkSampleCountFlagBits getMaxUsableSampleCount();
+	VkSampleCountFlags getSupportedSampleCounts();
+	VkSampleCountFlagBits chooseMsaaSamples();
 
 	//--Choose Functions
 	VkSurfaceFormatKHR chooseBestSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &formats);
@@ -230,9 +564,14 @@ private:
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
 	VkShaderModule createShaderModule(const std::vector<char>& code);
 
-	int createTextureImage(std::string filename);
+	int createTextureImage(std::string filename, uint32_t textureLoc);
 	int createTexture(std::string filename);
-	int createTextureDescriptor(VkImageView textureImage);
+	int createTextureDescriptor(VkImageView textureImage, uint32_t textureLoc);
+	void destroyTexture(uint32_t textureLoc);
+	void releaseModelResources(const RemovedModel& model);
+	// Model that failed during createMeshModel: its node block, textures and the meshes uploaded before the failure
+	void releaseRejectedModel(uint32_t rootNode, uint32_t nodeCount, const std::vector<uint32_t>& textures, std::vector<Mesh>& meshes);
+	void processPendingDeletions();
 
 	void generateMipmaps(VkImage image, int32_t width, int32_t height, uint32_t mipLevels);
 
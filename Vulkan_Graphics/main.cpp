@@ -50,10 +50,12 @@ int main()
 	vulkanRenderer.camera.Up = glm::vec3(0.0f, 1.0f, 0.0f);
 
 	//int helicopter = vulkanRenderer.createMeshModel("Models/viking_room.obj");
-	int spaceShip = vulkanRenderer.createMeshModel("Models/E45.obj");
-	int plane = vulkanRenderer.createMeshModel("Models/plane.obj");
-	int teapot = vulkanRenderer.createMeshModel("Models/teapot.obj");
-	int teapot2 = vulkanRenderer.createMeshModel("Models/teapot.obj");
+	SceneHandle spaceShip = vulkanRenderer.createMeshModel("Models/E45.obj");
+	SceneHandle plane = vulkanRenderer.createMeshModel("Models/plane.obj");
+	SceneHandle teapot = vulkanRenderer.createMeshModel("Models/teapot.obj");
+	SceneHandle teapot2 = vulkanRenderer.createMeshModel("Models/teapot.obj");
+
+	vulkanRenderer.addLight(glm::vec3(3.0f, 5.0f, 2.0f), glm::vec3(1.0f, 1.0f, 1.0f), 60.0f);
 
 	//loop until close
 	while (!glfwWindowShouldClose(window))